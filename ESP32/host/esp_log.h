@@ -0,0 +1,29 @@
+/*
+ * esp_log.h for the host build: to stderr, up to host_log_level
+ */
+#ifndef HOST_ESP_LOG_H
+#define HOST_ESP_LOG_H
+
+#include <stdio.h>
+
+#define ESP_LOG_NONE 0
+#define ESP_LOG_ERROR 1
+#define ESP_LOG_WARN 2
+#define ESP_LOG_INFO 3
+
+extern int host_log_level;
+
+#define HOST_LOG(level, letter, tag, format, ...)                               \
+    do                                                                          \
+    {                                                                           \
+        if (host_log_level >= (level))                                          \
+        {                                                                       \
+            fprintf(stderr, letter " (%s) " format "\n", tag, ##__VA_ARGS__);   \
+        }                                                                       \
+    } while (0)
+
+#define ESP_LOGE(tag, format, ...) HOST_LOG(ESP_LOG_ERROR, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) HOST_LOG(ESP_LOG_WARN, "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) HOST_LOG(ESP_LOG_INFO, "I", tag, format, ##__VA_ARGS__)
+
+#endif
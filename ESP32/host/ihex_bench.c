@@ -0,0 +1,362 @@
+/*
+ * ihex_bench.c
+ *
+ * Throughput of the Intel HEX decoding in main/ihex.c against the converter it
+ * replaced (two passes, strtol for every field and data byte, the image in a
+ * malloc'd buffer), on synthetic HEX files of the usual objcopy shape. Both read
+ * from and write to memory, so what is compared is the parsing. See README.md.
+ */
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "ihex.h"
+
+#define BENCH_SIZES "4,32,111"      // KB of binary image
+#define BENCH_RECORD_SIZE 16        // data bytes per record, what objcopy writes
+#define BENCH_CHUNK_SIZE 2048       // text per ihex_image_feed, UPLOAD_CHUNK_SIZE in http_server.c
+#define BENCH_MIN_RUN_MS 300        // each method runs at least this long, the fastest pass counts
+#define BENCH_APP_ADDRESS 0x08004000U
+#define BENCH_IMAGE_MAX (1024 * 1024)
+
+int host_log_level = ESP_LOG_ERROR;
+
+static double now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+/*
+ * Test input
+ */
+
+static size_t append_record(char *out, uint8_t type, uint16_t address, const uint8_t *data, uint8_t length)
+{
+    uint8_t sum = length + (address >> 8) + address + type;
+    size_t n = sprintf(out, ":%02X%04X%02X", length, address, type);
+    for (uint8_t i = 0; i < length; i++)
+    {
+        n += sprintf(out + n, "%02X", data[i]);
+        sum += data[i];
+    }
+    return n + sprintf(out + n, "%02X\r\n", (uint8_t)-sum);
+}
+
+// HEX text of `size` random bytes at the application address, CRLF as objcopy on Windows writes it
+static char *make_hex(const uint8_t *image, size_t size, size_t *hex_size)
+{
+    char *hex = malloc(size * 3 + size / BENCH_RECORD_SIZE * 16 + 256);
+    size_t n = 0;
+    uint32_t upper = UINT32_MAX;
+
+    for (size_t offset = 0; offset < size; offset += BENCH_RECORD_SIZE)
+    {
+        uint32_t address = BENCH_APP_ADDRESS + offset;
+        if (address >> 16 != upper)
+        {
+            upper = address >> 16;
+            uint8_t ela[2] = {upper >> 8, upper};
+            n += append_record(hex + n, 0x04, 0, ela, 2);
+        }
+        size_t length = size - offset < BENCH_RECORD_SIZE ? size - offset : BENCH_RECORD_SIZE;
+        n += append_record(hex + n, 0x00, address & 0xFFFF, image + offset, length);
+    }
+    uint8_t entry[4] = {0x08, 0x00, 0x41, 0x31};
+    n += append_record(hex + n, 0x05, 0, entry, 4);
+    n += append_record(hex + n, 0x01, 0, NULL, 0);
+    *hex_size = n;
+    return hex;
+}
+
+/*
+ * Converter before the streaming decoder, from http_server.c, taking streams
+ * instead of paths and without the log lines
+ */
+
+static esp_err_t legacy_convert(FILE *hex_file, FILE *bin_file, size_t *size)
+{
+    char line[256];
+    uint32_t min_address = 0xFFFFFFFF;
+    uint32_t max_address = 0;
+    uint32_t base_address = 0;
+    bool first_data_record = true;
+
+    // First pass: find the address range
+    while (fgets(line, sizeof(line), hex_file))
+    {
+        if (line[0] != ':')
+            continue;
+
+        char byte_count_str[3] = {line[1], line[2], '\0'};
+        char address_str[5] = {line[3], line[4], line[5], line[6], '\0'};
+        char record_type_str[3] = {line[7], line[8], '\0'};
+
+        uint8_t byte_count = (uint8_t)strtol(byte_count_str, NULL, 16);
+        uint16_t address = (uint16_t)strtol(address_str, NULL, 16);
+        uint8_t record_type = (uint8_t)strtol(record_type_str, NULL, 16);
+
+        if (record_type == 0x00)
+        {
+            uint32_t full_address = base_address + address;
+            uint32_t end_address = full_address + byte_count;
+            if (first_data_record)
+            {
+                min_address = full_address;
+                first_data_record = false;
+            }
+            if (full_address < min_address)
+                min_address = full_address;
+            if (end_address > max_address)
+                max_address = end_address;
+        }
+        else if (record_type == 0x04)
+        {
+            char ext_addr_str[5] = {line[9], line[10], line[11], line[12], '\0'};
+            base_address = ((uint32_t)strtol(ext_addr_str, NULL, 16)) << 16;
+        }
+        else if (record_type == 0x01)
+        {
+            break;
+        }
+    }
+    if (first_data_record)
+        return ESP_FAIL;
+
+    uint32_t binary_size = max_address - min_address;
+    uint8_t *binary_data = malloc(binary_size);
+    if (binary_data == NULL)
+        return ESP_FAIL;
+    memset(binary_data, 0xFF, binary_size);
+
+    // Second pass: convert data
+    fseek(hex_file, 0, SEEK_SET);
+    base_address = 0;
+    while (fgets(line, sizeof(line), hex_file))
+    {
+        if (line[0] != ':')
+            continue;
+
+        char byte_count_str[3] = {line[1], line[2], '\0'};
+        char address_str[5] = {line[3], line[4], line[5], line[6], '\0'};
+        char record_type_str[3] = {line[7], line[8], '\0'};
+
+        uint8_t byte_count = (uint8_t)strtol(byte_count_str, NULL, 16);
+        uint16_t address = (uint16_t)strtol(address_str, NULL, 16);
+        uint8_t record_type = (uint8_t)strtol(record_type_str, NULL, 16);
+
+        if (record_type == 0x00)
+        {
+            uint32_t offset = base_address + address - min_address;
+            for (int i = 0; i < byte_count; i++)
+            {
+                char byte_str[3] = {line[9 + i * 2], line[10 + i * 2], '\0'};
+                uint8_t data_byte = (uint8_t)strtol(byte_str, NULL, 16);
+                if (offset + i < binary_size)
+                    binary_data[offset + i] = data_byte;
+            }
+        }
+        else if (record_type == 0x04)
+        {
+            char ext_addr_str[5] = {line[9], line[10], line[11], line[12], '\0'};
+            base_address = ((uint32_t)strtol(ext_addr_str, NULL, 16)) << 16;
+        }
+        else if (record_type == 0x01)
+        {
+            break;
+        }
+    }
+
+    size_t written = fwrite(binary_data, 1, binary_size, bin_file);
+    free(binary_data);
+    *size = binary_size;
+    return written == binary_size ? ESP_OK : ESP_FAIL;
+}
+
+/*
+ * Methods under test: HEX text in memory to an image in `out`
+ */
+
+typedef esp_err_t (*bench_method_t)(const char *hex, size_t hex_size, uint8_t *out, size_t *size);
+
+static esp_err_t run_legacy(const char *hex, size_t hex_size, uint8_t *out, size_t *size)
+{
+    FILE *in = fmemopen((void *)hex, hex_size, "r");
+    FILE *bin = fmemopen(out, BENCH_IMAGE_MAX, "w");
+    esp_err_t err = legacy_convert(in, bin, size);
+    fclose(in);
+    fclose(bin);
+    return err;
+}
+
+// ihex_image_feed in upload-sized chunks, as the upload handler calls it
+static esp_err_t run_streaming(const char *hex, size_t hex_size, uint8_t *out, size_t *size)
+{
+    FILE *bin = fmemopen(out, BENCH_IMAGE_MAX, "w+");
+    ihex_image_t image;
+    ihex_image_init(&image, &ihex_image_file_io, bin, BENCH_IMAGE_MAX);
+    for (size_t done = 0; done < hex_size; done += BENCH_CHUNK_SIZE)
+    {
+        size_t chunk = hex_size - done < BENCH_CHUNK_SIZE ? hex_size - done : BENCH_CHUNK_SIZE;
+        if (ihex_image_feed(&image, (const uint8_t *)hex + done, chunk) != ESP_OK)
+        {
+            break;
+        }
+    }
+    esp_err_t err = ihex_image_finish(&image, size);
+    fclose(bin);
+    return err;
+}
+
+typedef struct
+{
+    uint8_t *out;
+    size_t end;
+} decode_only_t;
+
+static esp_err_t decode_to_memory(uint32_t address, const uint8_t *data, size_t length, void *context)
+{
+    decode_only_t *sink = context;
+    memcpy(sink->out + (address - BENCH_APP_ADDRESS), data, length);
+    sink->end = address - BENCH_APP_ADDRESS + length;
+    return ESP_OK;
+}
+
+// ihex_decoder_feed alone, records copied into place: the parsing without stdio
+static esp_err_t run_decoder(const char *hex, size_t hex_size, uint8_t *out, size_t *size)
+{
+    decode_only_t sink = {.out = out};
+    ihex_decoder_t decoder;
+    ihex_decoder_init(&decoder, decode_to_memory, &sink);
+    for (size_t done = 0; done < hex_size; done += BENCH_CHUNK_SIZE)
+    {
+        size_t chunk = hex_size - done < BENCH_CHUNK_SIZE ? hex_size - done : BENCH_CHUNK_SIZE;
+        if (ihex_decoder_feed(&decoder, (const uint8_t *)hex + done, chunk) != ESP_OK)
+        {
+            break;
+        }
+    }
+    *size = sink.end;
+    return ihex_decoder_finish(&decoder);
+}
+
+static const struct
+{
+    const char *name;
+    bench_method_t run;
+} methods[] = {
+    {"strtol", run_legacy},
+    {"stream", run_streaming},
+    {"decode", run_decoder},
+};
+
+// The end of file record without the line break after it, as many tools write it
+// and as the upload handler gets it with the multipart boundary stripped
+static bool decodes_without_last_newline(const char *hex, size_t hex_size, const uint8_t *image, size_t size,
+                                         uint8_t *out)
+{
+    while (hex_size > 0 && (hex[hex_size - 1] == '\r' || hex[hex_size - 1] == '\n'))
+    {
+        hex_size--;
+    }
+    for (size_t m = 1; m < sizeof(methods) / sizeof(methods[0]); m++)
+    {
+        size_t out_size = 0;
+        if (methods[m].run(hex, hex_size, out, &out_size) != ESP_OK || out_size != size ||
+            memcmp(out, image, size) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Driver
+ */
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-s KB,...]\n"
+            "  -s  binary image sizes in KB, default %s\n",
+            name, BENCH_SIZES);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    char sizes[128] = BENCH_SIZES;
+    int option;
+
+    while ((option = getopt(argc, argv, "s:h")) != -1)
+    {
+        switch (option)
+        {
+        case 's': snprintf(sizes, sizeof(sizes), "%s", optarg); break;
+        default: usage(argv[0]);
+        }
+    }
+
+    uint8_t *out = malloc(BENCH_IMAGE_MAX);
+    int failures = 0;
+    printf("%6s %8s %-7s %9s %8s %8s %8s\n", "KB", "hex KB", "method", "ms", "MB/s", "speedup", "result");
+    for (char *item = strtok(sizes, ","); item != NULL; item = strtok(NULL, ","))
+    {
+        size_t size = (size_t)atoi(item) * 1024;
+        if (size == 0 || size > BENCH_IMAGE_MAX)
+        {
+            usage(argv[0]);
+        }
+        uint8_t *image = malloc(size);
+        srand(size);
+        for (size_t i = 0; i < size; i++)
+        {
+            image[i] = rand();
+        }
+        size_t hex_size;
+        char *hex = make_hex(image, size, &hex_size);
+
+        double baseline_ms = 0;
+        for (size_t m = 0; m < sizeof(methods) / sizeof(methods[0]); m++)
+        {
+            // fastest of as many passes as fit in BENCH_MIN_RUN_MS
+            double best_ms = 1e9;
+            double start = now_ms();
+            size_t out_size = 0;
+            esp_err_t err;
+            do
+            {
+                double pass = now_ms();
+                err = methods[m].run(hex, hex_size, out, &out_size);
+                double ms = now_ms() - pass;
+                best_ms = ms < best_ms ? ms : best_ms;
+            } while (err == ESP_OK && now_ms() - start < BENCH_MIN_RUN_MS);
+
+            bool ok = err == ESP_OK && out_size == size && memcmp(out, image, size) == 0;
+            if (m == 0)
+            {
+                baseline_ms = best_ms;
+            }
+            printf("%6zu %8zu %-7s %9.3f %8.1f %7.1fx %8s\n", size / 1024, hex_size / 1024, methods[m].name, best_ms,
+                   hex_size / best_ms / 1e3, baseline_ms / best_ms, ok ? "ok" : "WRONG");
+            failures += !ok;
+        }
+
+        bool ok = decodes_without_last_newline(hex, hex_size, image, size, out);
+        printf("%6zu %8zu %-7s %9s %8s %8s %8s\n", size / 1024, hex_size / 1024, "no-eol", "", "", "",
+               ok ? "ok" : "WRONG");
+        failures += !ok;
+        free(hex);
+        free(image);
+    }
+    free(out);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,663 @@
+/*
+ * ota_bench.c
+ *
+ * End-to-end benchmark of the firmware transfer: ota_transfer.c, as the ESP32
+ * runs it, against the bootloader host build (bootloader/host) over the
+ * pseudo-terminal that is its USART1. Every run starts the simulator, flashes
+ * one image and reports transfer time, throughput, ACK round trips and retries.
+ * The transfer keeps time by the simulated clock, so the numbers are those of
+ * the chip and not of the simulator running slower or faster than it. With -a the
+ * image is flashed as it arrives, at a given rate, the way /flash takes an upload.
+ * See README.md.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "ota_transfer.h"
+
+#define BENCH_SIM_PATH "../../bootloader/host/build/bootloader_host"
+#define BENCH_SIZES "4,16,32,64,110" // KB, the application area holds 111
+#define BENCH_MODES "window"
+#define BENCH_MAX_RUNS 32             // sizes and modes each
+#define BENCH_LINK_WAIT_MS 2000       // simulator start-up until its pty is there
+#define BENCH_EXIT_WAIT_MS 3000       // CHECKSUM_OK until the application is started
+#define BENCH_POLL_US 1000            // real time between two looks at the simulated clock
+#define BENCH_STALL_MS 5000           // real time a wait may take beyond its simulated length
+#define BENCH_EDIT_SIZE 32            // update images differ from their base in two runs of this many bytes
+#define BENCH_APP_ADDRESS 0x08004000U // APP_CURRENT in bootloader/Src/main.c
+#define BENCH_APP_STACK 0x20005000U
+
+typedef struct
+{
+    const char *sim_path;
+    uint32_t sizes[BENCH_MAX_RUNS];
+    size_t size_count;
+    ota_transfer_mode_e modes[BENCH_MAX_RUNS];
+    size_t mode_count;
+    const char *noise_ppm;
+    const char *seed;
+    uint32_t arrival_kbps; // window and legacy images flashed as they arrive at this rate, 0: all there
+    bool keep;
+} bench_config_t;
+
+int host_log_level = ESP_LOG_NONE;
+
+static bench_config_t config = {
+    .sim_path = BENCH_SIM_PATH,
+};
+static char work_dir[] = "/tmp/ota_bench.XXXXXX";
+static char flash_path[64];
+static char link_path[64];
+static char log_path[64];
+static char clock_path[64];
+static int link_fd = -1;
+static const volatile uint64_t *sim_clock = NULL; // simulated ns, written by the simulator
+static int64_t offline_us = 0;                  // waited while no simulator was running
+
+/*
+ * Port: the pty the simulator links to
+ */
+
+static int64_t real_time_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void real_sleep_us(uint32_t us)
+{
+    struct timespec wait = {us / 1000000, (us % 1000000) * 1000L};
+    while (nanosleep(&wait, &wait) != 0 && errno == EINTR)
+    {
+    }
+}
+
+static bool simulator_gone(void)
+{
+    struct pollfd line = {.fd = link_fd, .events = 0};
+    return link_fd < 0 || (poll(&line, 1, 0) > 0 && (line.revents & (POLLHUP | POLLERR | POLLNVAL)));
+}
+
+static int64_t bench_time_us(void)
+{
+    return (sim_clock ? (int64_t)(*sim_clock / 1000) : 0) + offline_us;
+}
+
+// Wait until the simulated clock reaches `deadline`, or input arrives with `wake`
+static bool wait_until(int64_t deadline, bool wake)
+{
+    int64_t real_limit = real_time_us() + (deadline - bench_time_us()) + BENCH_STALL_MS * 1000LL;
+
+    while (bench_time_us() < deadline)
+    {
+        struct pollfd line = {.fd = link_fd, .events = wake ? POLLIN : 0};
+        if (wake && poll(&line, 1, BENCH_POLL_US / 1000) > 0 && (line.revents & POLLIN))
+        {
+            return true;
+        }
+        if (simulator_gone() || real_time_us() > real_limit)
+        {
+            // no clock to wait for
+            offline_us += deadline - bench_time_us();
+            break;
+        }
+        if (!wake)
+        {
+            real_sleep_us(BENCH_POLL_US / 10);
+        }
+    }
+    return false;
+}
+
+static void bench_delay_ms(uint32_t ms)
+{
+    wait_until(bench_time_us() + (int64_t)ms * 1000, false);
+}
+
+static int bench_write(const uint8_t *data, size_t length)
+{
+    size_t done = 0;
+    while (done < length)
+    {
+        ssize_t written = write(link_fd, data + done, length - done);
+        if (written < 0 && errno == EAGAIN && !simulator_gone())
+        {
+            // the pty is full until the simulator takes the next bytes off the line
+            struct pollfd line = {.fd = link_fd, .events = POLLOUT};
+            poll(&line, 1, BENCH_POLL_US / 1000);
+            continue;
+        }
+        if (written < 0 && errno != EINTR)
+        {
+            break;
+        }
+        done += written > 0 ? written : 0;
+    }
+    return done;
+}
+
+static int bench_read(uint8_t *data, size_t length, uint32_t timeout_ms)
+{
+    ssize_t got = read(link_fd, data, length);
+    if (got <= 0 && wait_until(bench_time_us() + (int64_t)timeout_ms * 1000, true))
+    {
+        got = read(link_fd, data, length);
+    }
+    return got > 0 ? got : 0;
+}
+
+static void bench_flush_input(void)
+{
+    tcflush(link_fd, TCIFLUSH);
+}
+
+// The simulator takes the rate from the USART unless started with -b pty;
+// rates termios has no constant for are left as they are
+static void bench_set_baud(uint32_t baud)
+{
+    static const struct
+    {
+        uint32_t baud;
+        speed_t speed;
+    } speeds[] = {
+        {115200, B115200}, {230400, B230400}, {460800, B460800}, {921600, B921600},
+        {1000000, B1000000}, {2000000, B2000000}, {3000000, B3000000},
+    };
+    struct termios settings;
+
+    tcdrain(link_fd);
+    if (tcgetattr(link_fd, &settings) != 0)
+    {
+        return;
+    }
+    for (size_t i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++)
+    {
+        if (speeds[i].baud == baud)
+        {
+            cfsetspeed(&settings, speeds[i].speed);
+            tcsetattr(link_fd, TCSANOW, &settings);
+        }
+    }
+}
+
+static const ota_transfer_port_t bench_port = {
+    .write = bench_write,
+    .read = bench_read,
+    .flush_input = bench_flush_input,
+    .set_baud = bench_set_baud,
+    .delay_ms = bench_delay_ms,
+    .time_us = bench_time_us,
+};
+
+/*
+ * Source: an upload coming in at config.arrival_kbps from the start of the run
+ */
+
+typedef struct
+{
+    const uint8_t *image;
+    int64_t start_us;
+} bench_upload_t;
+
+// Simulated time the first `length` bytes are in
+static int64_t arrival_us(const bench_upload_t *upload, size_t length)
+{
+    return upload->start_us + (int64_t)length * 1000000 / ((int64_t)config.arrival_kbps * 1024);
+}
+
+static esp_err_t bench_source_wait(size_t length, uint32_t timeout_ms, void *context)
+{
+    const bench_upload_t *upload = context;
+    int64_t due = arrival_us(upload, length);
+    if (bench_time_us() < due && timeout_ms > 0)
+    {
+        int64_t limit = bench_time_us() + (int64_t)timeout_ms * 1000;
+        wait_until(due < limit ? due : limit, false);
+    }
+    return bench_time_us() >= due ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+static esp_err_t bench_source_read(size_t offset, uint8_t *data, size_t length, void *context)
+{
+    const bench_upload_t *upload = context;
+    memcpy(data, upload->image + offset, length);
+    return ESP_OK;
+}
+
+/*
+ * Simulator
+ */
+
+static pid_t start_simulator(bool erase, bool update_flag)
+{
+    char *argv[16];
+    int argc = 0;
+
+    argv[argc++] = (char *)config.sim_path;
+    argv[argc++] = "-r";
+    argv[argc++] = "-c";
+    argv[argc++] = clock_path;
+    argv[argc++] = "-f";
+    argv[argc++] = flash_path;
+    argv[argc++] = "-l";
+    argv[argc++] = link_path;
+    if (erase)
+    {
+        argv[argc++] = "-e";
+    }
+    if (update_flag)
+    {
+        argv[argc++] = "-u";
+    }
+    if (config.noise_ppm)
+    {
+        argv[argc++] = "-n";
+        argv[argc++] = (char *)config.noise_ppm;
+    }
+    if (config.seed)
+    {
+        argv[argc++] = "-s";
+        argv[argc++] = (char *)config.seed;
+    }
+    argv[argc] = NULL;
+
+    unlink(link_path);
+    unlink(clock_path);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int log = open(log_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (log >= 0)
+        {
+            dup2(log, STDERR_FILENO);
+            close(log);
+        }
+        execv(config.sim_path, argv);
+        perror(config.sim_path);
+        _exit(127);
+    }
+    if (pid < 0)
+    {
+        return -1;
+    }
+
+    // the simulator links the pty once it is up
+    for (int waited = 0; waited < BENCH_LINK_WAIT_MS; waited += 10)
+    {
+        link_fd = open(link_path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+        if (link_fd >= 0)
+        {
+            struct termios settings;
+            tcgetattr(link_fd, &settings);
+            cfmakeraw(&settings);
+            cfsetspeed(&settings, B115200);
+            tcsetattr(link_fd, TCSANOW, &settings);
+
+            // the clock file is there before the pty
+            int fd = open(clock_path, O_RDONLY);
+            void *clock = fd >= 0 ? mmap(NULL, sizeof(uint64_t), PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            sim_clock = clock != MAP_FAILED ? clock : NULL;
+            offline_us = 0;
+            return pid;
+        }
+        if (waitpid(pid, NULL, WNOHANG) == pid)
+        {
+            return -1;
+        }
+        real_sleep_us(10000);
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+// Exit status of the simulator, 0 once the application was started
+static int stop_simulator(pid_t pid)
+{
+    int status = 0;
+
+    for (int waited = 0; waited < BENCH_EXIT_WAIT_MS; waited += 10)
+    {
+        if (waitpid(pid, &status, WNOHANG) == pid)
+        {
+            break;
+        }
+        if (waited + 10 >= BENCH_EXIT_WAIT_MS)
+        {
+            kill(pid, SIGTERM);
+            waitpid(pid, &status, 0);
+        }
+        real_sleep_us(10000);
+    }
+    close(link_fd);
+    link_fd = -1;
+    if (sim_clock)
+    {
+        offline_us = bench_time_us();
+        munmap((void *)sim_clock, sizeof(uint64_t));
+        sim_clock = NULL;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/*
+ * Images
+ */
+
+static uint32_t bench_random(uint32_t *state)
+{
+    // xorshift32
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+// An image the bootloader accepts as an application: a vector table pointing into
+// RAM and the application area, then code-like data, 16-byte blocks of which one
+// in three repeats an earlier one
+static void make_image(uint8_t *image, size_t size, uint32_t seed)
+{
+    uint32_t state = seed ? seed : 1;
+    uint32_t words[2] = {BENCH_APP_STACK, BENCH_APP_ADDRESS + 0x131};
+
+    for (size_t offset = 0; offset < size; offset += 16)
+    {
+        size_t length = size - offset < 16 ? size - offset : 16;
+        if (offset >= 64 && bench_random(&state) % 3 == 0)
+        {
+            size_t from = (bench_random(&state) % (offset / 16)) * 16;
+            memcpy(image + offset, image + from, length);
+            continue;
+        }
+        for (size_t i = 0; i < length; i++)
+        {
+            image[offset + i] = bench_random(&state);
+        }
+    }
+    for (int i = 0; i < 8; i++)
+    {
+        image[i] = words[i / 4] >> (8 * (i % 4));
+    }
+}
+
+// The base with two short edits, what a small code change does to an image
+static void make_update(uint8_t *image, const uint8_t *base, size_t size, uint32_t seed)
+{
+    uint32_t state = seed ^ 0x5A5A5A5A;
+
+    memcpy(image, base, size);
+    for (int edit = 1; edit <= 2; edit++)
+    {
+        size_t offset = (size * edit / 3) & ~3UL;
+        for (size_t i = offset; i < offset + BENCH_EDIT_SIZE && i < size; i++)
+        {
+            image[i] = bench_random(&state);
+        }
+    }
+}
+
+/*
+ * Runs
+ */
+
+static bool parse_list(char *list, bool (*pAdd)(const char *item))
+{
+    for (char *item = strtok(list, ","); item; item = strtok(NULL, ","))
+    {
+        if (!pAdd(item))
+        {
+            fprintf(stderr, "ota_bench: bad list item '%s'\n", item);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool add_size(const char *item)
+{
+    uint32_t kb = strtoul(item, NULL, 0);
+    if (kb == 0 || config.size_count == BENCH_MAX_RUNS)
+    {
+        return false;
+    }
+    config.sizes[config.size_count++] = kb;
+    return true;
+}
+
+static bool add_mode(const char *item)
+{
+    for (int mode = 0; mode < OTA_TRANSFER_MODE_COUNT; mode++)
+    {
+        if (strcmp(item, ota_transfer_mode_names[mode]) == 0 && config.mode_count < BENCH_MAX_RUNS)
+        {
+            config.modes[config.mode_count++] = mode;
+            return true;
+        }
+    }
+    return false;
+}
+
+// End of the histogram bucket the p-th percentile of the round trips falls in
+static double rtt_percentile_ms(const ota_transfer_stats_t *stats, uint32_t percent)
+{
+    uint32_t seen = 0;
+    for (int bucket = 0; bucket < OTA_TRANSFER_RTT_BUCKETS - 1; bucket++)
+    {
+        seen += stats->ack_histogram[bucket];
+        if ((uint64_t)seen * 100 >= (uint64_t)stats->ack_count * percent)
+        {
+            int64_t end = ota_transfer_rtt_bucket_us(bucket + 1);
+            return (end < stats->ack_max_us ? end : stats->ack_max_us) / 1000.0;
+        }
+    }
+    return stats->ack_max_us / 1000.0;
+}
+
+static void print_header(void)
+{
+    printf("%6s %-6s %8s %9s %9s %8s %8s %6s %5s %5s %4s %4s %4s %7s %7s %7s %7s %7s %6s  ", "KB", "mode", "baud",
+           "total ms", "data ms", "B/s", "data B/s", "frames", "naks", "tmo", "rdy", "down", "pass", "rtt min", "p50",
+           "p90", "p99", "max", "stall");
+    if (config.arrival_kbps)
+    {
+        printf("%9s %8s  ", "upload ms", "wait ms");
+    }
+    printf("result\n");
+}
+
+static void print_run(uint32_t kb, ota_transfer_mode_e mode, const ota_transfer_stats_t *stats, const char *result)
+{
+    size_t size = (size_t)kb * 1024;
+    double total_s = stats->total_us / 1e6;
+    double data_s = stats->data_us / 1e6;
+
+    printf("%6u %-6s %8u %9.1f %9.1f %8.0f %8.0f %6zu %5u %5u %4u %4u %4u %7.2f %7.2f %7.2f %7.2f %7.2f %5.1f%%  ",
+           kb, ota_transfer_mode_names[mode], stats->link_baud, stats->total_us / 1e3, stats->data_us / 1e3,
+           total_s > 0 ? size / total_s : 0.0, data_s > 0 ? size / data_s : 0.0, stats->frames_sent, stats->naks,
+           stats->ack_timeouts, stats->ready_retries, stats->downshifts, stats->passes,
+           stats->ack_count ? stats->ack_min_us / 1e3 : 0.0, stats->ack_count ? rtt_percentile_ms(stats, 50) : 0.0,
+           stats->ack_count ? rtt_percentile_ms(stats, 90) : 0.0, stats->ack_count ? rtt_percentile_ms(stats, 99) : 0.0,
+           stats->ack_max_us / 1e3, stats->flash_stall_permille / 10.0);
+    if (config.arrival_kbps)
+    {
+        printf("%9.1f %8.1f  ", size * 1e3 / (config.arrival_kbps * 1024.0), stats->source_wait_us / 1e3);
+    }
+    printf("%s\n", result);
+    fflush(stdout);
+}
+
+// One transfer on a simulator of its own; false with `result` set when it failed
+static bool run_transfer(ota_transfer_mode_e mode, const uint8_t *image, size_t size, const uint8_t *base,
+                         size_t base_size, bool erase, ota_transfer_stats_t *stats, const char **result)
+{
+    pid_t pid = start_simulator(erase, !erase);
+    if (pid < 0)
+    {
+        memset(stats, 0, sizeof(*stats));
+        *result = "simulator did not start";
+        return false;
+    }
+
+    const char *message = NULL;
+    esp_err_t err;
+    if (config.arrival_kbps && (mode == OTA_TRANSFER_MODE_WINDOW || mode == OTA_TRANSFER_MODE_LEGACY))
+    {
+        bench_upload_t upload = {.image = image, .start_us = bench_time_us()};
+        const ota_transfer_source_t source = {
+            .wait = bench_source_wait,
+            .read = bench_source_read,
+            .context = &upload,
+        };
+        err = ota_transfer_run_source(mode, size, &source, stats, &message);
+    }
+    else
+    {
+        err = ota_transfer_run(mode, image, size, base, base_size, stats, &message);
+    }
+    int status = stop_simulator(pid);
+    if (err != ESP_OK)
+    {
+        *result = message;
+        return false;
+    }
+    if (status != 0)
+    {
+        *result = "application not started";
+        return false;
+    }
+    *result = "ok";
+    return true;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-b simulator] [-s KB,...] [-m mode,...] [-a KB/s] [-n ppm] [-S seed] [-k] [-v]\n"
+            "  -b  bootloader host build, default %s\n"
+            "  -s  image sizes in KB, default %s\n"
+            "  -m  transfer modes: window, legacy, skip, delta, lz; default %s.\n"
+            "      skip and delta first flash a base image, then time an update of it\n"
+            "  -a  window and legacy: flash the image as it arrives at this rate, as /flash does\n"
+            "  -n  received bytes per million the simulator corrupts\n"
+            "  -S  seed of the line noise\n"
+            "  -k  keep the flash files and the simulator log\n"
+            "  -v  log of the transfer, twice for every frame exchanged\n",
+            name, BENCH_SIM_PATH, BENCH_SIZES, BENCH_MODES);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    char sizes[128] = BENCH_SIZES;
+    char modes[128] = BENCH_MODES;
+    int option;
+
+    while ((option = getopt(argc, argv, "b:s:m:a:n:S:kvh")) != -1)
+    {
+        switch (option)
+        {
+        case 'b': config.sim_path = optarg; break;
+        case 's': snprintf(sizes, sizeof(sizes), "%s", optarg); break;
+        case 'm': snprintf(modes, sizeof(modes), "%s", optarg); break;
+        case 'a': config.arrival_kbps = strtoul(optarg, NULL, 0); break;
+        case 'n': config.noise_ppm = optarg; break;
+        case 'S': config.seed = optarg; break;
+        case 'k': config.keep = true; break;
+        case 'v': host_log_level = host_log_level ? ESP_LOG_INFO : ESP_LOG_WARN; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (!parse_list(sizes, add_size) || !parse_list(modes, add_mode))
+    {
+        usage(argv[0]);
+    }
+    if (access(config.sim_path, X_OK) != 0)
+    {
+        fprintf(stderr, "ota_bench: no simulator at %s, make -C bootloader/host\n", config.sim_path);
+        return 1;
+    }
+    if (mkdtemp(work_dir) == NULL)
+    {
+        perror("ota_bench");
+        return 1;
+    }
+    snprintf(flash_path, sizeof(flash_path), "%s/flash.bin", work_dir);
+    snprintf(link_path, sizeof(link_path), "%s/usart1", work_dir);
+    snprintf(log_path, sizeof(log_path), "%s/sim.log", work_dir);
+    snprintf(clock_path, sizeof(clock_path), "%s/clock", work_dir);
+    signal(SIGPIPE, SIG_IGN);
+    ota_transfer_init(&bench_port, NULL);
+
+    int failures = 0;
+    print_header();
+    for (size_t s = 0; s < config.size_count; s++)
+    {
+        size_t size = (size_t)config.sizes[s] * 1024;
+        uint8_t *base = malloc(size);
+        uint8_t *update = malloc(size);
+        if (base == NULL || update == NULL)
+        {
+            return 1;
+        }
+        make_image(base, size, config.sizes[s]);
+        make_update(update, base, size, config.sizes[s]);
+
+        for (size_t m = 0; m < config.mode_count; m++)
+        {
+            ota_transfer_mode_e mode = config.modes[m];
+            ota_transfer_stats_t stats;
+            const char *result;
+            bool ok;
+
+            if (mode == OTA_TRANSFER_MODE_SKIP || mode == OTA_TRANSFER_MODE_DELTA)
+            {
+                // the update needs the base in flash first, that transfer is not reported
+                ok = run_transfer(OTA_TRANSFER_MODE_WINDOW, base, size, NULL, 0, true, &stats, &result) &&
+                     run_transfer(mode, update, size, base, size, false, &stats, &result);
+            }
+            else
+            {
+                ok = run_transfer(mode, base, size, NULL, 0, true, &stats, &result);
+            }
+            print_run(config.sizes[s], mode, &stats, result);
+            failures += !ok;
+        }
+        free(base);
+        free(update);
+    }
+
+    if (failures)
+    {
+        fprintf(stderr, "ota_bench: %d of %zu runs failed, simulator log in %s\n", failures,
+                config.size_count * config.mode_count, log_path);
+    }
+    else if (!config.keep)
+    {
+        unlink(flash_path);
+        unlink(log_path);
+        unlink(clock_path);
+        rmdir(work_dir);
+    }
+    return failures ? 1 : 0;
+}
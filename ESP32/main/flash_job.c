@@ -0,0 +1,520 @@
+#include "flash_job.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "driver/uart.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/stream_buffer.h"
+#include "freertos/task.h"
+
+#include "fw_store.h"
+#include "http_server.h"
+#include "tasks_common.h"
+
+static const char TAG[] = "flash_job";
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+// UART configuration for communication with STM32
+#define UART_PORT_NUM UART_NUM_1
+#define UART_TX_BUFFER_SIZE 1024
+#define UART_RX_BUFFER_SIZE 1024
+
+// Streamed jobs: upload on its way from the HTTP handler to the job task, taken off
+// in pieces of FLASH_CHUNK_SIZE; once the transfer is over the rest is waited for
+// this long at a time, and given up after FLASH_DRAIN_MAX_WAITS waits in a row that
+// bring nothing. A blocked uploader looks every FLASH_STREAM_POLL_MS whether the job
+// still takes the image
+#define FLASH_STREAM_SIZE (8 * 1024)
+#define FLASH_CHUNK_SIZE 512
+#define FLASH_DRAIN_WAIT_MS 1000
+#define FLASH_DRAIN_MAX_WAITS 45
+#define FLASH_STREAM_POLL_MS 100
+
+const char *const flash_job_state_names[FLASH_JOB_STATE_COUNT] = {"queued", "running", "done", "failed"};
+
+// Image still arriving. The job task writes it to the upload slot as it takes it off
+// the stream buffer and reads packets back from there
+struct flash_job_stream
+{
+    StreamBufferHandle_t buffer;
+    SemaphoreHandle_t ended; // given when the uploader is done with the stream
+    size_t size;             // of the image
+    size_t taken;            // off the buffer
+    volatile bool broken;    // the upload stopped before its end
+    volatile bool abandoned; // the job takes no more of it
+    fw_store_writer_t store;
+    esp_err_t store_err; // of the first store write that failed
+    uint8_t chunk[FLASH_CHUNK_SIZE];
+};
+
+typedef struct flash_job_request
+{
+    uint32_t id;
+    ota_transfer_mode_e mode;
+    flash_job_stream_t *stream; // NULL: the image in the upload slot
+} flash_job_request_t;
+
+static QueueHandle_t job_queue = NULL;
+static SemaphoreHandle_t job_lock = NULL;          // jobs, next_id and pending
+static flash_job_status_t jobs[FLASH_JOB_HISTORY]; // job id % FLASH_JOB_HISTORY
+static uint32_t next_id = 1;
+static uint32_t pending = 0; // jobs queued or running
+
+/*
+ * The STM32 link of ota_transfer on UART_PORT_NUM
+ */
+
+static int uart_port_write(const uint8_t *data, size_t length)
+{
+    return uart_write_bytes(UART_PORT_NUM, data, length);
+}
+
+static int uart_port_read(uint8_t *data, size_t length, uint32_t timeout_ms)
+{
+    return uart_read_bytes(UART_PORT_NUM, data, length, pdMS_TO_TICKS(timeout_ms));
+}
+
+static void uart_port_flush_input(void)
+{
+    uart_flush_input(UART_PORT_NUM);
+}
+
+static void uart_port_set_baud(uint32_t baud)
+{
+    uart_wait_tx_done(UART_PORT_NUM, pdMS_TO_TICKS(100));
+    uart_set_baudrate(UART_PORT_NUM, baud);
+}
+
+static void uart_port_delay_ms(uint32_t ms)
+{
+    vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+static const ota_transfer_port_t uart_port = {
+    .write = uart_port_write,
+    .read = uart_port_read,
+    .flush_input = uart_port_flush_input,
+    .set_baud = uart_port_set_baud,
+    .delay_ms = uart_port_delay_ms,
+    .time_us = esp_timer_get_time,
+};
+
+// Patch or compressed image of a transfer, in the payload slot of the firmware store
+// and sent from there mapped, so it takes no heap whatever the image size
+typedef struct payload_store
+{
+    fw_store_writer_t writer;
+    fw_store_image_t image;
+} payload_store_t;
+
+static esp_err_t payload_begin(size_t max_size, void *context)
+{
+    payload_store_t *payload = context;
+    memset(&payload->image, 0, sizeof(payload->image));
+    return max_size <= FW_STORE_IMAGE_MAX ? fw_store_begin(&payload->writer, FW_STORE_SLOT_PAYLOAD)
+                                          : ESP_ERR_INVALID_SIZE;
+}
+
+static esp_err_t payload_write(const uint8_t *data, size_t length, void *context)
+{
+    payload_store_t *payload = context;
+    return fw_store_write(&payload->writer, payload->writer.size, data, length);
+}
+
+static const uint8_t *payload_finish(void *context)
+{
+    payload_store_t *payload = context;
+    if (fw_store_commit(&payload->writer) != ESP_OK || fw_store_open(FW_STORE_SLOT_PAYLOAD, &payload->image) != ESP_OK)
+    {
+        return NULL;
+    }
+    return payload->image.data;
+}
+
+static void payload_release(void *context)
+{
+    payload_store_t *payload = context;
+    fw_store_abort(&payload->writer);
+    fw_store_close(&payload->image);
+}
+
+static payload_store_t payload_store;
+static const ota_transfer_scratch_t payload_scratch = {
+    .begin = payload_begin,
+    .write = payload_write,
+    .finish = payload_finish,
+    .release = payload_release,
+    .context = &payload_store,
+};
+
+// UART for STM32 communication. The driver interrupt is allocated on the core of the
+// task installing it, this one
+static void init_uart(void)
+{
+    uart_config_t uart_config = {
+        .baud_rate = OTA_TRANSFER_LINK_BAUD_DEFAULT,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE};
+    uart_param_config(UART_PORT_NUM, &uart_config);
+    uart_set_pin(UART_PORT_NUM, 17, 16, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE); // TX GPIO17, RX GPIO16 - adjust as needed
+    uart_driver_install(UART_PORT_NUM, UART_RX_BUFFER_SIZE * 2, UART_TX_BUFFER_SIZE * 2, 0, NULL, 0);
+    ota_transfer_init(&uart_port, &payload_scratch);
+    ESP_LOGI(TAG, "UART initialized for STM32 communication on core %d", xPortGetCoreID());
+}
+
+/*
+ * Streamed images
+ */
+
+// Take what the uploader passed on into the store, waiting up to timeout_ms for the
+// first `length` bytes of the image to be in
+static esp_err_t stream_source_wait(size_t length, uint32_t timeout_ms, void *context)
+{
+    flash_job_stream_t *stream = context;
+    TickType_t start = xTaskGetTickCount();
+    TickType_t timeout = pdMS_TO_TICKS(timeout_ms);
+
+    while (stream->taken < stream->size)
+    {
+        // what is there is taken in any case, more is waited for only while it is needed
+        TickType_t waited = xTaskGetTickCount() - start;
+        TickType_t wait = (stream->taken >= length || stream->broken || waited >= timeout) ? 0 : timeout - waited;
+        size_t got = xStreamBufferReceive(stream->buffer, stream->chunk,
+                                          MIN(sizeof(stream->chunk), stream->size - stream->taken), wait);
+        if (got == 0)
+        {
+            break;
+        }
+        if (stream->store_err == ESP_OK)
+        {
+            stream->store_err = fw_store_write(&stream->store, stream->taken, stream->chunk, got);
+        }
+        stream->taken += got;
+    }
+    if (stream->store_err != ESP_OK)
+    {
+        return stream->store_err;
+    }
+    if (stream->taken >= length)
+    {
+        return ESP_OK;
+    }
+    return stream->broken ? ESP_FAIL : ESP_ERR_TIMEOUT;
+}
+
+static esp_err_t stream_source_read(size_t offset, uint8_t *data, size_t length, void *context)
+{
+    flash_job_stream_t *stream = context;
+    return fw_store_read(&stream->store, offset, data, length);
+}
+
+static void free_stream(flash_job_stream_t *stream)
+{
+    if (stream->buffer != NULL)
+    {
+        vStreamBufferDelete(stream->buffer);
+    }
+    if (stream->ended != NULL)
+    {
+        vSemaphoreDelete(stream->ended);
+    }
+    free(stream);
+}
+
+/*
+ * Jobs
+ */
+
+// The image in the upload slot, read in place
+static esp_err_t run_stored(ota_transfer_mode_e mode, ota_transfer_stats_t *stats, const char **message)
+{
+    fw_store_image_t firmware;
+    if (fw_store_open(FW_STORE_SLOT_UPLOAD, &firmware) != ESP_OK)
+    {
+        *message = "Stored firmware missing or damaged, please upload it again";
+        return ESP_ERR_NOT_FOUND;
+    }
+    ESP_LOGI(TAG, "Firmware size: %zu bytes", firmware.size);
+
+    // Delta mode patches against the image last flashed
+    fw_store_image_t base = {0};
+    if (mode == OTA_TRANSFER_MODE_DELTA && fw_store_open(FW_STORE_SLOT_TARGET, &base) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "No image of the last update, sending the whole image");
+    }
+
+    esp_err_t result = ota_transfer_run(mode, firmware.data, firmware.size, base.data, base.size, stats, message);
+    fw_store_close(&base);
+    fw_store_close(&firmware);
+
+    // Base for the next delta update
+    if (result == ESP_OK && fw_store_copy(FW_STORE_SLOT_UPLOAD, FW_STORE_SLOT_TARGET) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Could not keep the flashed image, next delta update sends it whole");
+    }
+    return result;
+}
+
+// An image flashed as it arrives, and written to the upload slot on the way
+static esp_err_t run_streamed(ota_transfer_mode_e mode, flash_job_stream_t *stream, ota_transfer_stats_t *stats,
+                              const char **message)
+{
+    const ota_transfer_source_t source = {
+        .wait = stream_source_wait,
+        .read = stream_source_read,
+        .context = stream,
+    };
+    esp_err_t result = ota_transfer_run_source(mode, stream->size, &source, stats, message);
+
+    // The rest of the upload is stored whatever became of the transfer, it can be sent
+    // again. An uploader that stalls without closing the connection is not waited for
+    // for ever, the engine would take no other job
+    int idle_waits = 0;
+    while (stream->taken < stream->size && !stream->broken && idle_waits < FLASH_DRAIN_MAX_WAITS)
+    {
+        size_t taken = stream->taken;
+        stream_source_wait(stream->size, FLASH_DRAIN_WAIT_MS, stream);
+        idle_waits = stream->taken == taken ? idle_waits + 1 : 0;
+    }
+    if (stream->taken < stream->size && !stream->broken)
+    {
+        ESP_LOGE(TAG, "Upload stalled at %zu of %zu bytes, giving up on it", stream->taken, stream->size);
+    }
+    stream->abandoned = true;
+    if (stream->taken == stream->size && stream->store_err == ESP_OK)
+    {
+        stream->store_err = fw_store_commit(&stream->store);
+    }
+    else
+    {
+        fw_store_abort(&stream->store);
+    }
+    if (stream->store_err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to store the image (%s)", esp_err_to_name(stream->store_err));
+    }
+
+    // Base for the next delta update
+    if (result == ESP_OK && stream->store_err == ESP_OK &&
+        fw_store_copy(FW_STORE_SLOT_UPLOAD, FW_STORE_SLOT_TARGET) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Could not keep the flashed image, next delta update sends it whole");
+    }
+
+    // the uploader may still be leaving flash_job_stream_end
+    xSemaphoreTake(stream->ended, portMAX_DELAY);
+    free_stream(stream);
+    return result;
+}
+
+static void set_job_state(uint32_t id, flash_job_state_e state)
+{
+    xSemaphoreTake(job_lock, portMAX_DELAY);
+    flash_job_status_t *job = &jobs[id % FLASH_JOB_HISTORY];
+    if (job->id == id)
+    {
+        job->state = state;
+    }
+    xSemaphoreGive(job_lock);
+}
+
+static void finish_job(uint32_t id, esp_err_t result, const char *message, const ota_transfer_stats_t *stats)
+{
+    xSemaphoreTake(job_lock, portMAX_DELAY);
+    flash_job_status_t *job = &jobs[id % FLASH_JOB_HISTORY];
+    if (job->id == id)
+    {
+        job->state = result == ESP_OK ? FLASH_JOB_DONE : FLASH_JOB_FAILED;
+        job->result = result;
+        snprintf(job->message, sizeof(job->message), "%s", result == ESP_OK || message == NULL ? "" : message);
+        job->link_baud = stats->link_baud;
+        job->bytes_sent = stats->bytes_sent;
+        job->packets_sent = stats->packets_sent;
+        job->total_us = stats->total_us;
+        job->data_us = stats->data_us;
+        job->source_wait_us = stats->source_wait_us;
+        job->flash_stall_permille = stats->flash_stall_permille;
+    }
+    pending--;
+    xSemaphoreGive(job_lock);
+}
+
+static void flash_job_task(void *arg)
+{
+    init_uart();
+
+    flash_job_request_t request;
+    while (1)
+    {
+        if (xQueueReceive(job_queue, &request, portMAX_DELAY))
+        {
+            ESP_LOGI(TAG, "Job %lu: %s transfer of the %s image", (unsigned long)request.id,
+                     ota_transfer_mode_names[request.mode], request.stream ? "arriving" : "stored");
+            set_job_state(request.id, FLASH_JOB_RUNNING);
+
+            ota_transfer_stats_t stats = {0};
+            const char *message = NULL;
+            esp_err_t result = request.stream ? run_streamed(request.mode, request.stream, &stats, &message)
+                                              : run_stored(request.mode, &stats, &message);
+            if (result == ESP_OK)
+            {
+                ESP_LOGI(TAG, "Job %lu: firmware flashed and verified in %lld ms", (unsigned long)request.id,
+                         stats.total_us / 1000);
+                http_server_monitor_send_message(HTTP_MSG_OTA_UPDATE_SUCCESSFULL);
+            }
+            else
+            {
+                ESP_LOGE(TAG, "Job %lu failed: %s (%s)", (unsigned long)request.id, message ? message : "",
+                         esp_err_to_name(result));
+                http_server_monitor_send_message(HTTP_MSG_OTA_UPDATE_FAILED);
+            }
+            finish_job(request.id, result, message, &stats);
+        }
+    }
+}
+
+// New job in the history and the queue
+static esp_err_t queue_job(ota_transfer_mode_e mode, flash_job_stream_t *stream, size_t size, uint32_t *id)
+{
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+    xSemaphoreTake(job_lock, portMAX_DELAY);
+    // the queue has room for every job but the one running
+    if (pending < FLASH_JOB_QUEUE_LENGTH && (stream == NULL || pending == 0))
+    {
+        flash_job_request_t request = {.id = next_id, .mode = mode, .stream = stream};
+        if (xQueueSend(job_queue, &request, 0) == pdTRUE)
+        {
+            flash_job_status_t *job = &jobs[next_id % FLASH_JOB_HISTORY];
+            memset(job, 0, sizeof(*job));
+            job->id = next_id++;
+            job->state = FLASH_JOB_QUEUED;
+            job->mode = mode;
+            job->streamed = stream != NULL;
+            job->size = size;
+            *id = job->id;
+            pending++;
+            err = ESP_OK;
+        }
+    }
+    xSemaphoreGive(job_lock);
+    return err;
+}
+
+esp_err_t flash_job_init(void)
+{
+    job_queue = xQueueCreate(FLASH_JOB_QUEUE_LENGTH, sizeof(flash_job_request_t));
+    job_lock = xSemaphoreCreateMutex();
+    if (job_queue == NULL || job_lock == NULL ||
+        xTaskCreatePinnedToCore(&flash_job_task, "flash_job_task", FLASH_JOB_TASK_STACK_SIZE, NULL,
+                                FLASH_JOB_TASK_PRIORITY, NULL, FLASH_JOB_TASK_CORE_ID) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to start the flashing job task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t flash_job_submit(ota_transfer_mode_e mode, uint32_t *id)
+{
+    // checked now so the client hears of it, the job opens the image again when it runs
+    fw_store_image_t firmware;
+    esp_err_t err = fw_store_open(FW_STORE_SLOT_UPLOAD, &firmware);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    size_t size = firmware.size;
+    fw_store_close(&firmware);
+    return queue_job(mode, NULL, size, id);
+}
+
+esp_err_t flash_job_submit_stream(ota_transfer_mode_e mode, size_t size, flash_job_stream_t **stream, uint32_t *id)
+{
+    if (mode != OTA_TRANSFER_MODE_WINDOW && mode != OTA_TRANSFER_MODE_LEGACY)
+    {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (flash_job_busy())
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    flash_job_stream_t *job_stream = calloc(1, sizeof(flash_job_stream_t));
+    if (job_stream == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    job_stream->buffer = xStreamBufferCreate(FLASH_STREAM_SIZE, 1);
+    job_stream->ended = xSemaphoreCreateBinary();
+    job_stream->size = size;
+    esp_err_t err = ESP_ERR_NO_MEM;
+    if (job_stream->buffer != NULL && job_stream->ended != NULL)
+    {
+        err = fw_store_begin(&job_stream->store, FW_STORE_SLOT_UPLOAD);
+    }
+    if (err == ESP_OK)
+    {
+        err = queue_job(mode, job_stream, size, id);
+    }
+    if (err != ESP_OK)
+    {
+        fw_store_abort(&job_stream->store);
+        free_stream(job_stream);
+        return err;
+    }
+    *stream = job_stream;
+    return ESP_OK;
+}
+
+bool flash_job_stream_write(flash_job_stream_t *stream, const uint8_t *data, size_t length)
+{
+    while (length > 0 && !stream->abandoned)
+    {
+        size_t sent = xStreamBufferSend(stream->buffer, data, length, pdMS_TO_TICKS(FLASH_STREAM_POLL_MS));
+        data += sent;
+        length -= sent;
+    }
+    return length == 0;
+}
+
+void flash_job_stream_end(flash_job_stream_t *stream, bool complete)
+{
+    if (!complete)
+    {
+        stream->broken = true;
+    }
+    xSemaphoreGive(stream->ended);
+}
+
+bool flash_job_busy(void)
+{
+    xSemaphoreTake(job_lock, portMAX_DELAY);
+    bool busy = pending > 0;
+    xSemaphoreGive(job_lock);
+    return busy;
+}
+
+esp_err_t flash_job_get(uint32_t id, flash_job_status_t *status)
+{
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    xSemaphoreTake(job_lock, portMAX_DELAY);
+    if (id == 0)
+    {
+        id = next_id - 1;
+    }
+    const flash_job_status_t *job = &jobs[id % FLASH_JOB_HISTORY];
+    if (id != 0 && job->id == id)
+    {
+        *status = *job;
+        err = ESP_OK;
+    }
+    xSemaphoreGive(job_lock);
+    return err;
+}
@@ -0,0 +1,103 @@
+/**
+ * Flashing job engine
+ *
+ * Transfers to the STM32 run one at a time in a task of their own on
+ * FLASH_JOB_TASK_CORE_ID, away from Wi-Fi and the HTTP server. The UART driver is
+ * installed from that task, so its interrupt is served on the same core. HTTP
+ * handlers queue a job and answer at once with its ID; the state and result of
+ * the last FLASH_JOB_HISTORY jobs can be looked up by it. A job flashes either
+ * the image in the upload slot of the firmware store, or one still being
+ * uploaded, which the handler passes on through a stream buffer as it arrives.
+ */
+#ifndef FLASH_JOB_H
+#define FLASH_JOB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "ota_transfer.h"
+
+#define FLASH_JOB_QUEUE_LENGTH 4
+#define FLASH_JOB_HISTORY 8
+#define FLASH_JOB_MESSAGE_MAX 96
+
+typedef enum
+{
+    FLASH_JOB_QUEUED = 0,
+    FLASH_JOB_RUNNING,
+    FLASH_JOB_DONE,
+    FLASH_JOB_FAILED,
+    FLASH_JOB_STATE_COUNT,
+} flash_job_state_e;
+
+extern const char *const flash_job_state_names[FLASH_JOB_STATE_COUNT];
+
+typedef struct flash_job_status
+{
+    uint32_t id;
+    flash_job_state_e state;
+    ota_transfer_mode_e mode;
+    bool streamed; // flashed as it was uploaded
+    size_t size;   // of the image
+    esp_err_t result;
+    char message[FLASH_JOB_MESSAGE_MAX]; // why it failed, "" otherwise
+    // of the transfer, once the job is over
+    uint32_t link_baud;
+    size_t bytes_sent;
+    size_t packets_sent;
+    int64_t total_us;
+    int64_t data_us;
+    int64_t source_wait_us;
+    uint32_t flash_stall_permille;
+} flash_job_status_t;
+
+typedef struct flash_job_stream flash_job_stream_t;
+
+/**
+ * Start the job task, which sets up the UART to the STM32
+ * @return ESP_OK, ESP_ERR_NO_MEM
+ */
+esp_err_t flash_job_init(void);
+
+/**
+ * Queue flashing the image in the upload slot
+ * @param id of the job
+ * @return ESP_OK, ESP_ERR_NOT_FOUND when the slot holds no image, ESP_ERR_INVALID_CRC when
+ *         it is damaged, ESP_ERR_INVALID_STATE when the queue is full
+ */
+esp_err_t flash_job_submit(ota_transfer_mode_e mode, uint32_t *id);
+
+/**
+ * Start flashing an image still arriving: pass it on with flash_job_stream_write, then
+ * call flash_job_stream_end. Only when no other job is queued, the engine takes the
+ * image as it comes, and in window or legacy mode (ota_transfer_run_source)
+ * @param size of the whole image
+ * @return ESP_OK, ESP_ERR_NOT_SUPPORTED for another mode, ESP_ERR_INVALID_STATE while a
+ *         job is queued or running, ESP_ERR_NO_MEM, or the firmware store error
+ */
+esp_err_t flash_job_submit_stream(ota_transfer_mode_e mode, size_t size, flash_job_stream_t **stream, uint32_t *id);
+
+/**
+ * Pass on the next piece of the image; blocks while the engine is behind
+ * @return false when the engine gave up on the upload, the rest need not be read
+ */
+bool flash_job_stream_write(flash_job_stream_t *stream, const uint8_t *data, size_t length);
+
+/**
+ * The upload is over, whole or cut off. The stream is the engine's from now on
+ */
+void flash_job_stream_end(flash_job_stream_t *stream, bool complete);
+
+/**
+ * @return true while a job is queued or running, the upload slot is in use then
+ */
+bool flash_job_busy(void);
+
+/**
+ * @param id 0 for the last job submitted
+ * @return ESP_OK, ESP_ERR_NOT_FOUND for a job never submitted or too long ago
+ */
+esp_err_t flash_job_get(uint32_t id, flash_job_status_t *status);
+
+#endif
@@ -0,0 +1,293 @@
+#include "fw_store.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+
+static const char TAG[] = "fw_store";
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#define FW_STORE_MAGIC 0x54535746 // "FWST"
+
+typedef struct fw_store_header
+{
+    uint32_t magic;
+    uint32_t size;
+    uint32_t crc; // CRC-32 (esp_rom_crc32_le) of the image
+    uint32_t reserved;
+} fw_store_header_t;
+
+static const esp_partition_t *partition = NULL;
+
+// Partition offset of a slot's header, the image follows one sector later
+static size_t slot_offset(fw_store_slot_e slot)
+{
+    return (size_t)slot * FW_STORE_SLOT_SIZE;
+}
+
+static size_t sector_offset(const fw_store_writer_t *writer, int index)
+{
+    return slot_offset(writer->slot) + FW_STORE_SECTOR_SIZE * (1 + index);
+}
+
+esp_err_t fw_store_init(void)
+{
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, FW_STORE_PARTITION_LABEL);
+    if (partition == NULL || partition->size < FW_STORE_SLOT_COUNT * FW_STORE_SLOT_SIZE)
+    {
+        ESP_LOGE(TAG, "No %s partition of %d KB", FW_STORE_PARTITION_LABEL, FW_STORE_SLOT_COUNT * FW_STORE_SLOT_SIZE / 1024);
+        partition = NULL;
+        return ESP_ERR_NOT_FOUND;
+    }
+    ESP_LOGI(TAG, "Firmware store at 0x%06lX, %d slots of %d KB", (unsigned long)partition->address, FW_STORE_SLOT_COUNT,
+             FW_STORE_SLOT_SIZE / 1024);
+    return ESP_OK;
+}
+
+esp_err_t fw_store_begin(fw_store_writer_t *writer, fw_store_slot_e slot)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->slot = slot;
+    writer->sector_index = -1;
+    if (partition == NULL)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t err = esp_partition_erase_range(partition, slot_offset(slot), FW_STORE_SECTOR_SIZE);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to erase the header of slot %d (%s)", slot, esp_err_to_name(err));
+        return err;
+    }
+    writer->sector = malloc(FW_STORE_SECTOR_SIZE);
+    return writer->sector != NULL ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+// The sector in RAM to flash
+static esp_err_t flush_sector(fw_store_writer_t *writer)
+{
+    if (writer->sector_index < 0)
+    {
+        return ESP_OK;
+    }
+    size_t offset = sector_offset(writer, writer->sector_index);
+    esp_err_t err = esp_partition_erase_range(partition, offset, FW_STORE_SECTOR_SIZE);
+    if (err == ESP_OK)
+    {
+        err = esp_partition_write(partition, offset, writer->sector, FW_STORE_SECTOR_SIZE);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to write at 0x%06zX (%s)", offset, esp_err_to_name(err));
+        return err;
+    }
+    writer->programmed |= 1UL << writer->sector_index;
+    writer->sector_index = -1;
+    return ESP_OK;
+}
+
+// Make a sector the one in RAM, with what it holds so far
+static esp_err_t load_sector(fw_store_writer_t *writer, int index)
+{
+    if (writer->sector_index == index)
+    {
+        return ESP_OK;
+    }
+    esp_err_t err = flush_sector(writer);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    if (writer->programmed & (1UL << index))
+    {
+        err = esp_partition_read(partition, sector_offset(writer, index), writer->sector, FW_STORE_SECTOR_SIZE);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+    }
+    else
+    {
+        memset(writer->sector, 0xFF, FW_STORE_SECTOR_SIZE);
+    }
+    writer->sector_index = index;
+    return ESP_OK;
+}
+
+esp_err_t fw_store_write(fw_store_writer_t *writer, size_t offset, const uint8_t *data, size_t length)
+{
+    if (offset + length > FW_STORE_IMAGE_MAX)
+    {
+        ESP_LOGE(TAG, "Image over %d bytes", FW_STORE_IMAGE_MAX);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    while (length > 0)
+    {
+        size_t in_sector = offset % FW_STORE_SECTOR_SIZE;
+        size_t chunk = MIN(length, FW_STORE_SECTOR_SIZE - in_sector);
+        esp_err_t err = load_sector(writer, offset / FW_STORE_SECTOR_SIZE);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        memcpy(writer->sector + in_sector, data, chunk);
+        offset += chunk;
+        data += chunk;
+        length -= chunk;
+        writer->size = offset > writer->size ? offset : writer->size;
+    }
+    return ESP_OK;
+}
+
+esp_err_t fw_store_read(fw_store_writer_t *writer, size_t offset, uint8_t *data, size_t length)
+{
+    if (offset + length > FW_STORE_IMAGE_MAX)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    while (length > 0)
+    {
+        int index = offset / FW_STORE_SECTOR_SIZE;
+        size_t in_sector = offset % FW_STORE_SECTOR_SIZE;
+        size_t chunk = MIN(length, FW_STORE_SECTOR_SIZE - in_sector);
+        if (index == writer->sector_index)
+        {
+            memcpy(data, writer->sector + in_sector, chunk);
+        }
+        else if (writer->programmed & (1UL << index))
+        {
+            esp_err_t err = esp_partition_read(partition, sector_offset(writer, index) + in_sector, data, chunk);
+            if (err != ESP_OK)
+            {
+                return err;
+            }
+        }
+        else
+        {
+            memset(data, 0xFF, chunk);
+        }
+        offset += chunk;
+        data += chunk;
+        length -= chunk;
+    }
+    return ESP_OK;
+}
+
+esp_err_t fw_store_commit(fw_store_writer_t *writer)
+{
+    esp_err_t err = flush_sector(writer);
+    free(writer->sector);
+    writer->sector = NULL;
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    // every sector of the image must be in flash, an unwritten one holds an old image
+    size_t sectors = (writer->size + FW_STORE_SECTOR_SIZE - 1) / FW_STORE_SECTOR_SIZE;
+    if (writer->size == 0 || (~writer->programmed & ((1UL << sectors) - 1)) != 0)
+    {
+        ESP_LOGE(TAG, "Image of %zu bytes not written whole", writer->size);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    const void *data;
+    esp_partition_mmap_handle_t mmap;
+    err = esp_partition_mmap(partition, sector_offset(writer, 0), writer->size, ESP_PARTITION_MMAP_DATA, &data, &mmap);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to map the image (%s)", esp_err_to_name(err));
+        return err;
+    }
+    fw_store_header_t header = {
+        .magic = FW_STORE_MAGIC,
+        .size = writer->size,
+        .crc = esp_rom_crc32_le(0, data, writer->size),
+    };
+    esp_partition_munmap(mmap);
+
+    err = esp_partition_write(partition, slot_offset(writer->slot), &header, sizeof(header));
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to write the header of slot %d (%s)", writer->slot, esp_err_to_name(err));
+        return err;
+    }
+    ESP_LOGI(TAG, "Slot %d: %zu bytes, CRC 0x%08lX", writer->slot, writer->size, (unsigned long)header.crc);
+    return ESP_OK;
+}
+
+void fw_store_abort(fw_store_writer_t *writer)
+{
+    free(writer->sector);
+    writer->sector = NULL;
+    writer->sector_index = -1;
+}
+
+esp_err_t fw_store_open(fw_store_slot_e slot, fw_store_image_t *image)
+{
+    memset(image, 0, sizeof(*image));
+    fw_store_header_t header;
+    if (partition == NULL || esp_partition_read(partition, slot_offset(slot), &header, sizeof(header)) != ESP_OK ||
+        header.magic != FW_STORE_MAGIC || header.size == 0 || header.size > FW_STORE_IMAGE_MAX)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    const void *data;
+    esp_err_t err = esp_partition_mmap(partition, slot_offset(slot) + FW_STORE_SECTOR_SIZE, header.size,
+                                       ESP_PARTITION_MMAP_DATA, &data, &image->mmap);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to map slot %d (%s)", slot, esp_err_to_name(err));
+        return err;
+    }
+    if (esp_rom_crc32_le(0, data, header.size) != header.crc)
+    {
+        ESP_LOGE(TAG, "Slot %d: CRC error", slot);
+        esp_partition_munmap(image->mmap);
+        return ESP_ERR_INVALID_CRC;
+    }
+    image->data = data;
+    image->size = header.size;
+    image->crc = header.crc;
+    return ESP_OK;
+}
+
+void fw_store_close(fw_store_image_t *image)
+{
+    if (image->data != NULL)
+    {
+        esp_partition_munmap(image->mmap);
+        image->data = NULL;
+    }
+}
+
+esp_err_t fw_store_copy(fw_store_slot_e from, fw_store_slot_e to)
+{
+    fw_store_image_t image;
+    esp_err_t err = fw_store_open(from, &image);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    fw_store_writer_t writer;
+    err = fw_store_begin(&writer, to);
+    if (err == ESP_OK)
+    {
+        // sector by sector through the writer's RAM copy, flash is not programmed from flash
+        err = fw_store_write(&writer, 0, image.data, image.size);
+        if (err == ESP_OK)
+        {
+            err = fw_store_commit(&writer);
+        }
+        else
+        {
+            fw_store_abort(&writer);
+        }
+    }
+    fw_store_close(&image);
+    return err;
+}
@@ -0,0 +1,97 @@
+/**
+ * Raw flash store of firmware images
+ *
+ * Images live in the "fwstore" data partition, one per slot, outside any file
+ * system. They are written through a RAM copy of one flash sector, erased and
+ * programmed a whole sector at a time with esp_partition_write, and read in
+ * place through esp_partition_mmap. The first sector of a slot holds a header
+ * with the image size and CRC, erased when a write begins and written after the
+ * image, so a slot whose write did not finish holds no image.
+ */
+#ifndef FW_STORE_H
+#define FW_STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+
+#define FW_STORE_PARTITION_LABEL "fwstore"
+#define FW_STORE_SECTOR_SIZE 4096
+#define FW_STORE_SLOT_SIZE (128 * 1024)                             // header sector and image
+#define FW_STORE_IMAGE_MAX (FW_STORE_SLOT_SIZE - FW_STORE_SECTOR_SIZE) // 124 KB
+
+typedef enum
+{
+    FW_STORE_SLOT_UPLOAD = 0, // image uploaded, to be flashed
+    FW_STORE_SLOT_TARGET,     // image last flashed to the STM32, the base of delta updates
+    FW_STORE_SLOT_PAYLOAD,    // patch or compressed image of the transfer running
+    FW_STORE_SLOT_COUNT,
+} fw_store_slot_e;
+
+typedef struct fw_store_writer
+{
+    fw_store_slot_e slot;
+    uint8_t *sector;     // FW_STORE_SECTOR_SIZE bytes, the image sector being written
+    int sector_index;    // of that sector, -1 for none
+    uint32_t programmed; // bit per image sector written to flash, 31 of them
+    size_t size;         // end of the data written
+} fw_store_writer_t;
+
+typedef struct fw_store_image
+{
+    const uint8_t *data; // mapped flash
+    size_t size;
+    uint32_t crc;
+    esp_partition_mmap_handle_t mmap;
+} fw_store_image_t;
+
+/**
+ * Find the partition
+ * @return ESP_OK, ESP_ERR_NOT_FOUND when the partition table has none large enough
+ */
+esp_err_t fw_store_init(void);
+
+/**
+ * Start writing an image to a slot; what it held is gone
+ * @return ESP_OK, ESP_ERR_NOT_FOUND without the partition, ESP_ERR_NO_MEM, or the flash error
+ */
+esp_err_t fw_store_begin(fw_store_writer_t *writer, fw_store_slot_e slot);
+
+/**
+ * Write at any offset. A sector goes to flash when a write moves on to another one;
+ * going back to a sector already in flash costs reading, erasing and programming it again
+ * @return ESP_OK, ESP_ERR_INVALID_SIZE past FW_STORE_IMAGE_MAX, or the flash error
+ */
+esp_err_t fw_store_write(fw_store_writer_t *writer, size_t offset, const uint8_t *data, size_t length);
+
+/**
+ * Read back what was written, 0xFF where nothing was
+ */
+esp_err_t fw_store_read(fw_store_writer_t *writer, size_t offset, uint8_t *data, size_t length);
+
+/**
+ * Write the last sector and the header; the image is writer->size bytes. Frees the writer
+ * @return ESP_OK, ESP_ERR_INVALID_STATE when the data has holes, or the flash error
+ */
+esp_err_t fw_store_commit(fw_store_writer_t *writer);
+
+/**
+ * Give up a write, the slot stays empty. Frees the writer
+ */
+void fw_store_abort(fw_store_writer_t *writer);
+
+/**
+ * Map the image of a slot and check its CRC
+ * @return ESP_OK, ESP_ERR_NOT_FOUND when the slot holds none, ESP_ERR_INVALID_CRC when it is damaged
+ */
+esp_err_t fw_store_open(fw_store_slot_e slot, fw_store_image_t *image);
+
+void fw_store_close(fw_store_image_t *image);
+
+/**
+ * Copy the image of one slot to another
+ */
+esp_err_t fw_store_copy(fw_store_slot_e from, fw_store_slot_e to);
+
+#endif
@@ -24,12 +24,6 @@ typedef struct http_server_queue_message
 
 BaseType_t http_server_monitor_send_message(http_server_message_e msgID);
 
-void init_uart(void);
-
-esp_err_t init_spiffs(void);
-
-esp_err_t convert_hex_to_bin(const char* hex_file_path, const char* bin_file_path);
-
 void http_server_start(void);
 
 void http_server_stop(void);
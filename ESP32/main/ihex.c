@@ -0,0 +1,397 @@
+#include "ihex.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+
+static const char TAG[] = "ihex";
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#define IHEX_DATA 0x00
+#define IHEX_END_OF_FILE 0x01
+#define IHEX_EXTENDED_SEGMENT_ADDRESS 0x02
+#define IHEX_START_SEGMENT_ADDRESS 0x03
+#define IHEX_EXTENDED_LINEAR_ADDRESS 0x04
+#define IHEX_START_LINEAR_ADDRESS 0x05
+
+struct ihex_segment
+{
+    ihex_segment_t *next;
+    uint32_t address;
+    size_t length;
+    uint8_t data[];
+};
+
+// Value of a hex digit, XX for anything else
+#define XX 0xFF
+static const uint8_t hex_digit[256] = {
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, XX, XX, XX, XX, XX, XX,
+    XX, 10, 11, 12, 13, 14, 15, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, 10, 11, 12, 13, 14, 15, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+};
+#undef XX
+
+void ihex_decoder_init(ihex_decoder_t *decoder, ihex_data_cb_t on_data, void *context)
+{
+    memset(decoder, 0, sizeof(*decoder));
+    decoder->on_data = on_data;
+    decoder->context = context;
+}
+
+static inline esp_err_t add_byte(ihex_decoder_t *decoder, uint8_t byte)
+{
+    if (decoder->record_length == sizeof(decoder->record))
+    {
+        ESP_LOGE(TAG, "Record %lu: too long", (unsigned long)decoder->record_number);
+        return ESP_ERR_INVALID_ARG;
+    }
+    decoder->record[decoder->record_length++] = byte;
+    decoder->sum += byte;
+    return ESP_OK;
+}
+
+// A whole record is decoded: check it and act on it
+static esp_err_t parse_record(ihex_decoder_t *decoder)
+{
+    const uint8_t *record = decoder->record;
+
+    if (decoder->odd || decoder->record_length < 5 || record[0] + 5U != decoder->record_length)
+    {
+        ESP_LOGE(TAG, "Record %lu: length does not match its byte count", (unsigned long)decoder->record_number);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (decoder->sum != 0)
+    {
+        ESP_LOGE(TAG, "Record %lu: checksum error", (unsigned long)decoder->record_number);
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    uint8_t length = record[0];
+    uint16_t offset = (record[1] << 8) | record[2];
+    const uint8_t *data = &record[4];
+    switch (record[3])
+    {
+    case IHEX_DATA:
+        return length > 0 ? decoder->on_data(decoder->upper_address + offset, data, length, decoder->context) : ESP_OK;
+    case IHEX_END_OF_FILE:
+        decoder->end_seen = true;
+        return ESP_OK;
+    case IHEX_EXTENDED_SEGMENT_ADDRESS:
+    case IHEX_EXTENDED_LINEAR_ADDRESS:
+        if (length != 2)
+        {
+            break;
+        }
+        decoder->upper_address = (uint32_t)((data[0] << 8) | data[1]) << (record[3] == IHEX_EXTENDED_LINEAR_ADDRESS ? 16 : 4);
+        return ESP_OK;
+    case IHEX_START_SEGMENT_ADDRESS:
+    case IHEX_START_LINEAR_ADDRESS:
+        return ESP_OK; // entry point, the vector table has it
+    }
+    ESP_LOGE(TAG, "Record %lu: unknown record type %02X", (unsigned long)decoder->record_number, record[3]);
+    return ESP_ERR_INVALID_ARG;
+}
+
+// Digits are decoded through hex_digit as they come, two at a time, and summed on the
+// way, so a record is checked without going over its text again
+esp_err_t ihex_decoder_feed(ihex_decoder_t *decoder, const uint8_t *data, size_t length)
+{
+    const uint8_t *p = data;
+    const uint8_t *end = data + length;
+    esp_err_t err = ESP_OK;
+
+    while (p < end && !decoder->end_seen)
+    {
+        if (!decoder->in_record)
+        {
+            // anything between records is skipped, as other tools do
+            p = memchr(p, ':', end - p);
+            if (p == NULL)
+            {
+                break;
+            }
+            p++;
+            decoder->in_record = true;
+            decoder->record_length = 0;
+            decoder->sum = 0;
+            decoder->odd = false;
+            decoder->record_number++;
+            continue;
+        }
+
+        // the digit left from the last piece, then pairs
+        if (decoder->odd && hex_digit[*p] <= 0xF)
+        {
+            decoder->odd = false;
+            err = add_byte(decoder, (decoder->high_nibble << 4) | hex_digit[*p++]);
+        }
+        while (err == ESP_OK && end - p >= 2 && (hex_digit[p[0]] | hex_digit[p[1]]) <= 0xF)
+        {
+            err = add_byte(decoder, (hex_digit[p[0]] << 4) | hex_digit[p[1]]);
+            p += 2;
+        }
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        if (p == end)
+        {
+            break;
+        }
+        if (!decoder->odd && hex_digit[*p] <= 0xF)
+        {
+            decoder->odd = true;
+            decoder->high_nibble = hex_digit[*p++];
+            continue;
+        }
+
+        // not a digit: the record ends here
+        decoder->in_record = false;
+        if (*p != '\r' && *p != '\n')
+        {
+            ESP_LOGE(TAG, "Record %lu: not a hex digit", (unsigned long)decoder->record_number);
+            return ESP_ERR_INVALID_ARG;
+        }
+        p++;
+        if ((err = parse_record(decoder)) != ESP_OK)
+        {
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
+// The last record may end with the text instead of a line break
+esp_err_t ihex_decoder_finish(ihex_decoder_t *decoder)
+{
+    if (decoder->in_record && !decoder->end_seen)
+    {
+        decoder->in_record = false;
+        esp_err_t err = parse_record(decoder);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+    }
+    return decoder->end_seen ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+static esp_err_t write_at(ihex_image_t *image, size_t offset, const uint8_t *data, size_t length)
+{
+    if (image->io->write(offset, data, length, image->io_context) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to write the image");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+// Erased flash between records
+static esp_err_t write_padding(ihex_image_t *image, size_t offset, size_t length)
+{
+    uint8_t erased[64];
+    memset(erased, 0xFF, sizeof(erased));
+    for (size_t done = 0; done < length;)
+    {
+        size_t chunk = MIN(sizeof(erased), length - done);
+        if (write_at(image, offset + done, erased, chunk) != ESP_OK)
+        {
+            return ESP_FAIL;
+        }
+        done += chunk;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t image_data(uint32_t address, const uint8_t *data, size_t length, void *context)
+{
+    ihex_image_t *image = context;
+    if (!image->started)
+    {
+        image->started = true;
+        image->base = address;
+        image->end = address;
+    }
+
+    uint32_t low = MIN(address, image->base);
+    uint32_t high = address + length > image->end ? address + length : image->end;
+    if (high - low > image->max_size)
+    {
+        ESP_LOGE(TAG, "Image over %zu bytes at address 0x%08lX", image->max_size, (unsigned long)address);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // in order, maybe after a gap: appended to the image
+    if (address >= image->end)
+    {
+        if (write_padding(image, image->end - image->base, address - image->end) != ESP_OK ||
+            write_at(image, address - image->base, data, length) != ESP_OK)
+        {
+            return ESP_FAIL;
+        }
+        image->end = address + length;
+        return ESP_OK;
+    }
+
+    // back into what is written: put in place
+    if (address >= image->base)
+    {
+        if (write_at(image, address - image->base, data, length) != ESP_OK)
+        {
+            return ESP_FAIL;
+        }
+        image->end = address + length > image->end ? address + length : image->end;
+        return ESP_OK;
+    }
+
+    // below the start of the image: kept until the end, the part above goes in now
+    if (address + length > image->base)
+    {
+        size_t below = image->base - address;
+        esp_err_t err = image_data(image->base, data + below, length - below, image);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        length = below;
+    }
+    if (image->segment_bytes + length > IHEX_SEGMENT_BYTES_MAX)
+    {
+        ESP_LOGE(TAG, "Over %d bytes of records below the first one", IHEX_SEGMENT_BYTES_MAX);
+        return ESP_ERR_NO_MEM;
+    }
+    ihex_segment_t *segment = malloc(sizeof(ihex_segment_t) + length);
+    if (segment == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    segment->next = NULL;
+    segment->address = address;
+    segment->length = length;
+    memcpy(segment->data, data, length);
+    *image->segments_tail = segment;
+    image->segments_tail = &segment->next;
+    image->segment_bytes += length;
+    return ESP_OK;
+}
+
+void ihex_image_init(ihex_image_t *image, const ihex_image_io_t *io, void *io_context, size_t max_size)
+{
+    memset(image, 0, sizeof(*image));
+    ihex_decoder_init(&image->decoder, image_data, image);
+    image->io = io;
+    image->io_context = io_context;
+    image->max_size = max_size;
+    image->segments_tail = &image->segments;
+}
+
+esp_err_t ihex_image_feed(ihex_image_t *image, const uint8_t *data, size_t length)
+{
+    if (image->error == ESP_OK)
+    {
+        image->error = ihex_decoder_feed(&image->decoder, data, length);
+    }
+    return image->error;
+}
+
+// Records below the first one: move what is written up by shift, from the end down so
+// nothing is overwritten before it is read, and pad the space it leaves
+static esp_err_t move_image_up(ihex_image_t *image, size_t size, size_t shift)
+{
+    uint8_t buffer[256];
+    for (size_t left = size; left > 0;)
+    {
+        size_t chunk = MIN(sizeof(buffer), left);
+        left -= chunk;
+        if (image->io->read(left, buffer, chunk, image->io_context) != ESP_OK ||
+            write_at(image, left + shift, buffer, chunk) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to move the image");
+            return ESP_FAIL;
+        }
+    }
+    return write_padding(image, 0, shift);
+}
+
+esp_err_t ihex_image_finish(ihex_image_t *image, size_t *size)
+{
+    esp_err_t err = image->error;
+    if (err == ESP_OK && (err = ihex_decoder_finish(&image->decoder)) == ESP_ERR_INVALID_SIZE)
+    {
+        ESP_LOGE(TAG, "No end of file record, the HEX file is cut off");
+    }
+
+    uint32_t low = image->base;
+    for (ihex_segment_t *segment = image->segments; segment != NULL; segment = segment->next)
+    {
+        low = MIN(low, segment->address);
+    }
+    if (err == ESP_OK && low < image->base)
+    {
+        err = move_image_up(image, image->end - image->base, image->base - low);
+        image->base = low;
+    }
+
+    // in the order they came, so a later record wins where two overlap
+    while (image->segments != NULL)
+    {
+        ihex_segment_t *segment = image->segments;
+        if (err == ESP_OK)
+        {
+            err = write_at(image, segment->address - image->base, segment->data, segment->length);
+        }
+        image->segments = segment->next;
+        free(segment);
+    }
+    image->segments_tail = &image->segments;
+    image->segment_bytes = 0;
+
+    if (err == ESP_OK && !image->started)
+    {
+        ESP_LOGE(TAG, "No data records found in HEX file");
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    *size = image->end - image->base;
+    return err;
+}
+
+// Image in a stdio file, written in order as a rule, so the seek that flushes the
+// stdio buffer is only made for a record out of order
+static esp_err_t file_write(size_t offset, const uint8_t *data, size_t length, void *context)
+{
+    FILE *file = context;
+    if (ftell(file) != (long)offset && fseek(file, offset, SEEK_SET) != 0)
+    {
+        return ESP_FAIL;
+    }
+    return fwrite(data, 1, length, file) == length ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t file_read(size_t offset, uint8_t *data, size_t length, void *context)
+{
+    FILE *file = context;
+    if (fseek(file, offset, SEEK_SET) != 0)
+    {
+        return ESP_FAIL;
+    }
+    return fread(data, 1, length, file) == length ? ESP_OK : ESP_FAIL;
+}
+
+const ihex_image_io_t ihex_image_file_io = {
+    .write = file_write,
+    .read = file_read,
+};
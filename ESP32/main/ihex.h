@@ -0,0 +1,115 @@
+/**
+ * Streaming Intel HEX decoding
+ *
+ * ihex_decoder_t takes the text in pieces of any size, as it comes off the
+ * network, checks every record and hands on the data records with their full
+ * address. ihex_image_t builds the binary image from them in storage behind
+ * ihex_image_io_t: records in ascending order, the usual case, are appended as
+ * they come and gaps padded with 0xFF, so memory does not grow with the image. A
+ * record that goes back is written over the padding in place; one below the
+ * first record's address is kept in a list until the end, when the image is
+ * moved up to make room for it.
+ */
+#ifndef IHEX_H
+#define IHEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "esp_err.h"
+
+#define IHEX_RECORD_BYTES_MAX (5 + 255)    // count, address, type, 255 data bytes, checksum
+#define IHEX_SEGMENT_BYTES_MAX (16 * 1024) // data below the first record, kept in RAM
+
+/**
+ * Receives the data records in the order they appear
+ * @return ESP_OK to go on, anything else stops the decoder with that error
+ */
+typedef esp_err_t (*ihex_data_cb_t)(uint32_t address, const uint8_t *data, size_t length, void *context);
+
+typedef struct ihex_decoder
+{
+    uint8_t record[IHEX_RECORD_BYTES_MAX]; // decoded as the digits come in
+    size_t record_length;
+    uint8_t sum;            // of the bytes decoded, 0 for a whole record that is right
+    uint8_t high_nibble;    // a digit whose pair is still to come
+    bool odd;               // high_nibble holds one
+    bool in_record;
+    bool end_seen;          // end of file record, the rest is ignored
+    uint32_t upper_address; // from extended segment / linear address records
+    uint32_t record_number; // of the record being read, from 1, for error messages
+    ihex_data_cb_t on_data;
+    void *context;
+} ihex_decoder_t;
+
+void ihex_decoder_init(ihex_decoder_t *decoder, ihex_data_cb_t on_data, void *context);
+
+/**
+ * Decode the next piece of text
+ * @return ESP_OK, ESP_ERR_INVALID_CRC for a record with a wrong checksum, ESP_ERR_INVALID_ARG
+ *         for a malformed one, or what on_data returned
+ */
+esp_err_t ihex_decoder_feed(ihex_decoder_t *decoder, const uint8_t *data, size_t length);
+
+/**
+ * Decode the record the text ends in when no line break follows it
+ * @return ESP_OK once the end of file record was decoded, ESP_ERR_INVALID_SIZE when the text
+ *         ended before it, as ihex_decoder_feed for a malformed last record
+ */
+esp_err_t ihex_decoder_finish(ihex_decoder_t *decoder);
+
+/**
+ * Storage of the image, by offset from its lowest address. Writes come in order but
+ * for records out of order; reads only when records below the first one are put in
+ */
+typedef struct ihex_image_io
+{
+    esp_err_t (*write)(size_t offset, const uint8_t *data, size_t length, void *context);
+    esp_err_t (*read)(size_t offset, uint8_t *data, size_t length, void *context);
+} ihex_image_io_t;
+
+/** The image in a FILE *, the io context, open for reading and writing */
+extern const ihex_image_io_t ihex_image_file_io;
+
+typedef struct ihex_segment ihex_segment_t;
+
+typedef struct ihex_image
+{
+    ihex_decoder_t decoder;
+    const ihex_image_io_t *io;
+    void *io_context;
+    size_t max_size;
+    bool started;
+    uint32_t base;            // address of offset 0
+    uint32_t end;             // address after the last byte written
+    ihex_segment_t *segments; // records below base, oldest first
+    ihex_segment_t **segments_tail;
+    size_t segment_bytes;
+    esp_err_t error; // of the first ihex_image_feed that failed
+} ihex_image_t;
+
+/**
+ * @param io where the image goes, empty; offset 0 is the lowest address
+ * @param max_size larger images are refused
+ */
+void ihex_image_init(ihex_image_t *image, const ihex_image_io_t *io, void *io_context, size_t max_size);
+
+/**
+ * Decode the next piece of text into the image
+ * @return as ihex_decoder_feed, or ESP_ERR_INVALID_SIZE for an image over max_size,
+ *         ESP_ERR_NO_MEM when too much data came out of order, ESP_FAIL when the image
+ *         could not be written
+ */
+esp_err_t ihex_image_feed(ihex_image_t *image, const uint8_t *data, size_t length);
+
+/**
+ * Put the records that came out of order in place. Frees what the image holds, so call
+ * it after a failed ihex_image_feed too
+ * @param size the image size
+ * @return ESP_OK, the error of a failed ihex_image_feed, ESP_ERR_INVALID_SIZE when the
+ *         text ended early, ESP_FAIL when the image could not be written
+ */
+esp_err_t ihex_image_finish(ihex_image_t *image, size_t *size);
+
+#endif
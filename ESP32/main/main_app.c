@@ -1,5 +1,7 @@
 #include "nvs_flash.h"
 #include "wifi_app.h"
+#include "flash_job.h"
+#include "fw_store.h"
 #include "http_server.h"
 void app_main(void)
 {
@@ -11,7 +13,7 @@ void app_main(void)
         ret = nvs_flash_init();
     }
     ESP_ERROR_CHECK(ret);
-    init_spiffs();
-    init_uart();
+    fw_store_init();
+    flash_job_init();
     wifi_app_start();
 }
\ No newline at end of file
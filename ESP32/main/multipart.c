@@ -0,0 +1,237 @@
+#include "multipart.h"
+
+#include <string.h>
+#include <strings.h>
+
+// Value of a parameter (name=value or name="value") in a header, NULL if it is not there
+static const char *find_parameter(const char *header, const char *name, size_t *length)
+{
+    size_t name_length = strlen(name);
+    for (const char *p = header; (p = strchr(p, ';')) != NULL;)
+    {
+        p++;
+        while (*p == ' ' || *p == '\t')
+        {
+            p++;
+        }
+        if (strncasecmp(p, name, name_length) != 0 || p[name_length] != '=')
+        {
+            continue;
+        }
+        p += name_length + 1;
+        if (*p == '"')
+        {
+            const char *end = strchr(++p, '"');
+            *length = end != NULL ? (size_t)(end - p) : strlen(p);
+        }
+        else
+        {
+            *length = strcspn(p, "; \t");
+        }
+        return p;
+    }
+    return NULL;
+}
+
+esp_err_t multipart_parser_init(multipart_parser_t *parser, const char *content_type, multipart_data_cb_t on_data,
+                                void *context)
+{
+    memset(parser, 0, sizeof(*parser));
+    if (strncasecmp(content_type, "multipart/", 10) != 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t length;
+    const char *boundary = find_parameter(content_type, "boundary", &length);
+    if (boundary == NULL || length == 0 || length > MULTIPART_BOUNDARY_MAX || memchr(boundary, '\r', length) != NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memcpy(parser->delimiter, "\r\n--", 4);
+    memcpy(parser->delimiter + 4, boundary, length);
+    parser->delimiter_length = 4 + length;
+    // the first delimiter may open the body, without the CRLF before it
+    parser->matched = 2;
+    parser->carried = 2;
+    parser->on_data = on_data;
+    parser->context = context;
+    return ESP_OK;
+}
+
+// A part header line is complete
+static void parse_header_line(multipart_parser_t *parser)
+{
+    if (strncasecmp(parser->line, "Content-Disposition:", 20) != 0)
+    {
+        return;
+    }
+    size_t length;
+    const char *filename = find_parameter(parser->line, "filename", &length);
+    if (filename != NULL && length > 0)
+    {
+        length = length < sizeof(parser->filename) - 1 ? length : sizeof(parser->filename) - 1;
+        memcpy(parser->filename, filename, length);
+        parser->filename[length] = '\0';
+    }
+}
+
+// Preamble or part content: hand on everything before the next delimiter and step past
+// it. The boundary holds no CR, so a failed match cannot hide the start of another
+// one and the bytes held back on the way are known to be the delimiter's own
+static esp_err_t scan_content(multipart_parser_t *parser, const uint8_t *data, size_t length, size_t *used)
+{
+    bool deliver = parser->state == MULTIPART_BODY && parser->in_file;
+    esp_err_t err;
+    size_t i = 0;
+
+    while (i < length)
+    {
+        if (parser->matched == 0)
+        {
+            const uint8_t *cr = memchr(data + i, '\r', length - i);
+            if (cr == NULL)
+            {
+                break;
+            }
+            i = cr - data;
+        }
+
+        if (data[i] == (uint8_t)parser->delimiter[parser->matched])
+        {
+            i++;
+            if (++parser->matched < parser->delimiter_length)
+            {
+                continue;
+            }
+            size_t end = i - (parser->delimiter_length - parser->carried);
+            if (deliver && end > 0 && (err = parser->on_data(data, end, parser->context)) != ESP_OK)
+            {
+                return err;
+            }
+            if (parser->in_file)
+            {
+                parser->in_file = false;
+                parser->file_seen = true;
+            }
+            parser->matched = 0;
+            parser->carried = 0;
+            parser->state = MULTIPART_DELIMITER_END;
+            *used = i;
+            return ESP_OK;
+        }
+
+        // not a delimiter after all: what was held back from earlier pieces is content
+        if (deliver && parser->carried > 0 &&
+            (err = parser->on_data((const uint8_t *)parser->delimiter, parser->carried, parser->context)) != ESP_OK)
+        {
+            return err;
+        }
+        parser->matched = 0;
+        parser->carried = 0;
+    }
+
+    // a delimiter may be starting at the end, keep that back
+    size_t end = length - (parser->matched - parser->carried);
+    if (deliver && end > 0 && (err = parser->on_data(data, end, parser->context)) != ESP_OK)
+    {
+        return err;
+    }
+    parser->carried = parser->matched;
+    *used = length;
+    return ESP_OK;
+}
+
+esp_err_t multipart_parser_feed(multipart_parser_t *parser, const uint8_t *data, size_t length)
+{
+    size_t i = 0;
+    while (i < length)
+    {
+        if (parser->state == MULTIPART_PREAMBLE || parser->state == MULTIPART_BODY)
+        {
+            size_t used;
+            esp_err_t err = scan_content(parser, data + i, length - i, &used);
+            if (err != ESP_OK)
+            {
+                return err;
+            }
+            i += used;
+            continue;
+        }
+
+        char c = data[i++];
+        switch (parser->state)
+        {
+        case MULTIPART_DELIMITER_END:
+            if (c == '-')
+            {
+                parser->state = MULTIPART_CLOSE_DASH;
+            }
+            else if (c == '\r')
+            {
+                parser->state = MULTIPART_DELIMITER_LF;
+            }
+            else if (c != ' ' && c != '\t') // transport padding
+            {
+                return ESP_ERR_INVALID_RESPONSE;
+            }
+            break;
+
+        case MULTIPART_DELIMITER_LF:
+            if (c != '\n')
+            {
+                return ESP_ERR_INVALID_RESPONSE;
+            }
+            parser->state = MULTIPART_HEADERS;
+            parser->line_length = 0;
+            parser->filename[0] = '\0';
+            break;
+
+        case MULTIPART_CLOSE_DASH:
+            if (c != '-')
+            {
+                return ESP_ERR_INVALID_RESPONSE;
+            }
+            parser->state = MULTIPART_EPILOGUE;
+            break;
+
+        case MULTIPART_HEADERS:
+            if (c != '\n')
+            {
+                if (parser->line_length < sizeof(parser->line) - 1)
+                {
+                    parser->line[parser->line_length++] = c;
+                }
+                break;
+            }
+            if (parser->line_length > 0 && parser->line[parser->line_length - 1] == '\r')
+            {
+                parser->line_length--;
+            }
+            if (parser->line_length > 0)
+            {
+                parser->line[parser->line_length] = '\0';
+                parse_header_line(parser);
+                parser->line_length = 0;
+                break;
+            }
+            // blank line: the content follows
+            parser->in_file = parser->filename[0] != '\0' && !parser->file_seen;
+            parser->state = MULTIPART_BODY;
+            break;
+
+        default: // epilogue
+            return ESP_OK;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t multipart_parser_finish(const multipart_parser_t *parser)
+{
+    if (parser->file_seen)
+    {
+        return ESP_OK;
+    }
+    return parser->in_file ? ESP_ERR_INVALID_SIZE : ESP_ERR_NOT_FOUND;
+}
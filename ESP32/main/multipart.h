@@ -0,0 +1,75 @@
+/**
+ * Streaming multipart/form-data parser for the firmware upload
+ *
+ * The body is fed as it arrives, in pieces of any size. The parser finds the
+ * delimiters of the boundary given in the Content-Type header, reads the part
+ * headers and hands the content of the first file part (a part with a filename)
+ * to a callback; the rest of the body is skipped. Nothing is buffered beyond
+ * one header line, so memory does not grow with the upload.
+ */
+#ifndef MULTIPART_H
+#define MULTIPART_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define MULTIPART_BOUNDARY_MAX 70 // RFC 2046
+#define MULTIPART_LINE_MAX 256    // longer part header lines are cut off
+#define MULTIPART_FILENAME_MAX 64
+
+/**
+ * Receives the file content in order, as it is parsed
+ * @return ESP_OK to go on, anything else stops the parser with that error
+ */
+typedef esp_err_t (*multipart_data_cb_t)(const uint8_t *data, size_t length, void *context);
+
+typedef enum
+{
+    MULTIPART_PREAMBLE = 0,
+    MULTIPART_DELIMITER_END, // after a delimiter: CRLF for another part, "--" for the last
+    MULTIPART_DELIMITER_LF,
+    MULTIPART_CLOSE_DASH,
+    MULTIPART_HEADERS,
+    MULTIPART_BODY,
+    MULTIPART_EPILOGUE,
+} multipart_state_e;
+
+typedef struct multipart_parser
+{
+    char delimiter[4 + MULTIPART_BOUNDARY_MAX]; // CRLF "--" boundary
+    size_t delimiter_length;
+    size_t matched; // delimiter bytes seen at the end of the input so far
+    size_t carried; // of those, bytes from earlier pieces, not handed on yet
+    multipart_state_e state;
+    char line[MULTIPART_LINE_MAX];
+    size_t line_length;
+    char filename[MULTIPART_FILENAME_MAX]; // of the current part, "" if it has none
+    bool in_file;   // the current part is the file
+    bool file_seen; // the file part is over
+    multipart_data_cb_t on_data;
+    void *context;
+} multipart_parser_t;
+
+/**
+ * @param content_type the request header, "multipart/form-data; boundary=..."
+ * @return ESP_OK, ESP_ERR_INVALID_ARG when it is not multipart or has no usable boundary
+ */
+esp_err_t multipart_parser_init(multipart_parser_t *parser, const char *content_type, multipart_data_cb_t on_data,
+                                void *context);
+
+/**
+ * Parse the next piece of the body
+ * @return ESP_OK, ESP_ERR_INVALID_RESPONSE for a malformed body, or what on_data returned
+ */
+esp_err_t multipart_parser_feed(multipart_parser_t *parser, const uint8_t *data, size_t length);
+
+/**
+ * Call at the end of the body
+ * @return ESP_OK when a file part was received whole, ESP_ERR_NOT_FOUND when there was
+ *         none, ESP_ERR_INVALID_SIZE when the body ended before the file part did
+ */
+esp_err_t multipart_parser_finish(const multipart_parser_t *parser);
+
+#endif
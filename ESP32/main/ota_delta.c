@@ -0,0 +1,174 @@
+#include "ota_delta.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DELTA_MIN_COPY 12  // a copy costs 7 bytes, shorter matches go out as literals
+#define DELTA_MAX_LENGTH 0xFFFF
+#define DELTA_HASH_BITS 13 // 32 KB of source positions
+#define DELTA_HASH_WINDOW 4
+#define DELTA_HASH_STEP 8  // every 8th source position, few enough not to push each other out
+#define DELTA_NO_POSITION UINT32_MAX
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+typedef struct
+{
+    uint8_t out[OTA_DELTA_OUT_CHUNK]; // not handed on yet
+    size_t buffered;
+    size_t length; // of the patch so far
+    size_t max_size;
+    ota_delta_write_cb_t write;
+    void *context;
+    esp_err_t err; // of write
+} delta_writer_t;
+
+static uint32_t delta_hash(const uint8_t *data)
+{
+    uint32_t value = data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+    return (value * 2654435761u) >> (32 - DELTA_HASH_BITS);
+}
+
+// Old byte at src is still readable by the bootloader while it writes new byte out
+static inline bool delta_source_alive(size_t src, size_t out)
+{
+    return src / OTA_DELTA_PAGE_SIZE + (OTA_DELTA_HISTORY_PAGES - 1) >= out / OTA_DELTA_PAGE_SIZE;
+}
+
+static size_t delta_match(const uint8_t *source, size_t source_size, const uint8_t *target, size_t target_size,
+                          size_t src, size_t out)
+{
+    size_t length = 0;
+    while (src + length < source_size && out + length < target_size && length < DELTA_MAX_LENGTH &&
+           source[src + length] == target[out + length] && delta_source_alive(src + length, out + length))
+    {
+        length++;
+    }
+    return length;
+}
+
+static bool delta_flush(delta_writer_t *writer)
+{
+    if (writer->buffered > 0 && (writer->err = writer->write(writer->out, writer->buffered, writer->context)) != ESP_OK)
+    {
+        return false;
+    }
+    writer->buffered = 0;
+    return true;
+}
+
+static bool delta_put(delta_writer_t *writer, const uint8_t *data, size_t length)
+{
+    if (writer->length + length > writer->max_size)
+    {
+        return false;
+    }
+    writer->length += length;
+    while (length > 0)
+    {
+        if (writer->buffered == sizeof(writer->out) && !delta_flush(writer))
+        {
+            return false;
+        }
+        size_t chunk = MIN(length, sizeof(writer->out) - writer->buffered);
+        memcpy(writer->out + writer->buffered, data, chunk);
+        writer->buffered += chunk;
+        data += chunk;
+        length -= chunk;
+    }
+    return true;
+}
+
+static bool delta_put_literal(delta_writer_t *writer, const uint8_t *data, size_t length)
+{
+    while (length > 0)
+    {
+        size_t chunk = length < DELTA_MAX_LENGTH ? length : DELTA_MAX_LENGTH;
+        uint8_t header[3] = {OTA_DELTA_OP_LITERAL, chunk >> 8, chunk & 0xFF};
+        if (!delta_put(writer, header, sizeof(header)) || !delta_put(writer, data, chunk))
+        {
+            return false;
+        }
+        data += chunk;
+        length -= chunk;
+    }
+    return true;
+}
+
+static bool delta_put_copy(delta_writer_t *writer, size_t src, size_t length)
+{
+    uint8_t op[7] = {OTA_DELTA_OP_COPY, length >> 8, length & 0xFF,
+                     (src >> 24) & 0xFF, (src >> 16) & 0xFF, (src >> 8) & 0xFF, src & 0xFF};
+    return delta_put(writer, op, sizeof(op));
+}
+
+esp_err_t ota_delta_encode(const uint8_t *source, size_t source_size, const uint8_t *target, size_t target_size,
+                           size_t max_size, ota_delta_write_cb_t write, void *context, size_t *patch_size)
+{
+    uint32_t *positions = malloc(sizeof(uint32_t) << DELTA_HASH_BITS);
+    if (positions == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    delta_writer_t writer = {.max_size = max_size, .write = write, .context = context, .err = ESP_OK};
+
+    // where 4-byte sequences of the old image are, looked up at every new position
+    memset(positions, 0xFF, sizeof(uint32_t) << DELTA_HASH_BITS);
+    for (size_t i = 0; i + DELTA_HASH_WINDOW <= source_size; i += DELTA_HASH_STEP)
+    {
+        positions[delta_hash(source + i)] = i;
+    }
+
+    size_t out = 0;
+    size_t literal_start = 0;
+    ptrdiff_t last_shift = 0; // source - target of the previous copy, code usually continues that way
+    bool ok = true;
+
+    while (out < target_size && ok)
+    {
+        size_t best_src = 0;
+        size_t best_length = 0;
+
+        // same place, same shift as the previous copy, or wherever the hash points
+        size_t candidates[3] = {out, out + last_shift, DELTA_NO_POSITION};
+        if (out + DELTA_HASH_WINDOW <= target_size)
+        {
+            candidates[2] = positions[delta_hash(target + out)];
+        }
+        for (int i = 0; i < 3; i++)
+        {
+            if (candidates[i] == DELTA_NO_POSITION || candidates[i] >= source_size)
+            {
+                continue;
+            }
+            size_t length = delta_match(source, source_size, target, target_size, candidates[i], out);
+            if (length > best_length)
+            {
+                best_length = length;
+                best_src = candidates[i];
+            }
+        }
+
+        if (best_length < DELTA_MIN_COPY)
+        {
+            out++;
+            continue;
+        }
+
+        ok = delta_put_literal(&writer, target + literal_start, out - literal_start) &&
+             delta_put_copy(&writer, best_src, best_length);
+        last_shift = (ptrdiff_t)best_src - (ptrdiff_t)out;
+        out += best_length;
+        literal_start = out;
+    }
+    ok = ok && delta_put_literal(&writer, target + literal_start, target_size - literal_start) && delta_flush(&writer);
+
+    free(positions);
+    *patch_size = writer.length;
+    if (!ok)
+    {
+        return writer.err != ESP_OK ? writer.err : ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,41 @@
+/**
+ * Delta patches for the STM32 bootloader (matching bootloader ota_delta.c)
+ *
+ * The patch is a stream of operations, all fields big-endian:
+ *   OTA_DELTA_OP_LITERAL (1) | length (2) | bytes (length)
+ *   OTA_DELTA_OP_COPY (1)    | length (2) | source offset (4)
+ * The bootloader rebuilds the image in place over the old one, so a copy may
+ * only read old bytes that are still there: from the page being written on,
+ * or from the OTA_DELTA_HISTORY_PAGES - 1 pages before it, kept in its RAM.
+ */
+#ifndef OTA_DELTA_H
+#define OTA_DELTA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define OTA_DELTA_OP_LITERAL 0
+#define OTA_DELTA_OP_COPY 1
+#define OTA_DELTA_PAGE_SIZE 1024
+#define OTA_DELTA_HISTORY_PAGES 2
+
+#define OTA_DELTA_OUT_CHUNK 256 // patch handed to the write callback at a time, at most
+
+/**
+ * Receives the patch in order, as it is produced
+ * @return ESP_OK to go on, anything else stops the encoder with that error
+ */
+typedef esp_err_t (*ota_delta_write_cb_t)(const uint8_t *data, size_t length, void *context);
+
+/**
+ * Build the patch turning source into target
+ * @param max_size give up when the patch would get larger than this
+ * @param patch_size size of the whole patch
+ * @return ESP_OK, ESP_ERR_NO_MEM, ESP_ERR_INVALID_SIZE when the patch is not worth it, or
+ *         what write returned
+ */
+esp_err_t ota_delta_encode(const uint8_t *source, size_t source_size, const uint8_t *target, size_t target_size,
+                           size_t max_size, ota_delta_write_cb_t write, void *context, size_t *patch_size);
+
+#endif
@@ -0,0 +1,52 @@
+/**
+ * ESP32 <-> STM32 link framing (matching bootloader ota_frame.c)
+ *
+ * Frame, all fields big-endian:
+ *   type (1) | seq (2) | length (2) | payload (length) | CRC-16/CCITT (2)
+ * The frame is COBS encoded and terminated by OTA_FRAME_DELIMITER, so a
+ * receiver that lost bytes resynchronises on the next delimiter.
+ */
+#ifndef OTA_FRAME_H
+#define OTA_FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define OTA_FRAME_DELIMITER 0x00
+#define OTA_FRAME_HEADER_SIZE 5
+#define OTA_FRAME_CRC_SIZE 2
+#define OTA_FRAME_MAX_PAYLOAD 1024 // one STM32 flash page
+#define OTA_FRAME_MAX_RAW (OTA_FRAME_HEADER_SIZE + OTA_FRAME_MAX_PAYLOAD + OTA_FRAME_CRC_SIZE)
+#define OTA_FRAME_MAX_ENCODED (OTA_FRAME_MAX_RAW + OTA_FRAME_MAX_RAW / 254 + 2)
+
+typedef struct ota_frame
+{
+    uint8_t type;
+    uint16_t seq;
+    uint16_t length;
+    const uint8_t *payload;
+} ota_frame_t;
+
+uint16_t ota_frame_crc16(const uint8_t *data, size_t length, uint16_t crc);
+
+/**
+ * CRC-32/MPEG-2 (poly 0x04C11DB7, no reflection), what the STM32 CRC unit computes;
+ * start with OTA_FRAME_CRC32_INIT, no final XOR
+ */
+#define OTA_FRAME_CRC32_INIT 0xFFFFFFFF
+uint32_t ota_frame_crc32(const uint8_t *data, size_t length, uint32_t crc);
+
+/**
+ * Encode a frame into out (at least OTA_FRAME_MAX_ENCODED bytes), delimiter included
+ * @return encoded length
+ */
+size_t ota_frame_encode(uint8_t type, uint16_t seq, const uint8_t *payload, uint16_t length, uint8_t *out);
+
+/**
+ * Decode an encoded frame (without delimiter) in place, frame->payload points into buffer
+ * @return ESP_OK, or ESP_ERR_INVALID_CRC / ESP_ERR_INVALID_SIZE for a damaged frame
+ */
+esp_err_t ota_frame_decode(uint8_t *buffer, size_t length, ota_frame_t *frame);
+
+#endif
@@ -0,0 +1,132 @@
+#include "ota_lz.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define LZ_HASH_BITS 12
+#define LZ_CHAIN_DEPTH 64 // candidates tried per position
+#define LZ_NO_POSITION UINT32_MAX
+
+static uint32_t lz_hash(const uint8_t *data)
+{
+    uint32_t value = data[0] | (data[1] << 8) | (data[2] << 16);
+    return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+esp_err_t ota_lz_compress(const uint8_t *data, size_t size, size_t max_size, ota_lz_write_cb_t write, void *context,
+                          size_t *out_size)
+{
+    // newest position per hash, and the previous position with the same hash per window slot
+    uint32_t *head = malloc(sizeof(uint32_t) << LZ_HASH_BITS);
+    uint32_t *chain = malloc(sizeof(uint32_t) * OTA_LZ_WINDOW_SIZE);
+    if (head == NULL || chain == NULL)
+    {
+        free(head);
+        free(chain);
+        return ESP_ERR_NO_MEM;
+    }
+    memset(head, 0xFF, sizeof(uint32_t) << LZ_HASH_BITS);
+
+    // the stream goes out a group of eight items at a time: the group's flag byte is
+    // only complete at its end
+    uint8_t stream[OTA_LZ_OUT_CHUNK];
+    size_t length = 0; // in stream
+    size_t written = 0; // handed to write before it
+    size_t flag_index = 0;
+    int flag_count = 8; // items under the current flag byte
+    size_t pos = 0;
+    esp_err_t err = ESP_OK;
+
+    while (pos < size)
+    {
+        // a flag byte, then up to two bytes for the item
+        if (written + length + 3 > max_size)
+        {
+            err = ESP_ERR_INVALID_SIZE;
+            break;
+        }
+        if (flag_count == 8)
+        {
+            if (length + 1 + 8 * 2 > sizeof(stream))
+            {
+                if ((err = write(stream, length, context)) != ESP_OK)
+                {
+                    break;
+                }
+                written += length;
+                length = 0;
+            }
+            flag_index = length++;
+            stream[flag_index] = 0;
+            flag_count = 0;
+        }
+
+        size_t best_length = 0;
+        size_t best_offset = 0;
+        if (pos + OTA_LZ_MIN_MATCH <= size)
+        {
+            uint32_t candidate = head[lz_hash(data + pos)];
+            size_t limit = size - pos < OTA_LZ_MAX_MATCH ? size - pos : OTA_LZ_MAX_MATCH;
+            for (int depth = 0; depth < LZ_CHAIN_DEPTH && candidate != LZ_NO_POSITION &&
+                                pos - candidate <= OTA_LZ_WINDOW_SIZE;
+                 depth++)
+            {
+                size_t match = 0;
+                while (match < limit && data[candidate + match] == data[pos + match])
+                {
+                    match++;
+                }
+                if (match > best_length)
+                {
+                    best_length = match;
+                    best_offset = pos - candidate;
+                    if (match == limit)
+                    {
+                        break;
+                    }
+                }
+                uint32_t previous = chain[candidate % OTA_LZ_WINDOW_SIZE];
+                if (previous == LZ_NO_POSITION || previous >= candidate)
+                {
+                    break;
+                }
+                candidate = previous;
+            }
+        }
+
+        size_t step = 1;
+        if (best_length >= OTA_LZ_MIN_MATCH)
+        {
+            uint16_t code = ((best_offset - 1) << 5) | (best_length - OTA_LZ_MIN_MATCH);
+            stream[length++] = code >> 8;
+            stream[length++] = code & 0xFF;
+            step = best_length;
+        }
+        else
+        {
+            stream[flag_index] |= 1 << flag_count;
+            stream[length++] = data[pos];
+        }
+        flag_count++;
+
+        // every position covered goes into the hash chains
+        for (size_t i = 0; i < step; i++, pos++)
+        {
+            if (pos + OTA_LZ_MIN_MATCH <= size)
+            {
+                uint32_t hash = lz_hash(data + pos);
+                chain[pos % OTA_LZ_WINDOW_SIZE] = head[hash];
+                head[hash] = pos;
+            }
+        }
+    }
+
+    free(head);
+    free(chain);
+    if (err == ESP_OK && length > 0)
+    {
+        err = write(stream, length, context);
+    }
+    *out_size = written + length;
+    return err;
+}
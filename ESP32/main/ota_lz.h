@@ -0,0 +1,38 @@
+/**
+ * LZSS compression for the STM32 bootloader (matching bootloader ota_lz.c)
+ *
+ * A flag byte describes the next eight items, LSB first: 1 = literal byte,
+ * 0 = match of two bytes, big-endian, offset - 1 in the upper 11 bits and
+ * length - OTA_LZ_MIN_MATCH in the lower 5. The bootloader keeps only the last
+ * OTA_LZ_WINDOW_SIZE bytes of output, so matches reach no further back.
+ */
+#ifndef OTA_LZ_H
+#define OTA_LZ_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define OTA_LZ_WINDOW_SIZE 2048
+#define OTA_LZ_MIN_MATCH 3
+#define OTA_LZ_MAX_MATCH (OTA_LZ_MIN_MATCH + 31)
+
+#define OTA_LZ_OUT_CHUNK 256 // stream handed to the write callback at a time, at most
+
+/**
+ * Receives the stream in order, as it is produced
+ * @return ESP_OK to go on, anything else stops the compression with that error
+ */
+typedef esp_err_t (*ota_lz_write_cb_t)(const uint8_t *data, size_t length, void *context);
+
+/**
+ * Compress data
+ * @param max_size give up when the stream would get larger than this
+ * @param out_size size of the whole stream
+ * @return ESP_OK, ESP_ERR_NO_MEM, ESP_ERR_INVALID_SIZE when it does not compress, or
+ *         what write returned
+ */
+esp_err_t ota_lz_compress(const uint8_t *data, size_t size, size_t max_size, ota_lz_write_cb_t write, void *context,
+                          size_t *out_size);
+
+#endif
@@ -0,0 +1,1446 @@
+#include "ota_transfer.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "ota_delta.h"
+#include "ota_frame.h"
+#include "ota_lz.h"
+
+static const char TAG[] = "ota_transfer";
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+// Frame types sent to STM32 (see ota_frame.h for the frame format)
+#define FW_REQUEST 28
+#define FW_LENGTH 2     // payload: 32-bit firmware size
+#define CHECKSUM_DATA 6 // payload: CRC-32/MPEG-2 of the image
+#define FW_DATA 10      // seq = packet number, payload = firmware data
+#define BAUD_PROPOSE 40 // payload: 32-bit baud rate to switch to
+#define PAGE_CRCS 13    // payload: 32-bit CRC of each flash page of the image
+#define DELTA_BASE 15   // payload: 32-bit old image size, old image CRC, patch size
+#define LZ_START 19     // payload: 32-bit compressed size
+#define RESUME_QUERY 21 // payload: 32-bit image size, CRC-32 of the image
+#define PASS_END 23     // page mode: every page of this pass is sent, answered with PAGE_MAP
+
+// Frame types sent by STM32
+#define FW_READY 31
+#define FW_ERR 4
+#define FW_OK 3 // payload: receive window in frames
+#define CHECKSUM_OK 7 // payload: flash stall and transfer time in 256 cycle units
+#define CHECKSUM_ERR 8
+#define FW_ACK 11 // seq = last packet stored (programmed in the background)
+#define FW_NAK 12 // seq = packet to resend from, in page mode: the oldest page in flight
+#define PAGE_MAP 14 // payload: bitmap of the pages still to send, LSB first
+#define DELTA_ACCEPT 16 // FW_DATA carries the patch from now on
+#define DELTA_REJECT 17 // flash does not hold the old image
+#define FW_BUSY 18      // STM32 still applying a frame, keep waiting for the ACK
+#define LZ_ACCEPT 20    // FW_DATA carries the compressed image from now on
+#define RESUME_POINT 22 // payload: 32-bit image offset the STM32 continues from
+#define BAUD_ACCEPT 41
+#define BAUD_REJECT 42
+
+// Both directions: STM32 echoes BAUD_TEST and answers BAUD_CONFIRM
+#define BAUD_TEST 43 // payload: test pattern
+#define BAUD_CONFIRM 44
+
+// Protocol Settings
+#define PROTOCOL_TIMEOUT_MS 10000 // Increase to 10 seconds for STM32 processing time
+#define DATA_CHUNK_SIZE 8         // Packet size of the legacy stop-and-wait mode
+#define FW_READY_TIMEOUT_MS 2000
+#define FW_READY_ATTEMPTS 3
+
+// Windowed transfer settings
+#define WINDOW_PACKET_SIZE OTA_FRAME_MAX_PAYLOAD
+#define WINDOW_SLOTS 4             // Upper bound, the STM32 announces its window in FW_OK
+#define WINDOW_ACK_TIMEOUT_MS 1000 // STM32 NAKs after 500ms without a frame
+#define WINDOW_MAX_RETRIES 10
+#define WINDOW_DOWNSHIFT_RETRIES 3 // errors in a row before a faster link is given up
+
+// Skip mode: one packet per STM32 flash page, pages whose CRC matches flash are not sent
+#define FLASH_PAGE_SIZE 1024
+#define PAGE_MAP_TIMEOUT_MS 1000
+#define PAGE_MAP_RETRIES 3
+
+// Delta mode: patch against the image last flashed to the STM32, sent whole
+// when the patch would be more than half the image
+#define DELTA_REPLY_TIMEOUT_MS 1000
+#define DELTA_RETRIES 3
+
+// Resuming a cut-off transfer of the same image
+#define RESUME_REPLY_TIMEOUT_MS 500
+#define RESUME_RETRIES 2
+
+// Page mode: passes over the missing pages until the STM32 has all of them
+#define PAGE_PASS_MAX 16
+
+// Image still arriving: how long the link waits for more of it before the STM32 is
+// sent the last packet it acknowledged again, well inside its 500 ms NAK timeout
+#define SOURCE_WAIT_MS 200
+
+// Link speed negotiation, fastest first. The STM32 goes back to the default rate
+// after 300 ms without a valid frame on an unconfirmed rate, 2 s on a confirmed one
+#define LINK_BAUD_DEFAULT OTA_TRANSFER_LINK_BAUD_DEFAULT
+#define BAUD_TEST_ROUNDS 4
+#define BAUD_TEST_SIZE 64
+#define BAUD_REPLY_TIMEOUT_MS 200
+#define BAUD_TRIAL_FALLBACK_MS 400
+#define BAUD_LINK_FALLBACK_MS 2500
+static const uint32_t link_baud_rates[] = {2250000, 921600, 460800};
+static uint32_t link_baud = LINK_BAUD_DEFAULT;
+
+const char *const ota_transfer_mode_names[OTA_TRANSFER_MODE_COUNT] = {"window", "legacy", "skip", "delta", "lz"};
+
+static const ota_transfer_port_t *port = NULL;
+static const ota_transfer_scratch_t *scratch = NULL;
+static ota_transfer_stats_t *stats = NULL; // of the transfer running
+static const ota_transfer_source_t *arriving = NULL; // image of ota_transfer_run_source
+
+// Frame buffers for the STM32 link
+static uint8_t uart_tx_frame[OTA_FRAME_MAX_ENCODED];
+static uint8_t uart_rx_frame[OTA_FRAME_MAX_ENCODED];
+static size_t uart_rx_frame_len = 0;
+static bool uart_rx_overflow = false;
+
+// Encoded payload on the heap, when the caller gives no scratch storage
+typedef struct heap_scratch
+{
+    uint8_t *data;
+    size_t length;
+    size_t max_size;
+} heap_scratch_t;
+
+static esp_err_t heap_scratch_begin(size_t max_size, void *context)
+{
+    heap_scratch_t *heap = context;
+    heap->data = malloc(max_size);
+    heap->length = 0;
+    heap->max_size = max_size;
+    return heap->data != NULL ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+static esp_err_t heap_scratch_write(const uint8_t *data, size_t length, void *context)
+{
+    heap_scratch_t *heap = context;
+    if (heap->length + length > heap->max_size)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(heap->data + heap->length, data, length);
+    heap->length += length;
+    return ESP_OK;
+}
+
+static const uint8_t *heap_scratch_finish(void *context)
+{
+    heap_scratch_t *heap = context;
+    return heap->data;
+}
+
+static void heap_scratch_release(void *context)
+{
+    heap_scratch_t *heap = context;
+    free(heap->data);
+    heap->data = NULL;
+}
+
+static heap_scratch_t heap_scratch_state;
+static const ota_transfer_scratch_t heap_scratch = {
+    .begin = heap_scratch_begin,
+    .write = heap_scratch_write,
+    .finish = heap_scratch_finish,
+    .release = heap_scratch_release,
+    .context = &heap_scratch_state,
+};
+
+void ota_transfer_init(const ota_transfer_port_t *uart_port, const ota_transfer_scratch_t *payload_scratch)
+{
+    port = uart_port;
+    scratch = payload_scratch != NULL ? payload_scratch : &heap_scratch;
+}
+
+// Milliseconds since `start` (port->time_us)
+static inline uint32_t elapsed_ms(int64_t start)
+{
+    return (uint32_t)((port->time_us() - start) / 1000);
+}
+
+// Round trips below 4 us get a bucket each, above that four buckets per power of
+// two, so a bucket is at most a quarter of its lower bound wide
+static int rtt_bucket(int64_t us)
+{
+    if (us < 4)
+    {
+        return us > 0 ? us : 0;
+    }
+    int octave = 63 - __builtin_clzll(us);
+    return MIN((octave - 1) * 4 + ((us >> (octave - 2)) & 3), OTA_TRANSFER_RTT_BUCKETS - 1);
+}
+
+int64_t ota_transfer_rtt_bucket_us(int bucket)
+{
+    if (bucket < 4)
+    {
+        return bucket;
+    }
+    return (int64_t)(4 + bucket % 4) << (bucket / 4 - 1);
+}
+
+// Time from sending a data frame to its FW_ACK
+static void record_ack_rtt(int64_t sent_us)
+{
+    int64_t rtt = port->time_us() - sent_us;
+    stats->ack_histogram[rtt_bucket(rtt)]++;
+    stats->ack_min_us = stats->ack_count == 0 ? rtt : MIN(stats->ack_min_us, rtt);
+    stats->ack_max_us = MAX(stats->ack_max_us, rtt);
+    stats->ack_sum_us += rtt;
+    stats->ack_count++;
+}
+
+// Protocol helper functions for frame-based communication
+static esp_err_t send_frame(uint8_t type, uint16_t seq, const uint8_t *payload, uint16_t length)
+{
+    size_t encoded_length = ota_frame_encode(type, seq, payload, length, uart_tx_frame);
+    int bytes_written = port->write(uart_tx_frame, encoded_length);
+    if (bytes_written != encoded_length)
+    {
+        ESP_LOGE(TAG, "Failed to send frame: type %d, seq %d", type, seq);
+        return ESP_FAIL;
+    }
+    if (type == FW_DATA)
+    {
+        stats->frames_sent++;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t send_command_byte(uint8_t command)
+{
+    if (send_frame(command, 0, NULL, 0) != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Sent command: %d", command);
+    return ESP_OK;
+}
+
+static esp_err_t send_command_with_data(uint8_t command, uint32_t data)
+{
+    uint8_t payload[4];
+    payload[0] = (data >> 24) & 0xFF; // Big-endian format
+    payload[1] = (data >> 16) & 0xFF;
+    payload[2] = (data >> 8) & 0xFF;
+    payload[3] = data & 0xFF;
+
+    if (send_frame(command, 0, payload, sizeof(payload)) != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Sent command: %d with data: %lu", command, (unsigned long)data);
+    return ESP_OK;
+}
+
+// Drop buffered input and any partially received frame
+static void reset_frame_receiver(void)
+{
+    port->flush_input();
+    uart_rx_frame_len = 0;
+    uart_rx_overflow = false;
+}
+
+// Receive the next intact frame; damaged frames are skipped at the next delimiter
+static esp_err_t receive_frame(ota_frame_t *frame, uint32_t timeout_ms)
+{
+    int64_t start_time = port->time_us();
+
+    while (elapsed_ms(start_time) < timeout_ms)
+    {
+        uint8_t byte;
+        if (port->read(&byte, 1, 10) <= 0)
+        {
+            // the STM32 is busy erasing or programming, take in more of the image meanwhile
+            if (arriving != NULL)
+            {
+                arriving->wait(0, 0, arriving->context);
+            }
+            continue;
+        }
+
+        if (byte != OTA_FRAME_DELIMITER)
+        {
+            if (uart_rx_frame_len < sizeof(uart_rx_frame))
+            {
+                uart_rx_frame[uart_rx_frame_len++] = byte;
+            }
+            else
+            {
+                uart_rx_overflow = true;
+            }
+            continue;
+        }
+
+        size_t length = uart_rx_frame_len;
+        bool overflow = uart_rx_overflow;
+        uart_rx_frame_len = 0;
+        uart_rx_overflow = false;
+        if (length == 0 || overflow)
+        {
+            continue;
+        }
+
+        esp_err_t err = ota_frame_decode(uart_rx_frame, length, frame);
+        if (err == ESP_OK)
+        {
+            return ESP_OK;
+        }
+        ESP_LOGW(TAG, "Dropped damaged frame (%s)", esp_err_to_name(err));
+    }
+    return ESP_ERR_TIMEOUT;
+}
+
+static esp_err_t wait_for_response(uint8_t expected_response, uint32_t timeout_ms)
+{
+    int64_t start_time = port->time_us();
+    ota_frame_t frame;
+
+    while (elapsed_ms(start_time) < timeout_ms)
+    {
+        if (receive_frame(&frame, 100) != ESP_OK)
+        {
+            continue;
+        }
+        if (frame.type == expected_response)
+        {
+            ESP_LOGI(TAG, "Received expected response: %d", expected_response);
+            return ESP_OK;
+        }
+        ESP_LOGW(TAG, "Received unexpected response: %d (expected: %d)", frame.type, expected_response);
+    }
+
+    ESP_LOGE(TAG, "Timeout waiting for response: %d", expected_response);
+    return ESP_ERR_TIMEOUT;
+}
+
+// Helper function to wait for either FW_OK or FW_ERR response
+static esp_err_t wait_for_fw_ok_or_err(uint32_t timeout_ms, size_t *window)
+{
+    int64_t start_time = port->time_us();
+    ota_frame_t frame;
+
+    while (elapsed_ms(start_time) < timeout_ms)
+    {
+        if (receive_frame(&frame, 100) != ESP_OK)
+        {
+            continue;
+        }
+        if (frame.type == FW_OK)
+        {
+            *window = (frame.length >= 1 && frame.payload[0] > 0) ? frame.payload[0] : 1;
+            ESP_LOGI(TAG, "Received FW_OK - STM32 accepted the length, window %zu frames", *window);
+            return ESP_OK;
+        }
+        else if (frame.type == FW_ERR)
+        {
+            ESP_LOGE(TAG, "Received FW_ERR - STM32 rejected the length");
+            return ESP_FAIL;
+        }
+        else
+        {
+            ESP_LOGW(TAG, "Received unexpected response: %d (expected: FW_OK=%d or FW_ERR=%d)",
+                     frame.type, FW_OK, FW_ERR);
+        }
+    }
+
+    ESP_LOGE(TAG, "Timeout waiting for FW_OK or FW_ERR response");
+    return ESP_ERR_TIMEOUT;
+}
+
+static void set_link_baud(uint32_t baud)
+{
+    port->set_baud(baud);
+    link_baud = baud;
+    reset_frame_receiver();
+}
+
+// Go back to the default rate and stay silent until the STM32 has done the same
+static void fall_back_to_default_baud(uint32_t wait_ms)
+{
+    set_link_baud(LINK_BAUD_DEFAULT);
+    port->delay_ms(wait_ms);
+    reset_frame_receiver();
+}
+
+// Wait for one of two frame types, anything else (late ACKs, FW_READY) is skipped
+static esp_err_t wait_for_either(uint8_t first, uint8_t second, uint32_t timeout_ms, ota_frame_t *frame)
+{
+    int64_t start_time = port->time_us();
+
+    while (elapsed_ms(start_time) < timeout_ms)
+    {
+        if (receive_frame(frame, 50) == ESP_OK && (frame->type == first || frame->type == second))
+        {
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_TIMEOUT;
+}
+
+// Propose a rate, switch, and echo test patterns through the STM32 before confirming it
+static esp_err_t try_baud_rate(uint32_t baud)
+{
+    ota_frame_t frame;
+
+    if (send_command_with_data(BAUD_PROPOSE, baud) != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+    if (wait_for_either(BAUD_ACCEPT, BAUD_REJECT, BAUD_REPLY_TIMEOUT_MS, &frame) != ESP_OK)
+    {
+        // the STM32 may have switched without us seeing the answer
+        fall_back_to_default_baud(BAUD_TRIAL_FALLBACK_MS);
+        return ESP_ERR_TIMEOUT;
+    }
+    if (frame.type == BAUD_REJECT)
+    {
+        ESP_LOGI(TAG, "STM32 cannot run at %lu baud", (unsigned long)baud);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    set_link_baud(baud);
+    port->delay_ms(2);
+
+    uint8_t pattern[BAUD_TEST_SIZE];
+    for (int round = 0; round < BAUD_TEST_ROUNDS; round++)
+    {
+        // long runs of 0x00/0xFF and alternating bits
+        for (int i = 0; i < BAUD_TEST_SIZE; i++)
+        {
+            pattern[i] = (uint8_t)(i * 0x1D + round * 0x47) ^ ((i & 1) ? 0x55 : 0xAA);
+        }
+        if (round == 0)
+        {
+            memset(pattern, 0x00, BAUD_TEST_SIZE / 4);
+            memset(pattern + BAUD_TEST_SIZE / 4, 0xFF, BAUD_TEST_SIZE / 4);
+        }
+
+        if (send_frame(BAUD_TEST, round, pattern, sizeof(pattern)) != ESP_OK ||
+            wait_for_either(BAUD_TEST, BAUD_TEST, BAUD_REPLY_TIMEOUT_MS, &frame) != ESP_OK ||
+            frame.seq != round || frame.length != sizeof(pattern) ||
+            memcmp(frame.payload, pattern, sizeof(pattern)) != 0)
+        {
+            ESP_LOGW(TAG, "Test pattern failed at %lu baud (round %d)", (unsigned long)baud, round);
+            fall_back_to_default_baud(BAUD_TRIAL_FALLBACK_MS);
+            return ESP_FAIL;
+        }
+    }
+
+    if (send_command_byte(BAUD_CONFIRM) != ESP_OK ||
+        wait_for_either(BAUD_CONFIRM, BAUD_CONFIRM, BAUD_REPLY_TIMEOUT_MS, &frame) != ESP_OK)
+    {
+        // the STM32 may hold the rate as confirmed, wait out its longer fallback
+        fall_back_to_default_baud(BAUD_LINK_FALLBACK_MS);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+// Move the link to the fastest rate below `limit` that passes the test; stays at
+// the default rate if none does
+static uint32_t negotiate_baud_rate(uint32_t limit)
+{
+    for (size_t i = 0; i < sizeof(link_baud_rates) / sizeof(link_baud_rates[0]); i++)
+    {
+        if (link_baud_rates[i] >= limit)
+        {
+            continue;
+        }
+        if (try_baud_rate(link_baud_rates[i]) == ESP_OK)
+        {
+            ESP_LOGI(TAG, "Link running at %lu baud", (unsigned long)link_baud);
+            return link_baud;
+        }
+    }
+    ESP_LOGW(TAG, "Link stays at %lu baud", (unsigned long)link_baud);
+    return link_baud;
+}
+
+// CRC-32/MPEG-2, what the STM32 CRC unit computes over flash
+uint32_t ota_transfer_image_crc32(const uint8_t *data, size_t size)
+{
+    return ota_frame_crc32(data, size, OTA_FRAME_CRC32_INIT);
+}
+
+// Send the CRC of every page and get back the bitmap of pages that differ from flash
+static esp_err_t request_page_map(const uint8_t *firmware_data, size_t file_size, uint8_t *page_map, size_t map_size)
+{
+    size_t page_count = (file_size + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE;
+    if (page_count * 4 > OTA_FRAME_MAX_PAYLOAD || (page_count + 7) / 8 > map_size)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    uint8_t crcs[OTA_FRAME_MAX_PAYLOAD];
+    for (size_t i = 0; i < page_count; i++)
+    {
+        size_t offset = i * FLASH_PAGE_SIZE;
+        uint32_t crc = ota_transfer_image_crc32(firmware_data + offset, MIN(FLASH_PAGE_SIZE, file_size - offset));
+        crcs[i * 4] = (crc >> 24) & 0xFF;
+        crcs[i * 4 + 1] = (crc >> 16) & 0xFF;
+        crcs[i * 4 + 2] = (crc >> 8) & 0xFF;
+        crcs[i * 4 + 3] = crc & 0xFF;
+    }
+
+    for (int retry = 0; retry < PAGE_MAP_RETRIES; retry++)
+    {
+        ota_frame_t frame;
+        if (send_frame(PAGE_CRCS, 0, crcs, page_count * 4) != ESP_OK)
+        {
+            return ESP_FAIL;
+        }
+        if (wait_for_either(PAGE_MAP, PAGE_MAP, PAGE_MAP_TIMEOUT_MS, &frame) == ESP_OK)
+        {
+            memset(page_map, 0xFF, map_size);
+            memcpy(page_map, frame.payload, MIN(frame.length, map_size));
+            return ESP_OK;
+        }
+        ESP_LOGW(TAG, "No PAGE_MAP, sending page CRCs again");
+    }
+    return ESP_ERR_TIMEOUT;
+}
+
+// Patch (delta mode) or compressed image (lz mode) into the scratch storage, before
+// the handshake: it takes longer than the STM32 keeps a fast link up without a frame.
+// NULL: nothing to gain or no room, the image goes as it is
+static const uint8_t *encode_payload(ota_transfer_mode_e mode, const uint8_t *firmware_data, size_t file_size,
+                                     const uint8_t *base, size_t base_size, size_t *encoded_size)
+{
+    if (mode == OTA_TRANSFER_MODE_DELTA && base == NULL)
+    {
+        ESP_LOGW(TAG, "No image of the STM32 application kept");
+        return NULL;
+    }
+    // worth it below half the image, compressed below the image size
+    size_t max_size = mode == OTA_TRANSFER_MODE_DELTA ? file_size / 2 : file_size;
+    esp_err_t err = scratch->begin(max_size, scratch->context);
+    if (err == ESP_OK)
+    {
+        if (mode == OTA_TRANSFER_MODE_DELTA)
+        {
+            err = ota_delta_encode(base, base_size, firmware_data, file_size, max_size, scratch->write, scratch->context,
+                                   encoded_size);
+        }
+        else
+        {
+            err = ota_lz_compress(firmware_data, file_size, max_size, scratch->write, scratch->context, encoded_size);
+        }
+    }
+    const uint8_t *encoded = err == ESP_OK ? scratch->finish(scratch->context) : NULL;
+    if (encoded == NULL)
+    {
+        ESP_LOGW(TAG, "Image not %s (%s)", mode == OTA_TRANSFER_MODE_DELTA ? "patched" : "compressed",
+                 esp_err_to_name(err != ESP_OK ? err : ESP_FAIL));
+        scratch->release(scratch->context);
+        return NULL;
+    }
+    ESP_LOGI(TAG, "%s: %zu bytes for a %zu byte image", mode == OTA_TRANSFER_MODE_DELTA ? "Patch" : "Compressed",
+             *encoded_size, file_size);
+    return encoded;
+}
+
+// Have the STM32 check that its flash still holds the image the patch was made
+// against. ESP_ERR_NOT_SUPPORTED: send the image whole
+static esp_err_t start_delta(const uint8_t *base, size_t base_size, size_t patch_size)
+{
+    uint32_t base_crc = ota_transfer_image_crc32(base, base_size);
+    uint8_t payload[12];
+    uint32_t fields[3] = {base_size, base_crc, patch_size};
+    for (int i = 0; i < 12; i++)
+    {
+        payload[i] = (fields[i / 4] >> (24 - 8 * (i % 4))) & 0xFF;
+    }
+    for (int retry = 0; retry < DELTA_RETRIES; retry++)
+    {
+        ota_frame_t frame;
+        if (send_frame(DELTA_BASE, 0, payload, sizeof(payload)) != ESP_OK)
+        {
+            break;
+        }
+        if (wait_for_either(DELTA_ACCEPT, DELTA_REJECT, DELTA_REPLY_TIMEOUT_MS, &frame) == ESP_OK)
+        {
+            if (frame.type == DELTA_ACCEPT)
+            {
+                return ESP_OK;
+            }
+            ESP_LOGW(TAG, "STM32 flash does not hold the kept image");
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+    }
+    return ESP_ERR_TIMEOUT;
+}
+
+// Ask the STM32 how much of this image its journal says is already in flash. An
+// answer also puts it in page mode, the page map then lists the pages after the
+// resume point. ESP_ERR_NOT_SUPPORTED: no answer, a bootloader without page mode
+static esp_err_t request_resume(uint32_t image_crc, size_t file_size, uint8_t *page_map, size_t map_size,
+                                uint32_t *offset)
+{
+    uint8_t payload[8];
+    uint32_t fields[2] = {(uint32_t)file_size, image_crc};
+    for (int i = 0; i < 8; i++)
+    {
+        payload[i] = (fields[i / 4] >> (24 - 8 * (i % 4))) & 0xFF;
+    }
+
+    for (int retry = 0; retry < RESUME_RETRIES; retry++)
+    {
+        ota_frame_t frame;
+        if (send_frame(RESUME_QUERY, 0, payload, sizeof(payload)) != ESP_OK)
+        {
+            break;
+        }
+        if (wait_for_either(RESUME_POINT, RESUME_POINT, RESUME_REPLY_TIMEOUT_MS, &frame) != ESP_OK)
+        {
+            continue;
+        }
+        if (frame.length < 4)
+        {
+            break;
+        }
+
+        *offset = ((uint32_t)frame.payload[0] << 24) | ((uint32_t)frame.payload[1] << 16) |
+                  ((uint32_t)frame.payload[2] << 8) | frame.payload[3];
+        if (*offset > file_size)
+        {
+            break;
+        }
+
+        // the resume point is a page boundary or the end of the image. The vector table
+        // goes along again, the STM32 holds it back until the image is verified
+        size_t page_count = (file_size + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE;
+        memset(page_map, 0, map_size);
+        page_map[0] = 1;
+        for (size_t i = (*offset + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE; i < page_count && i / 8 < map_size; i++)
+        {
+            page_map[i / 8] |= 1 << (i % 8);
+        }
+        return ESP_OK;
+    }
+    *offset = 0;
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+// Announce the compressed size
+static esp_err_t start_lz(size_t stream_size)
+{
+    for (int retry = 0; retry < DELTA_RETRIES; retry++)
+    {
+        ota_frame_t frame;
+        if (send_command_with_data(LZ_START, stream_size) != ESP_OK)
+        {
+            break;
+        }
+        if (wait_for_either(LZ_ACCEPT, FW_ERR, DELTA_REPLY_TIMEOUT_MS, &frame) == ESP_OK)
+        {
+            if (frame.type == LZ_ACCEPT)
+            {
+                return ESP_OK;
+            }
+            break;
+        }
+    }
+    return ESP_FAIL;
+}
+
+// Error rate went up: drop to the default rate and renegotiate below the failing one
+static bool downshift_link(int retries)
+{
+    if (retries < WINDOW_DOWNSHIFT_RETRIES || link_baud == LINK_BAUD_DEFAULT)
+    {
+        return false;
+    }
+    uint32_t failing_baud = link_baud;
+    ESP_LOGW(TAG, "Link errors at %lu baud, falling back", (unsigned long)failing_baud);
+    stats->downshifts++;
+    fall_back_to_default_baud(BAUD_LINK_FALLBACK_MS);
+    negotiate_baud_rate(failing_baud);
+    return true;
+}
+
+// Packet number of the i-th packet to send, every packet when there is no order
+static inline size_t packet_seq(const uint16_t *order, size_t i)
+{
+    return order ? order[i] : i;
+}
+
+// Payload of the data frame being sent, read from the image source
+static uint8_t packet_buffer[OTA_FRAME_MAX_PAYLOAD];
+
+// Image in memory, all of it there from the start
+typedef struct memory_source
+{
+    const uint8_t *data;
+} memory_source_t;
+
+static esp_err_t memory_source_wait(size_t length, uint32_t timeout_ms, void *context)
+{
+    return ESP_OK;
+}
+
+static esp_err_t memory_source_read(size_t offset, uint8_t *data, size_t length, void *context)
+{
+    const memory_source_t *memory = context;
+    memcpy(data, memory->data + offset, length);
+    return ESP_OK;
+}
+
+// Packet at `offset` into packet_buffer. With nothing in flight the link may wait a
+// while for it to arrive, otherwise ESP_ERR_TIMEOUT comes at once so the ACKs are
+// read. ESP_ERR_INVALID_SIZE: the image stopped arriving
+static esp_err_t read_packet(const ota_transfer_source_t *source, size_t offset, size_t length, bool idle)
+{
+    int64_t start = port->time_us();
+    esp_err_t err = source->wait(offset + length, idle ? SOURCE_WAIT_MS : 0, source->context);
+    if (idle)
+    {
+        stats->source_wait_us += port->time_us() - start;
+    }
+    if (err == ESP_OK)
+    {
+        err = source->read(offset, packet_buffer, length, source->context);
+    }
+    if (err != ESP_OK && err != ESP_ERR_TIMEOUT)
+    {
+        ESP_LOGE(TAG, "Image ended at offset %zu (%s)", offset, esp_err_to_name(err));
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return err;
+}
+
+// Send the last packet the STM32 acknowledged again. It just ACKs it once more, but
+// the frame keeps it from NAKing and from dropping a fast link while the image arrives
+static esp_err_t send_keepalive(const ota_transfer_source_t *source, size_t file_size, size_t packet_size,
+                                size_t seq)
+{
+    size_t offset = seq * packet_size;
+    size_t length = MIN(packet_size, file_size - offset);
+    if (source->read(offset, packet_buffer, length, source->context) != ESP_OK)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return send_frame(FW_DATA, seq, packet_buffer, length);
+}
+
+// Sliding-window transfer: keep up to `window` FW_DATA frames in flight, slide on
+// cumulative FW_ACK and go back to the requested packet on FW_NAK or timeout.
+// The legacy mode is the same exchange with 8-byte packets and a window of 1.
+// With an `order` only the listed packets are sent, the STM32 steps over the rest.
+// Packets go out as the source has them; waiting for it does not count as an error.
+static esp_err_t send_packets(const ota_transfer_source_t *source, size_t file_size, size_t packet_size,
+                              size_t window, const uint16_t *order, size_t packet_count)
+{
+    size_t base = 0; // oldest unacknowledged packet (index into order)
+    size_t next = 0; // next packet to send
+    int64_t sent_us[WINDOW_SLOTS]; // last transmission of the packets in flight
+    int retries = 0;
+
+    window = MIN(window, WINDOW_SLOTS);
+    while (base < packet_count)
+    {
+        while (next < packet_count && next - base < window)
+        {
+            size_t offset = packet_seq(order, next) * packet_size;
+            size_t length = MIN(packet_size, file_size - offset);
+            esp_err_t err = read_packet(source, offset, length, next == base);
+            if (err == ESP_ERR_TIMEOUT)
+            {
+                break;
+            }
+            if (err != ESP_OK)
+            {
+                return err;
+            }
+            sent_us[next % WINDOW_SLOTS] = port->time_us();
+            if (send_frame(FW_DATA, packet_seq(order, next), packet_buffer, length) != ESP_OK)
+            {
+                return ESP_FAIL;
+            }
+            next++;
+        }
+        if (next == base && base > 0)
+        {
+            // nothing in flight and the next packet not there yet
+            esp_err_t err = send_keepalive(source, file_size, packet_size, packet_seq(order, base - 1));
+            if (err != ESP_OK)
+            {
+                return err;
+            }
+        }
+
+        ota_frame_t frame;
+        esp_err_t err = receive_frame(&frame, WINDOW_ACK_TIMEOUT_MS);
+
+        if (err == ESP_OK && frame.type == FW_ACK)
+        {
+            if (base < next && frame.seq >= packet_seq(order, base) && frame.seq <= packet_seq(order, next - 1))
+            {
+                while (base < next && packet_seq(order, base) <= frame.seq)
+                {
+                    base++;
+                }
+                if (packet_seq(order, base - 1) == frame.seq)
+                {
+                    record_ack_rtt(sent_us[(base - 1) % WINDOW_SLOTS]);
+                }
+                retries = 0;
+                if (base == packet_count || base % MAX(16384 / packet_size, 1) == 0)
+                {
+                    ESP_LOGI(TAG, "Progress: %d%% (%zu/%zu packets)", (int)((base * 100) / packet_count), base,
+                             packet_count);
+                }
+            }
+            continue;
+        }
+        if (err == ESP_OK && frame.type == FW_BUSY)
+        {
+            continue;
+        }
+        if (err == ESP_OK && frame.type == FW_ERR)
+        {
+            ESP_LOGE(TAG, "STM32 aborted the transfer at packet %d", frame.seq);
+            return ESP_FAIL;
+        }
+
+        if (++retries > WINDOW_MAX_RETRIES)
+        {
+            ESP_LOGE(TAG, "Transfer stalled at packet %zu", base);
+            return ESP_ERR_TIMEOUT;
+        }
+        if (downshift_link(retries))
+        {
+            retries = 0;
+            next = base;
+            continue;
+        }
+        if (err == ESP_OK && frame.type == FW_NAK && frame.seq >= packet_seq(order, base))
+        {
+            ESP_LOGW(TAG, "FW_NAK: resending from packet %d", frame.seq);
+            stats->naks++;
+            while (base < next && packet_seq(order, base) < frame.seq)
+            {
+                base++;
+            }
+        }
+        else
+        {
+            ESP_LOGW(TAG, "ACK timeout: resending from packet %zu", packet_seq(order, base));
+            if (err != ESP_OK)
+            {
+                stats->ack_timeouts++;
+            }
+        }
+        next = base;
+    }
+    return ESP_OK;
+}
+
+// Pages not yet acknowledged, oldest first: the order they went out in
+typedef struct
+{
+    uint16_t page[WINDOW_SLOTS];
+    int64_t sent_us[WINDOW_SLOTS];
+    size_t count;
+} page_flight_t;
+
+static esp_err_t send_page(page_flight_t *flight, const uint8_t *firmware_data, size_t file_size, uint16_t page)
+{
+    size_t offset = (size_t)page * FLASH_PAGE_SIZE;
+    flight->page[flight->count] = page;
+    flight->sent_us[flight->count] = port->time_us();
+    flight->count++;
+    return send_frame(FW_DATA, page, firmware_data + offset, MIN(FLASH_PAGE_SIZE, file_size - offset));
+}
+
+static void drop_page(page_flight_t *flight, size_t index)
+{
+    flight->count--;
+    memmove(&flight->page[index], &flight->page[index + 1], (flight->count - index) * sizeof(flight->page[0]));
+    memmove(&flight->sent_us[index], &flight->sent_us[index + 1], (flight->count - index) * sizeof(flight->sent_us[0]));
+}
+
+// Send the oldest page in flight again, it becomes the newest
+static esp_err_t resend_oldest_page(page_flight_t *flight, const uint8_t *firmware_data, size_t file_size)
+{
+    uint16_t page = flight->page[0];
+    drop_page(flight, 0);
+    return send_page(flight, firmware_data, file_size, page);
+}
+
+// One page mode pass: every listed page once, up to `window` frames in flight. Each
+// page is acknowledged on its own. The link keeps frames in order, so a page still
+// unacknowledged when a later one is, or when the STM32 NAKs a bad frame, was lost
+// and goes again right away; only what is lost on top of that waits for the next
+// pass. Errors cost single pages instead of stalling the window.
+static esp_err_t send_page_pass(const uint8_t *firmware_data, size_t file_size, size_t window,
+                                const uint16_t *pages, size_t count)
+{
+    page_flight_t flight = {.count = 0};
+    size_t next = 0;
+    int retries = 0;
+
+    window = MIN(window, WINDOW_SLOTS);
+    while (next < count || flight.count > 0)
+    {
+        while (next < count && flight.count < window)
+        {
+            if (send_page(&flight, firmware_data, file_size, pages[next++]) != ESP_OK)
+            {
+                return ESP_FAIL;
+            }
+        }
+
+        ota_frame_t frame;
+        esp_err_t err = receive_frame(&frame, WINDOW_ACK_TIMEOUT_MS);
+
+        if (err == ESP_OK && frame.type == FW_ACK)
+        {
+            size_t acked = 0;
+            while (acked < flight.count && flight.page[acked] != frame.seq)
+            {
+                acked++;
+            }
+            if (acked == flight.count)
+            {
+                continue; // a page acknowledged before
+            }
+            record_ack_rtt(flight.sent_us[acked]);
+            drop_page(&flight, acked);
+            retries = 0;
+
+            // the pages sent before it were lost
+            for (size_t i = 0; i < acked; i++)
+            {
+                if (resend_oldest_page(&flight, firmware_data, file_size) != ESP_OK)
+                {
+                    return ESP_FAIL;
+                }
+            }
+            continue;
+        }
+        if (err == ESP_OK && frame.type == FW_NAK)
+        {
+            // the ACKs before it are in, the oldest page is the one that came in bad
+            if (flight.count > 0)
+            {
+                stats->naks++;
+                if (resend_oldest_page(&flight, firmware_data, file_size) != ESP_OK)
+                {
+                    return ESP_FAIL;
+                }
+            }
+            continue;
+        }
+        if (err == ESP_OK && frame.type == FW_BUSY)
+        {
+            continue;
+        }
+        if (err == ESP_OK && frame.type == FW_ERR)
+        {
+            ESP_LOGE(TAG, "STM32 aborted the transfer at page %d", frame.seq);
+            return ESP_FAIL;
+        }
+        if (err == ESP_OK)
+        {
+            continue;
+        }
+
+        // nothing for a while: what is still in flight is lost, PAGE_MAP will list it
+        flight.count = 0;
+        stats->ack_timeouts++;
+        if (++retries > WINDOW_MAX_RETRIES)
+        {
+            ESP_LOGE(TAG, "Transfer stalled at page %zu", next);
+            return ESP_ERR_TIMEOUT;
+        }
+        if (downshift_link(retries))
+        {
+            retries = 0;
+        }
+    }
+    return ESP_OK;
+}
+
+// End a pass and get the map of the pages the STM32 still misses
+static esp_err_t request_missing_pages(uint8_t *page_map, size_t map_size)
+{
+    for (int retry = 0; retry < PAGE_MAP_RETRIES; retry++)
+    {
+        ota_frame_t frame;
+        if (send_frame(PASS_END, 0, NULL, 0) != ESP_OK)
+        {
+            return ESP_FAIL;
+        }
+        if (wait_for_either(PAGE_MAP, PAGE_MAP, PAGE_MAP_TIMEOUT_MS, &frame) == ESP_OK)
+        {
+            memset(page_map, 0xFF, map_size);
+            memcpy(page_map, frame.payload, MIN(frame.length, map_size));
+            return ESP_OK;
+        }
+        ESP_LOGW(TAG, "No PAGE_MAP after the pass, asking again");
+    }
+    return ESP_ERR_TIMEOUT;
+}
+
+// Page mode transfer: passes over the pages in the map, each followed by PASS_END,
+// until the STM32 reports none missing. On a noisy link a pass loses some pages and
+// only those are sent again
+static esp_err_t send_pages(const uint8_t *firmware_data, size_t file_size, size_t window, uint8_t *page_map,
+                            size_t map_size, size_t *packets_sent)
+{
+    size_t page_count = (file_size + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE;
+    uint16_t *pages = malloc(page_count * sizeof(uint16_t));
+    if (pages == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = ESP_ERR_TIMEOUT;
+    *packets_sent = 0;
+    for (int pass = 0; pass < PAGE_PASS_MAX; pass++)
+    {
+        size_t count = 0;
+        for (size_t i = 0; i < page_count; i++)
+        {
+            if (page_map[i / 8] & (1 << (i % 8)))
+            {
+                pages[count++] = i;
+            }
+        }
+        if (count == 0)
+        {
+            err = ESP_OK;
+            break;
+        }
+        ESP_LOGI(TAG, "Pass %d: sending %zu of %zu pages", pass + 1, count, page_count);
+
+        *packets_sent += count;
+        stats->passes++;
+        err = send_page_pass(firmware_data, file_size, window, pages, count);
+        if (err == ESP_OK)
+        {
+            err = request_missing_pages(page_map, map_size);
+        }
+        if (err != ESP_OK)
+        {
+            break;
+        }
+        err = ESP_ERR_TIMEOUT;
+    }
+    free(pages);
+    return err;
+}
+
+// Send the whole image, or with a page map (skip mode) only the pages it marks
+static esp_err_t send_firmware(const uint8_t *firmware_data, size_t file_size, size_t packet_size, size_t window,
+                               const uint8_t *page_map, size_t *packets_sent)
+{
+    size_t packet_count = (file_size + packet_size - 1) / packet_size;
+    memory_source_t memory = {.data = firmware_data};
+    const ota_transfer_source_t source = {
+        .wait = memory_source_wait,
+        .read = memory_source_read,
+        .context = &memory,
+    };
+    if (page_map == NULL)
+    {
+        *packets_sent = packet_count;
+        return send_packets(&source, file_size, packet_size, window, NULL, packet_count);
+    }
+
+    uint16_t *order = malloc(packet_count * sizeof(uint16_t));
+    if (order == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < packet_count; i++)
+    {
+        if (page_map[i / 8] & (1 << (i % 8)))
+        {
+            order[count++] = i;
+        }
+    }
+    *packets_sent = count;
+    ESP_LOGI(TAG, "Sending %zu of %zu pages, the rest already match", count, packet_count);
+
+    esp_err_t err = send_packets(&source, file_size, packet_size, window, order, count);
+    free(order);
+    return err;
+}
+
+// Handshake up to FW_OK: FW_REQUEST until FW_READY, the link rate, then the length
+static esp_err_t start_transfer(ota_transfer_mode_e mode, size_t size, size_t *window, const char **message)
+{
+    // Every transfer starts at the default rate, so does a freshly reset STM32
+    set_link_baud(LINK_BAUD_DEFAULT);
+
+    // Step 1: Send FW_REQUEST command (using byte protocol)
+    ESP_LOGI(TAG, "Step 1: Sending FW_REQUEST");
+    if (send_command_byte(FW_REQUEST) != ESP_OK)
+    {
+        *message = "Failed to send FW_REQUEST";
+        return ESP_FAIL;
+    }
+
+    // Clear any spurious responses from UART buffer
+    reset_frame_receiver();
+    port->delay_ms(20); // Reduced settling time
+
+    // Step 2: Wait for FW_READY response with retry mechanism
+    ESP_LOGI(TAG, "Step 2: Waiting for FW_READY");
+    bool fw_ready_received = false;
+    for (int retry = 0; retry < FW_READY_ATTEMPTS && !fw_ready_received; retry++)
+    {
+        if (retry > 0)
+        {
+            ESP_LOGW(TAG, "FW_READY retry attempt %d/%d", retry + 1, FW_READY_ATTEMPTS);
+            stats->ready_retries++;
+            // Send FW_REQUEST again
+            reset_frame_receiver();
+            if (send_command_byte(FW_REQUEST) != ESP_OK)
+            {
+                continue;
+            }
+        }
+
+        if (wait_for_response(FW_READY, FW_READY_TIMEOUT_MS) == ESP_OK)
+        {
+            fw_ready_received = true;
+        }
+    }
+
+    if (!fw_ready_received)
+    {
+        ESP_LOGE(TAG, "STM32 completely unresponsive after %d attempts - may need hardware reset", FW_READY_ATTEMPTS);
+        *message = "STM32 not ready for firmware update";
+        return ESP_ERR_TIMEOUT;
+    }
+
+    // Legacy mode stays at the default rate for comparison
+    if (mode != OTA_TRANSFER_MODE_LEGACY)
+    {
+        ESP_LOGI(TAG, "Step 2b: Negotiating link speed");
+        negotiate_baud_rate(UINT32_MAX);
+    }
+
+    // Step 3: Send FW_LENGTH command
+    ESP_LOGI(TAG, "Step 3: Sending FW_LENGTH: %zu bytes", size);
+    if (send_command_with_data(FW_LENGTH, (uint32_t)size) != ESP_OK)
+    {
+        *message = "Failed to send FW_LENGTH";
+        return ESP_FAIL;
+    }
+
+    // Step 4: Wait for FW_OK or FW_ERR response
+    ESP_LOGI(TAG, "Step 4: Waiting for FW_OK or FW_ERR");
+    esp_err_t length_response = wait_for_fw_ok_or_err(PROTOCOL_TIMEOUT_MS, window);
+    if (length_response == ESP_FAIL)
+    {
+        *message = "STM32 rejected firmware length (FW_ERR)";
+        return ESP_FAIL;
+    }
+    else if (length_response != ESP_OK)
+    {
+        *message = "STM32 length response timeout";
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+
+// Steps 6 and 7: send the CRC and wait for the STM32 to compare it with its flash
+static esp_err_t verify_transfer(uint32_t firmware_checksum, const char **message)
+{
+    ESP_LOGI(TAG, "Step 6: Sending CRC-32: 0x%08lX", (unsigned long)firmware_checksum);
+    if (send_command_with_data(CHECKSUM_DATA, firmware_checksum) != ESP_OK)
+    {
+        *message = "Failed to send checksum";
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Step 7: Waiting for checksum verification");
+    int64_t start_time = port->time_us();
+    while (elapsed_ms(start_time) < PROTOCOL_TIMEOUT_MS)
+    {
+        ota_frame_t frame;
+        if (receive_frame(&frame, 100) != ESP_OK)
+        {
+            continue;
+        }
+
+        // Check for CHECKSUM_OK
+        if (frame.type == CHECKSUM_OK)
+        {
+            ESP_LOGI(TAG, "Checksum verification: SUCCESS");
+            if (frame.length >= 8)
+            {
+                uint32_t stall = ((uint32_t)frame.payload[0] << 24) | ((uint32_t)frame.payload[1] << 16) |
+                                 ((uint32_t)frame.payload[2] << 8) | frame.payload[3];
+                uint32_t total = ((uint32_t)frame.payload[4] << 24) | ((uint32_t)frame.payload[5] << 16) |
+                                 ((uint32_t)frame.payload[6] << 8) | frame.payload[7];
+                stats->flash_stall_permille = total > 0 ? (uint32_t)((uint64_t)stall * 1000 / total) : 0;
+                ESP_LOGI(TAG, "Link stalled on flash for %lu.%lu%% of the transfer",
+                         (unsigned long)stats->flash_stall_permille / 10, (unsigned long)stats->flash_stall_permille % 10);
+            }
+            return ESP_OK;
+        }
+
+        // Check for CHECKSUM_ERR, or FW_ERR when programming the last page failed
+        if (frame.type == CHECKSUM_ERR || frame.type == FW_ERR)
+        {
+            ESP_LOGE(TAG, "Checksum verification: FAILED");
+            *message = "Firmware transfer failed - checksum error";
+            return ESP_ERR_INVALID_CRC;
+        }
+
+        // Late duplicate ACKs are harmless here
+        if (frame.type != FW_ACK)
+        {
+            ESP_LOGW(TAG, "Received unexpected checksum response: %d (expected: CHECKSUM_OK=%d or CHECKSUM_ERR=%d)",
+                     frame.type, CHECKSUM_OK, CHECKSUM_ERR);
+        }
+    }
+
+    ESP_LOGE(TAG, "Timeout waiting for checksum verification");
+    *message = "Checksum verification timeout";
+    return ESP_ERR_TIMEOUT;
+}
+
+static esp_err_t run_transfer(ota_transfer_mode_e mode, const uint8_t *firmware_data, size_t file_size,
+                              const uint8_t *base, size_t base_size, const uint8_t *encoded, size_t encoded_size,
+                              const char **message)
+{
+    // CRC of the whole image, the STM32 computes the same over its flash
+    uint32_t firmware_checksum = ota_transfer_image_crc32(firmware_data, file_size);
+    ESP_LOGI(TAG, "Firmware CRC-32: 0x%08lX", (unsigned long)firmware_checksum);
+
+    size_t window = 1;
+    esp_err_t err = start_transfer(mode, file_size, &window, message);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    // Step 4a: Continue where a cut-off transfer of this image stopped
+    int64_t transfer_start = port->time_us();
+    uint8_t page_map[OTA_FRAME_MAX_PAYLOAD / 4 / 8];
+    uint32_t resume_offset = 0;
+    bool page_mode = false;
+    if (mode == OTA_TRANSFER_MODE_WINDOW || mode == OTA_TRANSFER_MODE_SKIP)
+    {
+        page_mode = request_resume(firmware_checksum, file_size, page_map, sizeof(page_map), &resume_offset) == ESP_OK;
+        if (resume_offset > 0)
+        {
+            ESP_LOGI(TAG, "Step 4a: Resuming at offset %lu of %zu", (unsigned long)resume_offset, file_size);
+        }
+    }
+
+    // Step 4b: Skip mode - find out which pages differ from the STM32 flash
+    if (mode == OTA_TRANSFER_MODE_SKIP && resume_offset == 0)
+    {
+        ESP_LOGI(TAG, "Step 4b: Comparing pages against STM32 flash");
+        if (request_page_map(firmware_data, file_size, page_map, sizeof(page_map)) != ESP_OK)
+        {
+            *message = "STM32 did not answer the page CRCs";
+            return ESP_ERR_TIMEOUT;
+        }
+    }
+
+    // Step 4c: Delta mode - send the patch instead of the image when the STM32 has the old one
+    const uint8_t *send_data = firmware_data;
+    size_t send_size = file_size;
+    if (mode == OTA_TRANSFER_MODE_DELTA && encoded != NULL)
+    {
+        ESP_LOGI(TAG, "Step 4c: Offering the delta update");
+        esp_err_t delta_result = start_delta(base, base_size, encoded_size);
+        if (delta_result == ESP_OK)
+        {
+            send_data = encoded;
+            send_size = encoded_size;
+        }
+        else if (delta_result != ESP_ERR_NOT_SUPPORTED)
+        {
+            *message = "STM32 did not answer the delta request";
+            return delta_result;
+        }
+    }
+
+    // Step 4d: Compressed mode - the STM32 decompresses into its page buffers
+    if (mode == OTA_TRANSFER_MODE_LZ && encoded != NULL)
+    {
+        ESP_LOGI(TAG, "Step 4d: Announcing the compressed image");
+        esp_err_t lz_result = start_lz(encoded_size);
+        if (lz_result != ESP_OK)
+        {
+            *message = "STM32 did not accept the compressed image";
+            return lz_result;
+        }
+        send_data = encoded;
+        send_size = encoded_size;
+    }
+
+    // Step 5: Send firmware data
+    ESP_LOGI(TAG, "Step 5: Starting firmware data transmission");
+    stats->link_baud = link_baud;
+    stats->bytes_sent = send_size;
+    if (mode == OTA_TRANSFER_MODE_LEGACY)
+    {
+        err = send_firmware(send_data, send_size, DATA_CHUNK_SIZE, 1, NULL, &stats->packets_sent);
+    }
+    else if (page_mode)
+    {
+        err = send_pages(send_data, send_size, window, page_map, sizeof(page_map), &stats->packets_sent);
+    }
+    else
+    {
+        err = send_firmware(send_data, send_size, WINDOW_PACKET_SIZE, window,
+                            mode == OTA_TRANSFER_MODE_SKIP ? page_map : NULL, &stats->packets_sent);
+    }
+    if (err != ESP_OK)
+    {
+        *message = "STM32 did not acknowledge firmware data";
+        return err;
+    }
+    stats->data_us = port->time_us() - transfer_start;
+    stats->link_baud = link_baud; // after a downshift, the rate the transfer ended at
+    uint32_t bytes_per_sec = stats->data_us > 0 ? (uint32_t)((int64_t)file_size * 1000000 / stats->data_us) : 0;
+
+    ESP_LOGI(TAG, "Firmware data transmission completed: %zu bytes in %lld ms, %lu B/s (%s, %zu packets, %zu bytes sent)",
+             file_size, (long long)(stats->data_us / 1000), (unsigned long)bytes_per_sec, ota_transfer_mode_names[mode],
+             stats->packets_sent, send_size);
+
+    return verify_transfer(firmware_checksum, message);
+}
+
+esp_err_t ota_transfer_run(ota_transfer_mode_e mode, const uint8_t *image, size_t size, const uint8_t *base,
+                           size_t base_size, ota_transfer_stats_t *transfer_stats, const char **message)
+{
+    memset(transfer_stats, 0, sizeof(*transfer_stats));
+    stats = transfer_stats;
+    *message = NULL;
+
+    int64_t start = port->time_us();
+    size_t encoded_size = 0;
+    const uint8_t *encoded = NULL;
+    if (mode == OTA_TRANSFER_MODE_DELTA || mode == OTA_TRANSFER_MODE_LZ)
+    {
+        ESP_LOGI(TAG, "Step 0: Encoding the image for %s mode", ota_transfer_mode_names[mode]);
+        encoded = encode_payload(mode, image, size, base, base_size, &encoded_size);
+    }
+    esp_err_t err = run_transfer(mode, image, size, base, base_size, encoded, encoded_size, message);
+    if (encoded != NULL)
+    {
+        scratch->release(scratch->context);
+    }
+    stats->total_us = port->time_us() - start;
+    stats = NULL;
+    return err;
+}
+
+// CRC of the image read back from the source, the STM32 computes the same over its flash
+static esp_err_t source_crc32(const ota_transfer_source_t *source, size_t size, uint32_t *crc)
+{
+    *crc = OTA_FRAME_CRC32_INIT;
+    for (size_t offset = 0; offset < size; offset += sizeof(packet_buffer))
+    {
+        size_t length = MIN(sizeof(packet_buffer), size - offset);
+        esp_err_t err = source->read(offset, packet_buffer, length, source->context);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        *crc = ota_frame_crc32(packet_buffer, length, *crc);
+    }
+    return ESP_OK;
+}
+
+// The image goes as it arrives; the CRC is known only at the end, so there is no
+// resume query or page map, and no encoding
+static esp_err_t run_source_transfer(ota_transfer_mode_e mode, size_t file_size, const ota_transfer_source_t *source,
+                                     const char **message)
+{
+    bool legacy = mode == OTA_TRANSFER_MODE_LEGACY;
+    size_t packet_size = legacy ? DATA_CHUNK_SIZE : WINDOW_PACKET_SIZE;
+
+    // Once past FW_OK the STM32 wants a data frame within its NAK timeout
+    ESP_LOGI(TAG, "Step 0: Waiting for the start of the image");
+    esp_err_t err;
+    while ((err = source->wait(MIN(packet_size, file_size), SOURCE_WAIT_MS, source->context)) == ESP_ERR_TIMEOUT)
+    {
+    }
+    if (err != ESP_OK)
+    {
+        *message = "Image stopped arriving";
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // The STM32 erases each page as it writes it, there is no erase up front to wait for
+    size_t window = 1;
+    err = start_transfer(mode, file_size, &window, message);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    ESP_LOGI(TAG, "Step 5: Sending firmware data as it arrives");
+    int64_t transfer_start = port->time_us();
+    size_t packet_count = (file_size + packet_size - 1) / packet_size;
+    stats->link_baud = link_baud;
+    stats->bytes_sent = file_size;
+    stats->packets_sent = packet_count;
+    err = send_packets(source, file_size, packet_size, legacy ? 1 : window, NULL, packet_count);
+    if (err == ESP_ERR_INVALID_SIZE)
+    {
+        *message = "Image stopped arriving";
+        return err;
+    }
+    if (err != ESP_OK)
+    {
+        *message = "STM32 did not acknowledge firmware data";
+        return err;
+    }
+    stats->data_us = port->time_us() - transfer_start;
+    stats->link_baud = link_baud;
+    ESP_LOGI(TAG, "Firmware data transmission completed: %zu bytes in %lld ms, %lld ms of it waiting for the image (%s, %zu packets)",
+             file_size, (long long)(stats->data_us / 1000), (long long)(stats->source_wait_us / 1000),
+             ota_transfer_mode_names[mode], packet_count);
+
+    uint32_t firmware_checksum;
+    if (source_crc32(source, file_size, &firmware_checksum) != ESP_OK)
+    {
+        *message = "Image could not be read back for its checksum";
+        return ESP_FAIL;
+    }
+    return verify_transfer(firmware_checksum, message);
+}
+
+esp_err_t ota_transfer_run_source(ota_transfer_mode_e mode, size_t size, const ota_transfer_source_t *source,
+                                  ota_transfer_stats_t *transfer_stats, const char **message)
+{
+    memset(transfer_stats, 0, sizeof(*transfer_stats));
+    *message = NULL;
+    if (mode != OTA_TRANSFER_MODE_WINDOW && mode != OTA_TRANSFER_MODE_LEGACY)
+    {
+        *message = "Transfer mode needs the whole image before it starts";
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    stats = transfer_stats;
+    arriving = source;
+
+    int64_t start = port->time_us();
+    esp_err_t err = run_source_transfer(mode, size, source, message);
+    stats->total_us = port->time_us() - start;
+    stats = NULL;
+    arriving = NULL;
+    return err;
+}
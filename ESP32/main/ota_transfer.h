@@ -0,0 +1,142 @@
+/**
+ * Firmware transfer to the STM32 bootloader (matching bootloader main.c)
+ *
+ * Handshake, link speed negotiation, the transfer modes, and the CRC-32 check
+ * at the end, over ota_frame frames. The UART is reached through an
+ * ota_transfer_port_t, so the same code runs in the HTTP server and in the
+ * host benchmark (ESP32/host).
+ */
+#ifndef OTA_TRANSFER_H
+#define OTA_TRANSFER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define OTA_TRANSFER_LINK_BAUD_DEFAULT 115200
+#define OTA_TRANSFER_RTT_BUCKETS 96 // four per power of two of microseconds, up to 16 s
+
+typedef enum
+{
+    OTA_TRANSFER_MODE_WINDOW = 0,
+    OTA_TRANSFER_MODE_LEGACY,
+    OTA_TRANSFER_MODE_SKIP,
+    OTA_TRANSFER_MODE_DELTA,
+    OTA_TRANSFER_MODE_LZ,
+    OTA_TRANSFER_MODE_COUNT,
+} ota_transfer_mode_e;
+
+extern const char *const ota_transfer_mode_names[OTA_TRANSFER_MODE_COUNT];
+
+/**
+ * UART to the STM32, 8N1 without flow control
+ */
+typedef struct ota_transfer_port
+{
+    // @return bytes queued for sending
+    int (*write)(const uint8_t *data, size_t length);
+    // @return bytes read, 0 when nothing came within timeout_ms
+    int (*read)(uint8_t *data, size_t length, uint32_t timeout_ms);
+    void (*flush_input)(void);
+    // switch once the bytes written so far are out
+    void (*set_baud)(uint32_t baud);
+    void (*delay_ms)(uint32_t ms);
+    int64_t (*time_us)(void);
+} ota_transfer_port_t;
+
+/**
+ * Where the patch (delta mode) or compressed image (lz mode) is kept from encoding to
+ * the end of the transfer. Without one it is a malloc'd buffer of up to the image size
+ */
+typedef struct ota_transfer_scratch
+{
+    // start a payload of at most max_size bytes
+    esp_err_t (*begin)(size_t max_size, void *context);
+    // append to it
+    esp_err_t (*write)(const uint8_t *data, size_t length, void *context);
+    // @return the payload written, readable until release; NULL when it cannot be read back
+    const uint8_t *(*finish)(void *context);
+    // after finish, or instead of it when encoding failed
+    void (*release)(void *context);
+    void *context;
+} ota_transfer_scratch_t;
+
+/**
+ * An image flashed while it is still arriving, for ota_transfer_run_source. It comes
+ * in order from offset 0; what has come must stay readable, packets are sent again
+ */
+typedef struct ota_transfer_source
+{
+    // wait up to timeout_ms for the first `length` bytes of the image; also called with
+    // 0 and 0 while the STM32 is busy, to take in what arrived meanwhile
+    // @return ESP_OK once they are in, ESP_ERR_TIMEOUT while they are not, anything
+    //         else when they never will be
+    esp_err_t (*wait)(size_t length, uint32_t timeout_ms, void *context);
+    // bytes that are in
+    esp_err_t (*read)(size_t offset, uint8_t *data, size_t length, void *context);
+    void *context;
+} ota_transfer_source_t;
+
+typedef struct ota_transfer_stats
+{
+    int64_t total_us;         // FW_REQUEST to the checksum answer
+    int64_t data_us;          // resume query to the last data frame acknowledged
+    uint32_t link_baud;       // rate the data went at
+    size_t bytes_sent;        // data frame payload, patch or compressed image in those modes
+    size_t packets_sent;      // data packets, each counted once
+    size_t frames_sent;       // data frames, resends included
+    uint32_t ready_retries;   // FW_REQUEST sent again
+    uint32_t naks;            // FW_NAK that sent the window back, or a page again
+    uint32_t ack_timeouts;    // window or page pass that saw nothing for an ACK timeout
+    uint32_t downshifts;      // link rate given up for errors
+    uint32_t passes;          // page mode passes
+    uint32_t flash_stall_permille; // of the transfer, as reported by CHECKSUM_OK
+    int64_t source_wait_us;   // link idle for an image still arriving
+    uint32_t ack_count;       // round trips sampled: frame sent to its FW_ACK
+    int64_t ack_min_us;
+    int64_t ack_max_us;
+    int64_t ack_sum_us;
+    uint32_t ack_histogram[OTA_TRANSFER_RTT_BUCKETS];
+} ota_transfer_stats_t;
+
+/**
+ * Set the UART used from now on; the port stays owned by the caller
+ * @param scratch storage for encoded payloads, NULL for the heap
+ */
+void ota_transfer_init(const ota_transfer_port_t *port, const ota_transfer_scratch_t *scratch);
+
+/**
+ * Flash an image into the STM32 application area and have it verified
+ * @param base delta mode: the image last flashed, NULL if unknown (the image then goes whole)
+ * @param stats filled in as far as the transfer got
+ * @param message set to a one line reason on failure
+ * @return ESP_OK once the STM32 reported a matching CRC, ESP_ERR_INVALID_CRC when it
+ *         did not, ESP_ERR_TIMEOUT / ESP_FAIL / ESP_ERR_NO_MEM when the transfer broke off
+ */
+esp_err_t ota_transfer_run(ota_transfer_mode_e mode, const uint8_t *image, size_t size, const uint8_t *base,
+                           size_t base_size, ota_transfer_stats_t *stats, const char **message);
+
+/**
+ * Flash an image while it arrives: the handshake starts with the first packet, data
+ * frames follow the image as it comes in (the STM32 erases each page as it writes
+ * it), and while they wait for it the STM32 is kept from timing out. Window and
+ * legacy mode, the others need the whole image up front
+ * @param size of the whole image
+ * @return as ota_transfer_run, ESP_ERR_INVALID_SIZE when the image stopped arriving,
+ *         ESP_ERR_NOT_SUPPORTED for another mode
+ */
+esp_err_t ota_transfer_run_source(ota_transfer_mode_e mode, size_t size, const ota_transfer_source_t *source,
+                                  ota_transfer_stats_t *stats, const char **message);
+
+/**
+ * Shortest round trip, in us, counted in a bucket of ota_transfer_stats_t.ack_histogram;
+ * the bucket ends where the next one starts
+ */
+int64_t ota_transfer_rtt_bucket_us(int bucket);
+
+/**
+ * CRC-32/MPEG-2 of an image, what the STM32 CRC unit computes over flash
+ */
+uint32_t ota_transfer_image_crc32(const uint8_t *data, size_t size);
+
+#endif
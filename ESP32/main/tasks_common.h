@@ -18,4 +18,9 @@
 #define HTTP_SERVER_MONITOR_STACK_SIZE 4096 
 #define HTTP_SERVER_MONITOR_PRIORITY 3
 #define HTTP_SERVER_MONITOR_CORE_ID 0
+
+//flash job task: transfers to the STM32, away from Wi-Fi and the http server
+#define FLASH_JOB_TASK_STACK_SIZE 6144
+#define FLASH_JOB_TASK_PRIORITY 5
+#define FLASH_JOB_TASK_CORE_ID 1
 #endif // MAIN_TASKS_COMMON_H
\ No newline at end of file
@@ -1,5 +1,6 @@
 document.addEventListener('DOMContentLoaded', function () {
     const uploadBtn = document.getElementById('uploadBtn');
+    const flashBtn = document.getElementById('flashBtn');
     const downloadBtn = document.getElementById('downloadBtn');
     const firmwareFile = document.getElementById('firmwareFile');
     const uploadProgressBar = document.getElementById('uploadProgressBar');
@@ -8,6 +9,8 @@ document.addEventListener('DOMContentLoaded', function () {
     const downloadProgressBar = document.getElementById('downloadProgressBar');
     const downloadProgressContainer = document.getElementById('downloadProgressContainer');
     const downloadStatus = document.getElementById('downloadStatus');
+    const transferMode = document.getElementById('transferMode');
+    const JOB_POLL_MS = 500;
 
     // Upload firmware file
     uploadBtn.addEventListener('click', async function () {
@@ -58,6 +61,61 @@ document.addEventListener('DOMContentLoaded', function () {
         }
     });
 
+    // Upload a .bin file and flash it to the device as it arrives
+    flashBtn.addEventListener('click', function () {
+        if (!firmwareFile.files.length) {
+            showStatus(uploadStatus, 'Please select a file first.', 'error');
+            return;
+        }
+
+        const file = firmwareFile.files[0];
+        if (!file.name.toLowerCase().endsWith('.bin')) {
+            showStatus(uploadStatus, 'Upload & Flash takes a .bin file, upload a .hex file first and then download it.', 'error');
+            return;
+        }
+        const mode = transferMode.value === 'legacy' ? 'legacy' : 'window';
+
+        uploadBtn.disabled = true;
+        flashBtn.disabled = true;
+        uploadProgressContainer.style.display = 'block';
+        uploadStatus.style.display = 'none';
+
+        // The file is the request body, its size is the image size
+        const xhr = new XMLHttpRequest();
+        xhr.open('POST', '/flash?mode=' + mode, true);
+        xhr.setRequestHeader('Content-Type', 'application/octet-stream');
+
+        xhr.upload.onprogress = function (e) {
+            if (e.lengthComputable) {
+                const percent = Math.round((e.loaded / e.total) * 100);
+                uploadProgressBar.style.width = percent + '%';
+                uploadProgressBar.textContent = percent + '%';
+            }
+        };
+
+        // Answered once the file is in, the job may still be flashing it then
+        xhr.onload = function () {
+            const done = function () {
+                uploadBtn.disabled = false;
+                flashBtn.disabled = false;
+            };
+            if (xhr.status === 202) {
+                followJob(JSON.parse(xhr.responseText).id, uploadStatus, done);
+            } else {
+                showStatus(uploadStatus, 'Flash failed: ' + xhr.responseText, 'error');
+                done();
+            }
+        };
+
+        xhr.onerror = function () {
+            showStatus(uploadStatus, 'Flash failed. Please try again.', 'error');
+            uploadBtn.disabled = false;
+            flashBtn.disabled = false;
+        };
+
+        xhr.send(file);
+    });
+
     // Download firmware to device
     downloadBtn.addEventListener('click', async function () {
         try {
@@ -65,40 +123,60 @@ document.addEventListener('DOMContentLoaded', function () {
             downloadProgressContainer.style.display = 'block';
             downloadStatus.style.display = 'none';
 
-            // Simulate progress for demo (replace with actual progress events)
-            let progress = 0;
-            const interval = setInterval(() => {
-                progress += 5;
-                if (progress > 100) progress = 100;
-                downloadProgressBar.style.width = progress + '%';
-                downloadProgressBar.textContent = progress + '%';
-
-                if (progress === 100) {
-                    clearInterval(interval);
-                    showStatus(downloadStatus, 'Firmware downloaded to device successfully!', 'success');
-                    downloadBtn.disabled = false;
-                }
-            }, 200);
+            downloadProgressBar.style.width = '100%';
+            downloadProgressBar.textContent = 'queued';
 
-            // In a real implementation, you would use fetch or WebSocket for progress updates
-            
-            const response = await fetch('/download', {
+            // The device queues a flashing job and answers with its ID right away
+            const response = await fetch('/download?mode=' + transferMode.value, {
                 method: 'POST'
             });
-            
-            if (response.ok) {
-                showStatus(downloadStatus, 'Firmware downloaded to device successfully!', 'success');
+
+            if (response.status === 202) {
+                const job = await response.json();
+                followJob(job.id, downloadStatus, function () {
+                    downloadBtn.disabled = false;
+                }, downloadProgressBar);
             } else {
                 showStatus(downloadStatus, 'Download failed: ' + (await response.text()), 'error');
+                downloadBtn.disabled = false;
             }
-            downloadBtn.disabled = false;
-            
         } catch (error) {
             showStatus(downloadStatus, 'Error: ' + error.message, 'error');
             downloadBtn.disabled = false;
         }
     });
 
+    // Poll a flashing job until it is over, then show how it went
+    function followJob(id, statusElement, done, progressBar) {
+        const poll = async function () {
+            try {
+                const response = await fetch('/job?id=' + id);
+                if (!response.ok) {
+                    throw new Error(await response.text());
+                }
+                const job = await response.json();
+                if (progressBar) {
+                    progressBar.textContent = job.state;
+                }
+                if (job.state === 'done') {
+                    showStatus(statusElement, 'Firmware flashed to STM32, checksum verified (' + job.mode + ' mode, ' +
+                        job.baud + ' baud, ' + job.size + ' bytes, ' + job.bytes_per_sec + ' B/s, ' +
+                        job.total_ms + ' ms)', 'success');
+                    done();
+                } else if (job.state === 'failed') {
+                    showStatus(statusElement, 'Flash failed: ' + job.message, 'error');
+                    done();
+                } else {
+                    setTimeout(poll, JOB_POLL_MS);
+                }
+            } catch (error) {
+                showStatus(statusElement, 'Lost track of flashing job ' + id + ': ' + error.message, 'error');
+                done();
+            }
+        };
+        poll();
+    }
+
     function showStatus(element, message, type) {
         element.textContent = message;
         element.className = 'status ' + type;
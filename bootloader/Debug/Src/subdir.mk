@@ -5,17 +5,35 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
+../Src/flash_benchmark.c \
 ../Src/main.c \
+../Src/ota_delta.c \
+../Src/ota_frame.c \
+../Src/ota_journal.c \
+../Src/ota_lz.c \
+../Src/ota_pages.c \
 ../Src/syscalls.c \
 ../Src/sysmem.c 
 
 OBJS += \
+./Src/flash_benchmark.o \
 ./Src/main.o \
+./Src/ota_delta.o \
+./Src/ota_frame.o \
+./Src/ota_journal.o \
+./Src/ota_lz.o \
+./Src/ota_pages.o \
 ./Src/syscalls.o \
 ./Src/sysmem.o 
 
 C_DEPS += \
+./Src/flash_benchmark.d \
 ./Src/main.d \
+./Src/ota_delta.d \
+./Src/ota_frame.d \
+./Src/ota_journal.d \
+./Src/ota_lz.d \
+./Src/ota_pages.d \
 ./Src/syscalls.d \
 ./Src/sysmem.d 
 
@@ -27,7 +45,7 @@ Src/%.o Src/%.su Src/%.cyclo: ../Src/%.c Src/subdir.mk
 clean: clean-Src
 
 clean-Src:
-	-$(RM) ./Src/main.cyclo ./Src/main.d ./Src/main.o ./Src/main.su ./Src/syscalls.cyclo ./Src/syscalls.d ./Src/syscalls.o ./Src/syscalls.su ./Src/sysmem.cyclo ./Src/sysmem.d ./Src/sysmem.o ./Src/sysmem.su
+	-$(RM) ./Src/flash_benchmark.cyclo ./Src/flash_benchmark.d ./Src/flash_benchmark.o ./Src/flash_benchmark.su ./Src/main.cyclo ./Src/main.d ./Src/main.o ./Src/main.su ./Src/ota_delta.cyclo ./Src/ota_delta.d ./Src/ota_delta.o ./Src/ota_delta.su ./Src/ota_frame.cyclo ./Src/ota_frame.d ./Src/ota_frame.o ./Src/ota_frame.su ./Src/ota_journal.cyclo ./Src/ota_journal.d ./Src/ota_journal.o ./Src/ota_journal.su ./Src/ota_lz.cyclo ./Src/ota_lz.d ./Src/ota_lz.o ./Src/ota_lz.su ./Src/ota_pages.cyclo ./Src/ota_pages.d ./Src/ota_pages.o ./Src/ota_pages.su ./Src/syscalls.cyclo ./Src/syscalls.d ./Src/syscalls.o ./Src/syscalls.su ./Src/sysmem.cyclo ./Src/sysmem.d ./Src/sysmem.o ./Src/sysmem.su
 
 .PHONY: clean-Src
 
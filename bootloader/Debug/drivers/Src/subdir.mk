@@ -7,22 +7,31 @@
 C_SRCS += \
 ../drivers/Src/stm32f103xx_bootloader.c \
 ../drivers/Src/stm32f103xx_core_driver.c \
+../drivers/Src/stm32f103xx_crc_driver.c \
+../drivers/Src/stm32f103xx_dma_driver.c \
 ../drivers/Src/stm32f103xx_flash_driver.c \
 ../drivers/Src/stm32f103xx_gpio_drivers.c \
+../drivers/Src/stm32f103xx_rcc_driver.c \
 ../drivers/Src/stm32f103xx_usart_driver.c 
 
 OBJS += \
 ./drivers/Src/stm32f103xx_bootloader.o \
 ./drivers/Src/stm32f103xx_core_driver.o \
+./drivers/Src/stm32f103xx_crc_driver.o \
+./drivers/Src/stm32f103xx_dma_driver.o \
 ./drivers/Src/stm32f103xx_flash_driver.o \
 ./drivers/Src/stm32f103xx_gpio_drivers.o \
+./drivers/Src/stm32f103xx_rcc_driver.o \
 ./drivers/Src/stm32f103xx_usart_driver.o 
 
 C_DEPS += \
 ./drivers/Src/stm32f103xx_bootloader.d \
 ./drivers/Src/stm32f103xx_core_driver.d \
+./drivers/Src/stm32f103xx_crc_driver.d \
+./drivers/Src/stm32f103xx_dma_driver.d \
 ./drivers/Src/stm32f103xx_flash_driver.d \
 ./drivers/Src/stm32f103xx_gpio_drivers.d \
+./drivers/Src/stm32f103xx_rcc_driver.d \
 ./drivers/Src/stm32f103xx_usart_driver.d 
 
 
@@ -33,7 +42,7 @@ drivers/Src/%.o drivers/Src/%.su drivers/Src/%.cyclo: ../drivers/Src/%.c drivers
 clean: clean-drivers-2f-Src
 
 clean-drivers-2f-Src:
-	-$(RM) ./drivers/Src/stm32f103xx_bootloader.cyclo ./drivers/Src/stm32f103xx_bootloader.d ./drivers/Src/stm32f103xx_bootloader.o ./drivers/Src/stm32f103xx_bootloader.su ./drivers/Src/stm32f103xx_core_driver.cyclo ./drivers/Src/stm32f103xx_core_driver.d ./drivers/Src/stm32f103xx_core_driver.o ./drivers/Src/stm32f103xx_core_driver.su ./drivers/Src/stm32f103xx_flash_driver.cyclo ./drivers/Src/stm32f103xx_flash_driver.d ./drivers/Src/stm32f103xx_flash_driver.o ./drivers/Src/stm32f103xx_flash_driver.su ./drivers/Src/stm32f103xx_gpio_drivers.cyclo ./drivers/Src/stm32f103xx_gpio_drivers.d ./drivers/Src/stm32f103xx_gpio_drivers.o ./drivers/Src/stm32f103xx_gpio_drivers.su ./drivers/Src/stm32f103xx_usart_driver.cyclo ./drivers/Src/stm32f103xx_usart_driver.d ./drivers/Src/stm32f103xx_usart_driver.o ./drivers/Src/stm32f103xx_usart_driver.su
+	-$(RM) ./drivers/Src/stm32f103xx_bootloader.cyclo ./drivers/Src/stm32f103xx_bootloader.d ./drivers/Src/stm32f103xx_bootloader.o ./drivers/Src/stm32f103xx_bootloader.su ./drivers/Src/stm32f103xx_core_driver.cyclo ./drivers/Src/stm32f103xx_core_driver.d ./drivers/Src/stm32f103xx_core_driver.o ./drivers/Src/stm32f103xx_core_driver.su ./drivers/Src/stm32f103xx_crc_driver.cyclo ./drivers/Src/stm32f103xx_crc_driver.d ./drivers/Src/stm32f103xx_crc_driver.o ./drivers/Src/stm32f103xx_crc_driver.su ./drivers/Src/stm32f103xx_dma_driver.cyclo ./drivers/Src/stm32f103xx_dma_driver.d ./drivers/Src/stm32f103xx_dma_driver.o ./drivers/Src/stm32f103xx_dma_driver.su ./drivers/Src/stm32f103xx_flash_driver.cyclo ./drivers/Src/stm32f103xx_flash_driver.d ./drivers/Src/stm32f103xx_flash_driver.o ./drivers/Src/stm32f103xx_flash_driver.su ./drivers/Src/stm32f103xx_gpio_drivers.cyclo ./drivers/Src/stm32f103xx_gpio_drivers.d ./drivers/Src/stm32f103xx_gpio_drivers.o ./drivers/Src/stm32f103xx_gpio_drivers.su ./drivers/Src/stm32f103xx_rcc_driver.cyclo ./drivers/Src/stm32f103xx_rcc_driver.d ./drivers/Src/stm32f103xx_rcc_driver.o ./drivers/Src/stm32f103xx_rcc_driver.su ./drivers/Src/stm32f103xx_usart_driver.cyclo ./drivers/Src/stm32f103xx_usart_driver.d ./drivers/Src/stm32f103xx_usart_driver.o ./drivers/Src/stm32f103xx_usart_driver.su
 
 .PHONY: clean-drivers-2f-Src
 
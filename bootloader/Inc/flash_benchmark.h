@@ -0,0 +1,34 @@
+/*
+ * flash_benchmark.h
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: nphuc
+ */
+
+#ifndef INC_FLASH_BENCHMARK_H_
+#define INC_FLASH_BENCHMARK_H_
+
+#include "stm32f103xx.h"
+
+/*
+ * Programs 1 KB into the spare last flash page with the per-word FLASH_WriteData
+ * and with FLASH_ProgramRange and records both in core clocks per KB, erase not
+ * included. Built in with -DFLASH_BENCHMARK, results are read with the debugger.
+ * The page holds the transfer journal, a benchmark build forgets a cut-off transfer.
+ */
+#define FLASH_BENCHMARK_PAGE					0x0801FC00U		/* after the 111 KB application */
+#define FLASH_BENCHMARK_ROUNDS					4
+
+typedef struct
+{
+	uint32_t word_cycles_per_kb;		/* FLASH_WriteData */
+	uint32_t range_cycles_per_kb;		/* FLASH_ProgramRange */
+	uint32_t hclk;
+	uint8_t status;						/* FLASH_OK when every round verified */
+} FlashBenchmark_Result_t;
+
+extern volatile FlashBenchmark_Result_t flash_benchmark;
+
+void FlashBenchmark_Run(void);
+
+#endif /* INC_FLASH_BENCHMARK_H_ */
@@ -0,0 +1,43 @@
+/*
+ * ota_delta.h
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: nphuc
+ */
+
+#ifndef INC_OTA_DELTA_H_
+#define INC_OTA_DELTA_H_
+
+#include "stm32f103xx.h"
+#include "ota_pages.h"
+
+/*
+ * Delta patch (matching ESP32 ota_delta.c): the new image is rebuilt from the
+ * application already in flash and literal bytes, as a stream of operations,
+ * all fields big-endian:
+ *   DELTA_OP_LITERAL (1) | length (2) | bytes (length)
+ *   DELTA_OP_COPY (1)    | length (2) | source offset (4)
+ * The image is rebuilt in place, an old page is gone once its new content is
+ * programmed. The old content of a page is kept in RAM when the output reaches
+ * it, so copies may read the last DELTA_HISTORY_PAGES pages from RAM and
+ * everything from the current output page on from flash.
+ */
+#define DELTA_OP_LITERAL						0
+#define DELTA_OP_COPY							1
+#define DELTA_HISTORY_PAGES						2
+
+#define DELTA_OK								1
+#define DELTA_ERROR								0
+
+/* takes at most one page at a time, PAGES_OK when stored */
+typedef uint8_t (*Delta_Output_t)(const uint8_t *pData, uint32_t length);
+
+void Delta_Init(uint32_t source, uint32_t source_size, uint32_t target_size, Delta_Output_t output);
+
+/* operations may be split anywhere between calls */
+uint8_t Delta_Feed(const uint8_t *pData, uint32_t length);
+
+/* DELTA_OK once the whole target is produced and no operation is left open */
+uint8_t Delta_Done(void);
+
+#endif /* INC_OTA_DELTA_H_ */
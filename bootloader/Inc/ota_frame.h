@@ -0,0 +1,67 @@
+/*
+ * ota_frame.h
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: nphuc
+ */
+
+#ifndef INC_OTA_FRAME_H_
+#define INC_OTA_FRAME_H_
+
+#include "stm32f103xx.h"
+
+/*
+ * Frame format (matching ESP32 ota_frame.c), all fields big-endian:
+ * type (1) | seq (2) | length (2) | payload (length) | CRC-16/CCITT (2)
+ * The whole frame is COBS encoded and terminated by FRAME_DELIMITER, so a
+ * receiver that lost bytes resynchronises on the next delimiter.
+ */
+#define FRAME_DELIMITER							0x00
+#define FRAME_HEADER_SIZE						5
+#define FRAME_CRC_SIZE							2
+#define FRAME_MAX_PAYLOAD						1024  /* one flash page*/
+#define FRAME_MAX_RAW							(FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD + FRAME_CRC_SIZE)
+#define FRAME_MAX_ENCODED						(FRAME_MAX_RAW + FRAME_MAX_RAW / 254 + 2)
+
+/* Receive slots filled by Frame_RxByte, a single-producer single-consumer queue */
+#define FRAME_RX_SLOTS							4
+
+#define FRAME_OK								1
+#define FRAME_ERROR								0
+#define FRAME_NONE								2
+
+typedef struct
+{
+	uint8_t type;
+	uint16_t seq;
+	uint16_t length;
+	uint8_t *payload;
+} Frame_t;
+
+uint16_t Frame_CRC16(const uint8_t *pData, uint32_t length, uint16_t crc);
+
+uint32_t Frame_Encode(uint8_t type, uint16_t seq, const uint8_t *pPayload, uint16_t length, uint8_t *pOut);
+
+uint8_t Frame_Decode(const uint8_t *pIn, uint32_t length, uint8_t *pOut, Frame_t *pFrame);
+
+/*
+ * Reception: Frame_RxByte/Frame_RxReady run in interrupt context (the producer),
+ * Frame_RxGet/Frame_RxRelease in main (the consumer); no locking is needed.
+ * Frame_RxGet decodes the oldest frame with its payload word aligned; the slot
+ * stays in use until Frame_RxRelease, for FRAME_ERROR as well
+ */
+void Frame_RxReset(void);
+
+void Frame_RxByte(uint8_t byte);
+
+/* 0 when every slot holds a frame: the producer has to stop at the frame boundary
+and keep the rest of its input, Frame_RxRelease then calls Frame_RxResumeCallback */
+uint8_t Frame_RxReady(void);
+
+uint8_t Frame_RxGet(Frame_t *pFrame);
+
+void Frame_RxRelease(void);
+
+__weak void Frame_RxResumeCallback(void);
+
+#endif /* INC_OTA_FRAME_H_ */
@@ -0,0 +1,53 @@
+/*
+ * ota_journal.h
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: nphuc
+ */
+
+#ifndef INC_OTA_JOURNAL_H_
+#define INC_OTA_JOURNAL_H_
+
+#include "stm32f103xx.h"
+
+/*
+ * Progress journal of an image transfer in the spare flash page after the
+ * application: a header naming the image (size and CRC-32) followed by
+ * half-word entries, each the number of image pages committed so far. Entries
+ * are only appended, so the page is erased once per image, and the last one
+ * written is the resume point. Every transfer writes its header before the
+ * first page is touched, so a journal that is still there at reset means a
+ * transfer was cut off and the application in flash is incomplete.
+ */
+#define JOURNAL_ADDRESS							0x0801FC00U
+#define JOURNAL_MAGIC							0x4C4E524AU		/* "JRNL" */
+#define JOURNAL_HEADER_SIZE						12
+
+/* read the journal from flash, at startup and whenever a transfer starts */
+void Journal_Open(void);
+
+/* a transfer was cut off */
+uint8_t Journal_Pending(void);
+
+/* Pages committed for this image, 0 for any other image, whose journal then
+replaces the old one. Journal_Commit only records pages after this */
+uint32_t Journal_Resume(uint32_t size, uint32_t crc);
+
+/* Before the first page of a transfer is touched, called with the flash
+controller idle. Without Journal_Resume the image has no name, the new journal
+keeps it from starting but is never resumed, and any old one is dropped: the
+pages it vouches for are being overwritten */
+void Journal_Begin(uint32_t size);
+
+/* committed pages of the image from the start of the application, called with
+the flash controller idle, only recorded after Journal_Resume or Journal_Begin */
+void Journal_Commit(uint32_t pages);
+
+/* The transfer failed: the journal stays, the application is still incomplete,
+but it is never resumed, the pages it vouches for may not be what it says */
+void Journal_Abandon(void);
+
+/* the image is complete and verified */
+void Journal_Clear(void);
+
+#endif /* INC_OTA_JOURNAL_H_ */
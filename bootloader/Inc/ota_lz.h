@@ -0,0 +1,39 @@
+/*
+ * ota_lz.h
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: nphuc
+ */
+
+#ifndef INC_OTA_LZ_H_
+#define INC_OTA_LZ_H_
+
+#include "stm32f103xx.h"
+#include "ota_pages.h"
+
+/*
+ * LZSS stream (matching ESP32 ota_lz.c). A flag byte describes the next eight
+ * items, LSB first: 1 = literal byte, 0 = match of two bytes, big-endian,
+ * offset - 1 in the upper 11 bits and length - LZ_MIN_MATCH in the lower 5.
+ * Matches copy from the last LZ_WINDOW_SIZE bytes of output, which are kept in
+ * RAM; the stream ends with the last byte of the image.
+ */
+#define LZ_WINDOW_SIZE							2048
+#define LZ_MIN_MATCH							3
+#define LZ_MAX_MATCH							(LZ_MIN_MATCH + 31)
+
+#define LZ_OK									1
+#define LZ_ERROR								0
+
+/* PAGES_OK when stored */
+typedef uint8_t (*Lz_Output_t)(const uint8_t *pData, uint32_t length);
+
+void Lz_Init(uint32_t target_size, Lz_Output_t output);
+
+/* items may be split anywhere between calls */
+uint8_t Lz_Feed(const uint8_t *pData, uint32_t length);
+
+/* LZ_OK once the whole target is produced and handed to the output */
+uint8_t Lz_Done(void);
+
+#endif /* INC_OTA_LZ_H_ */
@@ -0,0 +1,71 @@
+/*
+ * ota_pages.h
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: nphuc
+ */
+
+#ifndef INC_OTA_PAGES_H_
+#define INC_OTA_PAGES_H_
+
+#include "stm32f103xx.h"
+
+/*
+ * Ping-pong page buffers: received data fills one 1 KB buffer while the other
+ * is programmed half-word by half-word from Pages_Poll and read back to verify.
+ * Pages are programmed in order starting at the address given to Pages_Init,
+ * each one erased just before it is programmed, so only pages the image
+ * reaches are erased. A page whose flash content already matches the buffer
+ * is neither erased nor programmed.
+ *
+ * The page given to Pages_Hold (the vector table) is erased before any other
+ * page is touched and kept in RAM instead, Pages_Release programs it once the
+ * image is verified. Until then the application fails Bootloader_CheckApp, so
+ * a transfer cut off halfway never leaves an image that looks valid.
+ */
+#define PAGE_SIZE								1024
+#define PAGE_BUFFERS							2
+
+#define PAGES_OK								1
+#define PAGES_ERROR								0
+#define PAGES_BUSY								2
+
+void Pages_Init(uint32_t address);
+
+/* hold back the page at this address until Pages_Release, after Pages_Init */
+void Pages_Hold(uint32_t address);
+
+/* program the held page, with everything else programmed and verified. PAGES_OK
+also when nothing was touched, the page is as it was then */
+uint8_t Pages_Release(void);
+
+/* PAGES_BUSY: both buffers are in use, nothing was taken, poll and try again */
+uint8_t Pages_Write(const uint8_t *pData, uint32_t length);
+
+/* hand over the partly filled last page */
+void Pages_Flush(void);
+
+/* PAGES_OK once everything handed over is programmed and verified */
+uint8_t Pages_Poll(void);
+
+/* continue at another page, only on a page boundary */
+void Pages_Seek(uint32_t address);
+
+/* everything handed over below this address is programmed and verified */
+uint32_t Pages_Programmed(void);
+
+/* called from Pages_Poll with the flash controller idle and locked: everything
+handed over below `end` is programmed and verified */
+__weak void Pages_CommittedCallback(uint32_t end);
+
+/* image content at this address: the held page from RAM, the rest from flash */
+const uint8_t *Pages_Source(uint32_t address);
+
+/* CRC-32/MPEG-2 of image content with the CRC unit, which it resets */
+uint32_t Pages_CRC32(uint32_t address, uint32_t length);
+
+/* feed the CRC unit with image content without resetting it, whole words only,
+length / 4 of them; returns the unit's value */
+uint32_t Pages_AccumulateCRC(uint32_t address, uint32_t length);
+
+#endif /* INC_OTA_PAGES_H_ */
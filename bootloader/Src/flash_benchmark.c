@@ -0,0 +1,49 @@
+/*
+ * flash_benchmark.c
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: nphuc
+ */
+
+#include "flash_benchmark.h"
+#include <string.h>
+
+volatile FlashBenchmark_Result_t flash_benchmark;
+
+static uint32_t pattern[FLASH_PAGE_SIZE / 4];
+
+static uint8_t FlashBenchmark_Verify(void)
+{
+	uint8_t ok = memcmp((const void *)FLASH_BENCHMARK_PAGE, pattern, FLASH_PAGE_SIZE) == 0;
+	FLASH_RemovePartition(FLASH_BENCHMARK_PAGE, 1);
+	return ok;
+}
+
+void FlashBenchmark_Run(void)
+{
+	uint64_t word_cycles = 0;
+	uint64_t range_cycles = 0;
+	uint8_t ok = 1;
+
+	for(uint32_t i = 0; i < FLASH_PAGE_SIZE / 4; i++) {
+		pattern[i] = 0x9E3779B9U * (i + 1);
+	}
+
+	FLASH_RemovePartition(FLASH_BENCHMARK_PAGE, 1);
+	for(uint8_t round = 0; round < FLASH_BENCHMARK_ROUNDS; round++) {
+		uint32_t start = DWT_GetCycles();
+		ok &= FLASH_WriteData(FLASH_BENCHMARK_PAGE, pattern, FLASH_PAGE_SIZE / 4) == FLASH_OK;
+		word_cycles += DWT_GetCycles() - start;
+		ok &= FlashBenchmark_Verify();
+
+		start = DWT_GetCycles();
+		ok &= FLASH_ProgramRange(FLASH_BENCHMARK_PAGE, (const uint8_t *)pattern, FLASH_PAGE_SIZE) == FLASH_OK;
+		range_cycles += DWT_GetCycles() - start;
+		ok &= FlashBenchmark_Verify();
+	}
+
+	flash_benchmark.word_cycles_per_kb = (uint32_t)(word_cycles / FLASH_BENCHMARK_ROUNDS);
+	flash_benchmark.range_cycles_per_kb = (uint32_t)(range_cycles / FLASH_BENCHMARK_ROUNDS);
+	flash_benchmark.hclk = RCC_GetHCLK();
+	flash_benchmark.status = ok ? FLASH_OK : FLASH_ERROR;
+}
@@ -17,7 +17,14 @@
  */
 
 #include "stm32f103xx.h"
-#include <string.h>
+#include "ota_frame.h"
+#include "ota_pages.h"
+#include "ota_delta.h"
+#include "ota_lz.h"
+#include "ota_journal.h"
+#ifdef FLASH_BENCHMARK
+#include "flash_benchmark.h"
+#endif
 
 /* define Address Sources
 STM32F103C8T6 has 128KB flash:
@@ -32,21 +39,58 @@ Application: 0x08004000 - 0x0801FFFF (112KB)
 #define APP_SIZE								111
 #define APP_MAX_SIZE							(APP_SIZE * 1024)  /* 111KB in bytes*/
 
-/* Protocol Commands for ESP32-STM32 Communication (matching ESP32)*/
+/* Frame types from ESP32 (matching ESP32)*/
 #define FW_REQUEST								28
-#define FW_LENGTH								2
-#define CHECKSUM_DATA 							6
-
-/* Protocol Responses from STM32 (matching ESP32)*/
+#define FW_LENGTH								2     /* payload: 32-bit size*/
+#define CHECKSUM_DATA 							6     /* payload: CRC-32/MPEG-2 of the image*/
+#define FW_DATA									10    /* seq = packet number, payload = data*/
+#define PAGE_CRCS								13    /* payload: CRC-32 of each 1 KB page of the image*/
+#define DELTA_BASE								15    /* payload: 32-bit old image size, CRC-32, patch size*/
+#define LZ_START								19    /* payload: 32-bit compressed size*/
+#define RESUME_QUERY							21    /* payload: 32-bit image size, CRC-32*/
+#define PASS_END								23    /* page mode: all pages of a pass are sent*/
+#define BAUD_PROPOSE							40    /* payload: 32-bit baud rate to switch to*/
+
+/* Frame types from STM32 (matching ESP32)*/
 #define FW_READY 								31
 #define FW_ERR 									4
-#define FW_OK 									3
-#define FW_RECEIVED 							5
-#define CHECKSUM_OK 							7
+#define FW_OK 									3     /* payload: receive window in frames*/
+#define CHECKSUM_OK 							7     /* payload: flash stall and transfer time, 256 cycle units*/
 #define CHECKSUM_ERR 							8
-
-#define DATA_CHUNK_SIZE							8     /* 8 bytes per chunk (matching ESP32)*/
-#define UART_BUFFER_SIZE						8    /* Buffer for UART data*/
+#define FW_ACK									11    /* seq = last packet stored in a page buffer*/
+#define FW_NAK									12    /* seq = packet to resend from, unused in page mode*/
+#define PAGE_MAP								14    /* payload: bitmap of pages still to send, LSB first*/
+#define DELTA_ACCEPT							16    /* FW_DATA carries a patch against the application from now on*/
+#define DELTA_REJECT							17    /* flash does not hold the old image, send it whole*/
+#define FW_BUSY									18    /* still working on the last frame, keeps the ESP32 waiting*/
+#define LZ_ACCEPT								20    /* FW_DATA carries the compressed image from now on*/
+#define RESUME_POINT							22    /* payload: 32-bit image offset to continue from*/
+#define BAUD_ACCEPT								41    /* sent at the old rate, then both sides switch*/
+#define BAUD_REJECT								42
+
+/* Both directions: the STM32 echoes BAUD_TEST, answers BAUD_CONFIRM with BAUD_CONFIRM */
+#define BAUD_TEST								43    /* payload: test pattern*/
+#define BAUD_CONFIRM							44
+
+#define TX_BUFFER_SIZE							128   /* encoded response frames*/
+
+/* DMA receive ring. While a page is programmed (~25 ms) the ESP32 can still
+send the rest of its window, about 3 KB at 921600 baud */
+#define UART_RX_RING_SIZE						4096
+
+/* The ESP32 keeps at most FRAME_RX_SLOTS data frames unacknowledged, so every
+frame in flight has a free receive slot */
+#define DATA_RX_TIMEOUT							500   /* ms without a frame before NAK*/
+#define DATA_MAX_RETRIES						50    /* bad frames in a row before giving up*/
+#define DATA_BUSY_INTERVAL						250   /* ms between FW_BUSY while a patch frame is applied*/
+
+/* Link speed. Without a valid frame for a while the bootloader goes back to the
+default rate, which is where the ESP32 retries after a failed or degraded rate */
+#define LINK_BAUD_DEFAULT						USART_STD_BAUD_115200
+#define LINK_TRIAL_TIMEOUT						300   /* ms, rate not confirmed yet*/
+#define LINK_FALLBACK_TIMEOUT					2000  /* ms, confirmed rate*/
+#define LINK_MAX_BAUD_ERROR						20    /* per mille between asked and real rate*/
+#define BAUD_TEST_MAX							64    /* longest echoed pattern*/
 
 /* declare handler*/
 USART_Handle_t uart1;
@@ -58,46 +102,111 @@ typedef enum {
 	WAIT_REQUEST,    		/* Wait for FW_REQUEST from ESP32*/
 	SEND_READY,          	/* Send FW_READY to ESP32*/
 	WAIT_LENGTH,     		/* Wait for FW_LENGTH from ESP32*/
-	RECEIVE_DATA,        	/* Receive firmware data from ESP32*/
-	VERIFY_CHECKSUM,     	/* Verify firmware checksum*/
+	RECEIVE_DATA,        	/* Receive firmware data frames from ESP32*/
+	VERIFY_CHECKSUM,     	/* Verify firmware CRC*/
 	JUMP_TO_APP          	/* Jump to application*/
 } bootloader_state_t;
 
 /* Global variables*/
 bootloader_state_t bl_state = CHECK_FLAG;
-uint8_t uart_rx_buffer[UART_BUFFER_SIZE];
-uint8_t uart_tx_buffer[UART_BUFFER_SIZE];
-uint8_t data_received = 0;
+uint8_t uart_rx_ring[UART_RX_RING_SIZE];
+__vo uint8_t frame_rx_event = 0;	/* set by the receive interrupt after adding frames */
+uint8_t uart_tx_buffer[TX_BUFFER_SIZE];
+Frame_t frame;
 uint32_t firmware_size = 0;
 uint32_t bytes_received = 0;
-uint32_t flash_write_address = APP_CURRENT;
-uint32_t calculated_checksum = 0;
 uint32_t esp32_checksum = 0;
-uint32_t timeout_counter = 0;
+uint32_t crc_address = APP_CURRENT;	/* the CRC unit holds the CRC of the image up to here */
+uint16_t next_seq = 0;
+uint8_t nak_sent = 0;
+uint8_t retries = 0;
+
+/* Core cycles spent receiving the image, and how much of it the link waited on flash */
+uint64_t transfer_cycles = 0;
+uint64_t flash_stall_cycles = 0;
+uint32_t cycle_mark = 0;
+
+/* Page mode (after RESUME_QUERY or PAGE_CRCS): FW_DATA carries whole pages, seq is
+the page number and pages may come in any order. page_needed holds the pages not
+received yet, pages that already match are left out from the start; PAGE_MAP
+reports it after every pass, so only lost pages are sent again */
+uint8_t page_mode = 0;
+uint8_t page_needed[(APP_SIZE + 7) / 8];
+uint8_t page_committed[(APP_SIZE + 7) / 8];	/* in flash and verified */
+uint16_t pages_stored = 0;
+
+/* Offset a cut-off transfer of the same image continues from (after RESUME_QUERY) */
+uint32_t resume_offset = 0;
+
+/* What FW_DATA carries: the image, a patch against the application in flash
+(after DELTA_BASE) or the compressed image (after LZ_START) */
+#define DATA_FORMAT_RAW							0
+#define DATA_FORMAT_DELTA						1
+#define DATA_FORMAT_LZ							2
+
+uint8_t data_format = DATA_FORMAT_RAW;
+uint32_t transfer_size = 0;
+uint32_t busy_deadline = 0;
+
+uint32_t link_baud = LINK_BAUD_DEFAULT;
+uint8_t link_trial = 0;
+uint32_t link_mark = 0;		/* tick of the last valid frame */
 
 /* Function prototype */
+void RCC_Configure(void);
 void GPIO_Configure(void);
 void UART_Configure(void);
-void SendResponseByte(uint8_t response);
-uint8_t WaitForData(uint32_t timeout);
+void SendFrame(uint8_t type, uint16_t seq, const uint8_t *pPayload, uint16_t length);
+void SendResponse(uint8_t type, uint16_t seq);
+void ReadRxRing(void);
+uint8_t HandleLinkFrame(void);
+void SetLinkBaud(uint32_t baud);
+void CheckLinkFallback(void);
+uint8_t WaitForFrame(uint32_t timeout_ms);
+void RequestResend(void);
+uint8_t StorePageData(const uint8_t *pData, uint32_t length);
+uint8_t FinishPages(void);
+uint8_t StoreExpandedData(const uint8_t *pData, uint32_t length);
+uint8_t StoreEncodedFrame(const uint8_t *pData, uint32_t length);
+uint8_t StartDelta(const uint8_t *pPayload, uint32_t length);
+uint8_t StartLz(const uint8_t *pPayload, uint32_t length);
+void StartResume(uint32_t size, uint32_t crc);
+void StartPageMode(void);
+uint8_t StorePage(uint16_t page, const uint8_t *pData, uint32_t length);
+uint8_t TransferComplete(void);
+void CountTransferCycles(void);
+void ComparePages(const uint8_t *pCRCs, uint32_t count);
+void AdvanceImageCRC(void);
+uint32_t ImageCRC(void);
+uint32_t ReadBE32(const uint8_t *pData);
+void WriteBE32(uint8_t *pData, uint32_t value);
 
 int main(void)
 {
 	/* Initialize peripherals */
+	RCC_Configure();
 	GPIO_Configure();
 	UART_Configure();
 	NVIC_InterruptConfig(IRQ_NO_USART1, ENABLE);
+	NVIC_InterruptConfig(IRQ_NO_DMA1_CH5, ENABLE);
 	USART_Start(uart1.pUSARTx);
+	DWT_CycleCounterInit();
+	SysTick_Init(RCC_GetHCLK());
+
+#ifdef FLASH_BENCHMARK
+	FlashBenchmark_Run();
+#endif
 
-	/* Clear UART buffer */
-	memset(uart_rx_buffer, 0, sizeof(uart_rx_buffer));
-	memset(uart_tx_buffer, 0, sizeof(uart_tx_buffer));
+	/* Receive continuously into the DMA ring, the receive interrupts assemble frames */
+	Frame_RxReset();
+	USART_ReceiveDataDMA(&uart1, uart_rx_ring, UART_RX_RING_SIZE);
 
 	/* Check if valid application exists - if yes, wait limited time for update request */
 	uint8_t valid_app_exists = 0;
 
-	/* Basic application validation */
-	if(Bootloader_CheckApp(APP_CURRENT, APP_END))
+	/* Basic application validation, an application whose transfer was cut off is incomplete */
+	Journal_Open();
+	if(Bootloader_CheckApp(APP_CURRENT, APP_END) && !Journal_Pending())
 	{
 		valid_app_exists = 1;
 	}
@@ -111,7 +220,8 @@ int main(void)
 				FLASH_ReadData(APP_CURRENT_FLAG, (uint32_t*)flag, 1);
 
 				if(flag[0] == 0x0001){/* co yeu cau update khi dang chay app */
-					FLASH_RemovePartition(APP_CURRENT, 111);
+					/* pages are erased one by one as the new image arrives, the vector
+					table first and programmed last, so a cut-off image never validates */
 					/* Having update annoucement, sending ready cmd */
 					bl_state = SEND_READY;
 				}
@@ -129,9 +239,9 @@ int main(void)
 			}
 			case WAIT_REQUEST: {
 				/* Wait for "FW_REQUEST" */
-				WaitForData(500);
-				data_received = 0;
-				memset(uart_rx_buffer, 0, sizeof(uart_rx_buffer));
+				if(WaitForFrame(500) == FRAME_OK) {
+					Frame_RxRelease();
+				}
 				bl_state = SEND_READY;
 				break;
 			}
@@ -139,119 +249,208 @@ int main(void)
 			case SEND_READY:
 			{
 				/* Send FW_READY response to ESP32 */
-				SendResponseByte(FW_READY);
-				memset(uart_rx_buffer, 0, sizeof(uart_rx_buffer));
-				memset(uart_tx_buffer, 0, sizeof(uart_tx_buffer));
+				SendResponse(FW_READY, 0);
 				bl_state = WAIT_LENGTH;
 				break;
 			}
 
 			case WAIT_LENGTH:
 			{
-				/* Wait for FW_LENGTH command (1 command byte + 4 data bytes) */
-				if(WaitForData(500)) { // 500 ms timeout
-					if(uart_rx_buffer[0] == FW_LENGTH) {
-						/* Extract 32-bit length in big-endian format (matching ESP32) */
-						firmware_size = (uart_rx_buffer[1] << 24) |
-						               (uart_rx_buffer[2] << 16) |
-						               (uart_rx_buffer[3] << 8) |
-						               uart_rx_buffer[4];
-
-						/* Validate firmware size */
-						if(firmware_size > 0 && firmware_size <= APP_MAX_SIZE) {
-							SendResponseByte(FW_OK);
-							memset(uart_rx_buffer, 0, sizeof(uart_rx_buffer));
-							memset(uart_tx_buffer, 0, sizeof(uart_tx_buffer));
-							/* Reset variables for data reception */
-							bytes_received = 0;
-							flash_write_address = APP_CURRENT;
-							calculated_checksum = 0;
-							bl_state = RECEIVE_DATA;
-						} else {
-							SendResponseByte(FW_ERR);
-							bl_state = WAIT_REQUEST; /* Go back to wait for new request */
-						}
+				/* Wait for FW_LENGTH frame */
+				uint8_t result = WaitForFrame(500); // 500 ms timeout
+				if(result == FRAME_NONE) {
+					/* Timeout - wait for a new request */
+					bl_state = WAIT_REQUEST;
+					break;
+				}
+				if(result != FRAME_OK) {
+					break;
+				}
+
+				if(frame.type == FW_LENGTH && frame.length >= 4) {
+					firmware_size = ReadBE32(frame.payload);
+					Frame_RxRelease();
+
+					/* Validate firmware size */
+					if(firmware_size > 0 && firmware_size <= APP_MAX_SIZE) {
+						/* Reset variables for data reception */
+						bytes_received = 0;
+						transfer_size = firmware_size;
+						next_seq = 0;
+						page_mode = 0;
+						pages_stored = 0;
+						resume_offset = 0;
+						data_format = DATA_FORMAT_RAW;
+						nak_sent = 0;
+						retries = 0;
+						Pages_Init(APP_CURRENT);
+						Pages_Hold(APP_CURRENT);
+						/* a transfer in this boot that failed may have left it open */
+						Journal_Open();
+						crc_address = APP_CURRENT;
+						transfer_cycles = 0;
+						flash_stall_cycles = 0;
+						cycle_mark = DWT_GetCycles();
+
+						uint8_t window = FRAME_RX_SLOTS;
+						SendFrame(FW_OK, 0, &window, 1);
+						bl_state = RECEIVE_DATA;
+					} else {
+						SendResponse(FW_ERR, 0);
+						bl_state = WAIT_REQUEST; /* Go back to wait for new request */
 					}
 				} else {
-					/* Timeout - if valid app exists, jump to it; otherwise wait again */
-					memset(uart_rx_buffer, 0, sizeof(uart_rx_buffer));
-					memset(uart_tx_buffer, 0, sizeof(uart_tx_buffer));
-					bl_state = WAIT_REQUEST;
+					/* FW_REQUEST retry from ESP32 - answer again */
+					if(frame.type == FW_REQUEST) {
+						bl_state = SEND_READY;
+					}
+					Frame_RxRelease();
 				}
 				break;
 			}
 
 			case RECEIVE_DATA:
 			{
-				/* Wait for data chunks or checksum command
-				Use shorter timeout if all firmware data received */
-				uint32_t wait_timeout = (bytes_received >= firmware_size) ? 1000 : 10000;
-				/* Receive remaining bytes in the last chunk */
-				uint32_t remaining = firmware_size - bytes_received;
-				uint8_t chunk_size = (remaining >= DATA_CHUNK_SIZE) ? DATA_CHUNK_SIZE : remaining;
-
-				if (bytes_received >= firmware_size) {
-					/* firmware was sent all, wait for checksum */
-					data_received = 0;
-					USART_ReceiveDataIT(&uart1, uart_rx_buffer, 5);
-					uint32_t timeout_counter = 0;
-					uint32_t timeout_limit = wait_timeout * 1000;
-					while(timeout_counter < timeout_limit && !data_received) {
-						timeout_counter++;
+				CountTransferCycles();
+				uint8_t result = WaitForFrame(DATA_RX_TIMEOUT);
+				if(result != FRAME_OK) {
+					/* corrupt frame, or silence because the frame or our ACK was lost */
+					if(result == FRAME_NONE) {
+						nak_sent = 0;
 					}
-					if(data_received && uart_rx_buffer[0] == CHECKSUM_DATA) {
-						esp32_checksum = (uart_rx_buffer[1] << 24) |
-										 (uart_rx_buffer[2] << 16) |
-										 (uart_rx_buffer[3] << 8) |
-										 uart_rx_buffer[4];
-						bl_state = VERIFY_CHECKSUM;
+					RequestResend();
+					break;
+				}
+
+				if(frame.type == FW_DATA && page_mode) {
+					uint16_t page = frame.seq;
+					uint8_t stored = StorePage(page, frame.payload, frame.length);
+					Frame_RxRelease();
+					if(!stored) {
+						SendResponse(FW_ERR, page);
+						Journal_Abandon();
+						bl_state = WAIT_REQUEST;
 						break;
 					}
-				} else {
-					/* receive the last chunk from UART */
-					data_received = 0;
-					USART_ReceiveDataIT(&uart1, uart_rx_buffer, chunk_size);
-					uint32_t timeout_counter = 0;
-					uint32_t timeout_limit = wait_timeout * 1000;
-					while(timeout_counter < timeout_limit && !data_received) {
-						timeout_counter++;
+
+					/* every intact page is acknowledged, lost ones show up in the next PAGE_MAP */
+					SendResponse(FW_ACK, page);
+					retries = 0;
+				} else if(frame.type == FW_DATA && frame.seq == next_seq) {
+					uint32_t length = frame.length;
+					uint32_t remaining = transfer_size - bytes_received;
+
+					/* every image packet but the last must be whole words */
+					if(length == 0 || length > remaining || (data_format == DATA_FORMAT_RAW && length < remaining && (length & 3))) {
+						Frame_RxRelease();
+						SendResponse(FW_ERR, next_seq);
+						Journal_Abandon();
+						bl_state = WAIT_REQUEST;
+						break;
 					}
-					if(data_received) {
-						/* checksum algorithm */
-						for(uint8_t i = 0; i < chunk_size; i++) {
-							calculated_checksum += uart_rx_buffer[i];
-						}
-
-
-						if (chunk_size == DATA_CHUNK_SIZE) {
-							/* Chunk has 8 bytes */
-							FLASH_WriteData(flash_write_address, (uint32_t*)uart_rx_buffer, 2);
-						} else {
-							/* the last chunk < 8 bytes - pad with 0xFF and write 2 words */
-							uint8_t padded_data[DATA_CHUNK_SIZE];
-							memset(padded_data, 0xFF, DATA_CHUNK_SIZE);
-							memcpy(padded_data, uart_rx_buffer, chunk_size);
-							FLASH_WriteData(flash_write_address, (uint32_t*)padded_data, 2);
-						}
-
-						flash_write_address += chunk_size;
-						bytes_received += chunk_size;
-						SendResponseByte(FW_RECEIVED);
+
+					/* programmed in the background while the next frames arrive */
+					uint8_t stored = (data_format == DATA_FORMAT_RAW) ? StorePageData(frame.payload, length)
+					                                                  : StoreEncodedFrame(frame.payload, length);
+					Frame_RxRelease();
+					if(stored != PAGES_OK) {
+						SendResponse(FW_ERR, next_seq);
+						Journal_Abandon();
+						bl_state = WAIT_REQUEST;
+						break;
 					}
+					bytes_received += length;
+
+					/* the slot is free again, the ESP32 may refill it right away */
+					SendResponse(FW_ACK, next_seq);
+					next_seq++;
+					nak_sent = 0;
+					retries = 0;
+				} else if(frame.type == PAGE_CRCS && data_format == DATA_FORMAT_RAW && bytes_received == 0 && pages_stored == 0) {
+					/* a repeat means our PAGE_MAP was lost, it comes out the same */
+					ComparePages(frame.payload, frame.length / 4);
+					Frame_RxRelease();
+					SendFrame(PAGE_MAP, 0, page_needed, sizeof(page_needed));
+				} else if(frame.type == PASS_END && page_mode) {
+					Frame_RxRelease();
+					SendFrame(PAGE_MAP, 0, page_needed, sizeof(page_needed));
+				} else if(frame.type == RESUME_QUERY && frame.length >= 8 && data_format == DATA_FORMAT_RAW &&
+				          bytes_received == 0 && pages_stored == 0) {
+					/* a repeat means our RESUME_POINT was lost, it is answered the same */
+					StartResume(ReadBE32(&frame.payload[0]), ReadBE32(&frame.payload[4]));
+					Frame_RxRelease();
+					uint8_t point[4];
+					WriteBE32(point, resume_offset);
+					SendFrame(RESUME_POINT, 0, point, sizeof(point));
+				} else if(frame.type == DELTA_BASE && !page_mode &&
+				          (data_format == DATA_FORMAT_DELTA || (data_format == DATA_FORMAT_RAW && bytes_received == 0))) {
+					/* a repeat means our answer was lost */
+					uint8_t accepted = (data_format == DATA_FORMAT_DELTA) || StartDelta(frame.payload, frame.length);
+					Frame_RxRelease();
+					SendResponse(accepted ? DELTA_ACCEPT : DELTA_REJECT, 0);
+				} else if(frame.type == LZ_START && !page_mode &&
+				          (data_format == DATA_FORMAT_LZ || (data_format == DATA_FORMAT_RAW && bytes_received == 0))) {
+					uint8_t accepted = (data_format == DATA_FORMAT_LZ) || StartLz(frame.payload, frame.length);
+					Frame_RxRelease();
+					if(!accepted) {
+						SendResponse(FW_ERR, 0);
+						bl_state = WAIT_REQUEST;
+						break;
+					}
+					SendResponse(LZ_ACCEPT, 0);
+				} else if(frame.type == FW_DATA && frame.seq < next_seq) {
+					/* our ACK was lost and the ESP32 went back, ACK again */
+					Frame_RxRelease();
+					SendResponse(FW_ACK, next_seq - 1);
+				} else if(frame.type == CHECKSUM_DATA && frame.length >= 4 && TransferComplete()) {
+					esp32_checksum = ReadBE32(frame.payload);
+					Frame_RxRelease();
+					if(FinishPages() != PAGES_OK ||
+					   (data_format == DATA_FORMAT_DELTA && Delta_Done() != DELTA_OK) ||
+					   (data_format == DATA_FORMAT_LZ && Lz_Done() != LZ_OK)) {
+						SendResponse(FW_ERR, next_seq);
+						Journal_Abandon();
+						bl_state = WAIT_REQUEST;
+						break;
+					}
+					CountTransferCycles();
+					bl_state = VERIFY_CHECKSUM;
+				} else {
+					/* a frame before this one was lost */
+					Frame_RxRelease();
+					RequestResend();
 				}
 				break;
 			}
 
 			case VERIFY_CHECKSUM:
 			{
-				/* Compare checksums */
-				uint32_t stm32_checksum = calculated_checksum % 256;
+				/* CRC of what is in flash and the held vector table, so skipped pages count too */
+				uint32_t stm32_checksum = ImageCRC();
 
 				if(stm32_checksum == esp32_checksum) {
-					SendResponseByte(CHECKSUM_OK);
+					/* the vector table goes in last, the application is valid from here */
+					if(Pages_Release() != PAGES_OK) {
+						SendResponse(FW_ERR, 0);
+						Journal_Abandon();
+						bl_state = WAIT_REQUEST;
+						break;
+					}
+
+					uint8_t timing[8];
+					WriteBE32(&timing[0], (uint32_t)(flash_stall_cycles >> 8));
+					WriteBE32(&timing[4], (uint32_t)(transfer_cycles >> 8));
+					SendFrame(CHECKSUM_OK, 0, timing, sizeof(timing));
+					Journal_Clear();
+
+					/* the update flag is cleared only after a good image, clear it here if the image ends before it */
+					if(APP_CURRENT + firmware_size <= APP_CURRENT_FLAG) {
+						FLASH_RemovePartition(APP_CURRENT_FLAG, 1);
+					}
 					bl_state = JUMP_TO_APP;
 				} else {
-					SendResponseByte(CHECKSUM_ERR);
+					SendResponse(CHECKSUM_ERR, 0);
+					Journal_Abandon();
 					bl_state = WAIT_REQUEST;
 				}
 				break;
@@ -259,8 +458,15 @@ int main(void)
 
 			case JUMP_TO_APP:
 			{
+				/* the application owns this RAM from now on */
+				USART_AbortReceiveDMA(&uart1);
+				NVIC_InterruptConfig(IRQ_NO_DMA1_CH5, DISABLE);
 				NVIC_InterruptConfig(IRQ_NO_USART1, DISABLE);
 
+				/* the application starts from the reset clock tree as after power-up */
+				SysTick_DeInit();
+				RCC_DeInit();
+
 				Bootloader_JumpApp(APP_CURRENT);
 				break;
 			}
@@ -268,6 +474,25 @@ int main(void)
 	}
 }
 
+void RCC_Configure(void)
+{
+	RCC_Config_t clock;
+
+	/* 8 MHz crystal x 9 = 72 MHz, APB1 limited to 36 MHz */
+	clock.RCC_ClockSource = RCC_CLK_SRC_PLL_HSE;
+	clock.RCC_PLLMul = 9;
+	clock.RCC_AHBPrescaler = 1;
+	clock.RCC_APB1Prescaler = 2;
+	clock.RCC_APB2Prescaler = 1;
+
+	if(RCC_ClockConfig(&clock) != RCC_OK) {
+		/* no crystal: HSI/2 x 16 = 64 MHz */
+		clock.RCC_ClockSource = RCC_CLK_SRC_PLL_HSI;
+		clock.RCC_PLLMul = 16;
+		RCC_ClockConfig(&clock);
+	}
+}
+
 void GPIO_Configure(void)
 {
 	gpio.pGPIOx = GPIOA;
@@ -287,7 +512,7 @@ void GPIO_Configure(void)
 void UART_Configure(void)
 {
 	uart1.pUSARTx = USART1;
-	uart1.USART_Config.USART_Baudrate = USART_STD_BAUD_115200;
+	uart1.USART_Config.USART_Baudrate = LINK_BAUD_DEFAULT;
 	uart1.USART_Config.USART_HWFLowControl = USART_HW_FLOW_CTRL_NONE;
 	uart1.USART_Config.USART_Mode = USART_MODE_TXRX;
 	uart1.USART_Config.USART_NumberOfStopBits = USART_STOPBITS_1;
@@ -296,66 +521,396 @@ void UART_Configure(void)
 	USART_Init(&uart1);
 }
 
-void SendResponseByte(uint8_t response)
+void SendFrame(uint8_t type, uint16_t seq, const uint8_t *pPayload, uint16_t length)
 {
-	uart_tx_buffer[0] = response;
-	USART_SendData(&uart1, uart_tx_buffer, 1);
+	uint32_t encoded_length = Frame_Encode(type, seq, pPayload, length, uart_tx_buffer);
+	USART_SendData(&uart1, uart_tx_buffer, encoded_length);
 }
 
-uint8_t WaitForData(uint32_t timeout_ms)
+void SendResponse(uint8_t type, uint16_t seq)
 {
-	/* Clear buffer before receiving */
-	memset(uart_rx_buffer, 0, sizeof(uart_rx_buffer));
-	data_received = 0;
-
-	/* Start receiving first byte */
-	USART_ReceiveDataIT(&uart1, uart_rx_buffer, 1);
-
-	uint32_t timeout_counter = 0;
-	uint32_t timeout_limit = timeout_ms * 1000; /* Convert to microseconds roughly */
-
-	while(timeout_counter < timeout_limit) {
-		if(data_received) {
-			/* Check if we need to receive more bytes */
-			if(uart_rx_buffer[0] == FW_LENGTH || uart_rx_buffer[0] == CHECKSUM_DATA) {
-				/* Need to receive 4 more bytes for the 32-bit data */
-				data_received = 0;
-				USART_ReceiveDataIT(&uart1, &uart_rx_buffer[1], 4);
-
-				/* Wait for the remaining 4 bytes */
-				timeout_counter = 0; /* Reset timeout for additional bytes */
-				while(timeout_counter < timeout_limit && !data_received) {
-					timeout_counter++;
-				}
-				return data_received ? 1 : 0;
-			}
-			else if(uart_rx_buffer[0] == CHECKSUM_DATA){
+	SendFrame(type, seq, NULL, 0);
+}
 
+/* Wait for the next frame. FRAME_OK leaves it in `frame` until Frame_RxRelease,
+a corrupt frame is released here and reported as FRAME_ERROR. Baud rate
+negotiation frames are answered here and never reach the states */
+uint8_t WaitForFrame(uint32_t timeout_ms)
+{
+	uint32_t deadline = SysTick_Deadline(timeout_ms);
+
+	while(!SysTick_Expired(deadline)) {
+		/* cleared before the queue is looked at, a frame added later sets it again */
+		frame_rx_event = 0;
+
+		/* program the pending page while nothing else is to do */
+		uint8_t flash_idle = (Pages_Poll() != PAGES_BUSY);
+
+		uint8_t result = Frame_RxGet(&frame);
+		if(result == FRAME_OK) {
+			link_mark = SysTick_GetTicks();
+			if(!HandleLinkFrame()) {
+				return FRAME_OK;
 			}
-			else if(uart_rx_buffer[0] != FW_REQUEST && uart_rx_buffer[0] != CHECKSUM_DATA && uart_rx_buffer[0] != FW_LENGTH) {
-				/* This might be data chunk - receive remaining 7 bytes */
-				data_received = 0;
-				USART_ReceiveDataIT(&uart1, &uart_rx_buffer[1], DATA_CHUNK_SIZE - 1);
-
-				/* Wait for remaining bytes */
-				timeout_counter = 0;
-				while(timeout_counter < timeout_limit && !data_received) {
-					timeout_counter++;
-				}
-				return data_received ? 1 : 0;
-			} else {
-				/* Single byte command received */
+			deadline = SysTick_Deadline(timeout_ms);
+			continue;
+		}
+		if(result == FRAME_ERROR) {
+			Frame_RxRelease();
+			return FRAME_ERROR;
+		}
+		CheckLinkFallback();
+
+		/* nothing to do until a frame comes in or the next tick */
+		if(flash_idle) {
+			SysTick_SleepUnless(&frame_rx_event);
+		}
+	}
+
+	return FRAME_NONE; /* Timeout */
+}
+
+/* Interrupt context: assemble what the DMA has received into frames, straight
+from the ring. When every frame slot is taken it stops after a delimiter and
+leaves the rest in the ring, so nothing is lost while main is busy with flash */
+void ReadRxRing(void)
+{
+	uint8_t *pData;
+	uint32_t length;
+
+	while(Frame_RxReady() && (length = USART_PeekData(&uart1, &pData)) > 0) {
+		uint32_t used = 0;
+		while(used < length) {
+			uint8_t byte = pData[used++];
+			Frame_RxByte(byte);
+			if(byte == FRAME_DELIMITER && !Frame_RxReady()) break;
+		}
+		USART_SkipData(&uart1, used);
+	}
+	frame_rx_event = 1;
+}
+
+/* Baud rate negotiation, returns 1 when the frame was consumed */
+uint8_t HandleLinkFrame(void)
+{
+	uint16_t seq = frame.seq;
+
+	switch(frame.type) {
+		case BAUD_PROPOSE:
+		{
+			uint32_t baud = (frame.length >= 4) ? ReadBE32(frame.payload) : 0;
+			Frame_RxRelease();
+
+			uint32_t actual = USART_GetActualBaudRate(uart1.pUSARTx, baud);
+			uint32_t error = (actual > baud) ? actual - baud : baud - actual;
+			if(!actual || error * 1000 > baud * LINK_MAX_BAUD_ERROR) {
+				SendResponse(BAUD_REJECT, 0);
 				return 1;
 			}
+
+			/* USART_SendData returns after TC, the answer is out at the old rate */
+			SendResponse(BAUD_ACCEPT, 0);
+			SetLinkBaud(baud);
+			link_trial = 1;
+			return 1;
+		}
+		case BAUD_TEST:
+		{
+			uint8_t pattern[BAUD_TEST_MAX];
+			uint16_t length = (frame.length > BAUD_TEST_MAX) ? BAUD_TEST_MAX : frame.length;
+			for(uint16_t i = 0; i < length; i++) {
+				pattern[i] = frame.payload[i];
+			}
+			Frame_RxRelease();
+			SendFrame(BAUD_TEST, seq, pattern, length);
+			return 1;
+		}
+		case BAUD_CONFIRM:
+		{
+			Frame_RxRelease();
+			link_trial = 0;
+			SendResponse(BAUD_CONFIRM, 0);
+			return 1;
+		}
+		default:
+			return 0;
+	}
+}
+
+void SetLinkBaud(uint32_t baud)
+{
+	USART_SetBaudRate(uart1.pUSARTx, baud);
+	link_baud = baud;
+	link_mark = SysTick_GetTicks();
+}
+
+void CheckLinkFallback(void)
+{
+	if(link_baud == LINK_BAUD_DEFAULT) return;
+
+	if(SysTick_Expired(link_mark + (link_trial ? LINK_TRIAL_TIMEOUT : LINK_FALLBACK_TIMEOUT))) {
+		SetLinkBaud(LINK_BAUD_DEFAULT);
+		link_trial = 0;
+	}
+}
+
+/* Go-back-N: one FW_NAK per gap, frames still in flight behind it are dropped.
+In page mode every page stands alone and each bad frame gets its own FW_NAK, the
+ESP32 sends its oldest unacknowledged page again instead of waiting for the ACK */
+void RequestResend(void)
+{
+	if(++retries > DATA_MAX_RETRIES) {
+		/* ESP32 is gone, start over */
+		bl_state = WAIT_REQUEST;
+		return;
+	}
+	if(page_mode) {
+		SendResponse(FW_NAK, 0);
+	} else if(!nak_sent) {
+		SendResponse(FW_NAK, next_seq);
+		nak_sent = 1;
+	}
+}
+
+/* Queue data for programming, when both page buffers are busy the link waits on flash.
+Nothing in flash changes before the journal marks the application incomplete */
+uint8_t StorePageData(const uint8_t *pData, uint32_t length)
+{
+	uint32_t start = DWT_GetCycles();
+	uint8_t result;
+
+	Journal_Begin(firmware_size);
+	while((result = Pages_Write(pData, length)) == PAGES_BUSY) {
+		Pages_Poll();
+	}
+	flash_stall_cycles += DWT_GetCycles() - start;
+	AdvanceImageCRC();
+	return result;
+}
+
+/* Program the last page and wait until everything is written and verified */
+uint8_t FinishPages(void)
+{
+	uint32_t start = DWT_GetCycles();
+	uint8_t result;
+
+	Pages_Flush();
+	while((result = Pages_Poll()) == PAGES_BUSY);
+	flash_stall_cycles += DWT_GetCycles() - start;
+	return result;
+}
+
+/* Patch or decompressed output. Applying a patch frame may take far longer than
+the ESP32 waits for an ACK, FW_BUSY tells it to keep waiting */
+uint8_t StoreExpandedData(const uint8_t *pData, uint32_t length)
+{
+	if(SysTick_Expired(busy_deadline)) {
+		SendResponse(FW_BUSY, next_seq);
+		busy_deadline = SysTick_Deadline(DATA_BUSY_INTERVAL);
+	}
+	return StorePageData(pData, length);
+}
+
+uint8_t StoreEncodedFrame(const uint8_t *pData, uint32_t length)
+{
+	uint8_t result;
+
+	busy_deadline = SysTick_Deadline(DATA_BUSY_INTERVAL);
+	if(data_format == DATA_FORMAT_DELTA) {
+		result = (Delta_Feed(pData, length) == DELTA_OK);
+	} else {
+		result = (Lz_Feed(pData, length) == LZ_OK);
+	}
+	return result ? PAGES_OK : PAGES_ERROR;
+}
+
+/* Accept a patch only against the image the ESP32 thinks is in flash */
+uint8_t StartDelta(const uint8_t *pPayload, uint32_t length)
+{
+	if(length < 12) return 0;
+
+	uint32_t base_size = ReadBE32(&pPayload[0]);
+	uint32_t base_crc = ReadBE32(&pPayload[4]);
+	uint32_t patch_size = ReadBE32(&pPayload[8]);
+
+	if(base_size == 0 || base_size > APP_MAX_SIZE || patch_size == 0 ||
+	   Pages_CRC32(APP_CURRENT, base_size) != base_crc) {
+		return 0;
+	}
+
+	Delta_Init(APP_CURRENT, base_size, firmware_size, StoreExpandedData);
+	transfer_size = patch_size;
+	data_format = DATA_FORMAT_DELTA;
+	return 1;
+}
+
+uint8_t StartLz(const uint8_t *pPayload, uint32_t length)
+{
+	if(length < 4) return 0;
+
+	uint32_t compressed_size = ReadBE32(pPayload);
+	if(compressed_size == 0 || compressed_size > APP_MAX_SIZE + APP_MAX_SIZE / 8 + 1) {
+		return 0;
+	}
+
+	Lz_Init(firmware_size, StoreExpandedData);
+	transfer_size = compressed_size;
+	data_format = DATA_FORMAT_LZ;
+	return 1;
+}
+
+/* Mark the pages whose flash content differs from the image (or has no CRC) as needed */
+void ComparePages(const uint8_t *pCRCs, uint32_t count)
+{
+	uint32_t page_count = (firmware_size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+	for(uint32_t i = 0; i < sizeof(page_needed); i++) {
+		page_needed[i] = 0;
+	}
+	for(uint32_t i = 0; i < page_count; i++) {
+		uint32_t offset = i * PAGE_SIZE;
+		uint32_t length = (firmware_size - offset < PAGE_SIZE) ? firmware_size - offset : PAGE_SIZE;
+
+		if(i >= count || Pages_CRC32(APP_CURRENT + offset, length) != ReadBE32(&pCRCs[i * 4])) {
+			page_needed[i / 8] |= (1 << (i % 8));
 		}
-		timeout_counter++;
 	}
+	StartPageMode();
+}
+
+/* Pages that are not needed are in flash already */
+void StartPageMode(void)
+{
+	for(uint32_t i = 0; i < sizeof(page_needed); i++) {
+		page_committed[i] = ~page_needed[i];
+	}
+	page_mode = 1;
+}
+
+/* Page mode: store a whole page where it belongs. A page that is in already is
+acknowledged again without being stored, 0 for a page that does not fit the image */
+uint8_t StorePage(uint16_t page, const uint8_t *pData, uint32_t length)
+{
+	uint32_t offset = (uint32_t)page * PAGE_SIZE;
+	if(offset >= firmware_size) return 0;
+
+	uint32_t remaining = firmware_size - offset;
+	if(length != ((remaining < PAGE_SIZE) ? remaining : PAGE_SIZE)) return 0;
+	if(!(page_needed[page / 8] & (1 << (page % 8)))) return 1;
+
+	Pages_Seek(APP_CURRENT + offset);
+	if(StorePageData(pData, length) != PAGES_OK) return 0;
+	/* the last page is short, hand it over so the next page starts on an empty buffer */
+	Pages_Flush();
+
+	page_needed[page / 8] &= ~(1 << (page % 8));
+	pages_stored++;
+	return 1;
+}
+
+uint8_t TransferComplete(void)
+{
+	if(!page_mode) return bytes_received >= transfer_size;
+
+	for(uint32_t i = 0; i < sizeof(page_needed); i++) {
+		if(page_needed[i]) return 0;
+	}
+	return 1;
+}
+
+/* Feed the CRC unit with the image as its pages are programmed, whole words only.
+Pages come in any order in page mode, the CRC is taken at the end then */
+void AdvanceImageCRC(void)
+{
+	if(page_mode) return;
 
-	return 0; /* Timeout */
+	uint32_t end = Pages_Programmed();
+	if(end > APP_CURRENT + firmware_size) {
+		end = APP_CURRENT + firmware_size;
+	}
+	end &= ~3;
+	if(end <= crc_address) return;
+
+	/* page CRCs and the delta base check use the unit before the first page is programmed */
+	if(crc_address == APP_CURRENT) {
+		CRC_Reset();
+	}
+	Pages_AccumulateCRC(crc_address, end - crc_address);
+	crc_address = end;
+}
+
+uint32_t ImageCRC(void)
+{
+	if(page_mode) return Pages_CRC32(APP_CURRENT, firmware_size);
+
+	AdvanceImageCRC();
+	uint32_t crc = (crc_address == APP_CURRENT) ? CRC_INIT_VALUE : CRC_GetValue();
+	return CRC_UpdateBytes(crc, Pages_Source(crc_address), APP_CURRENT + firmware_size - crc_address);
 }
 
-/* USART interrupt callback */
+/* Page mode, continuing a cut-off transfer of the same image after its last
+committed page. The pages before it count as received, but for the vector table:
+it was only ever held in RAM */
+void StartResume(uint32_t size, uint32_t crc)
+{
+	uint32_t committed = (size == firmware_size) ? Journal_Resume(size, crc) : 0;
+	uint32_t page_count = (firmware_size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+	for(uint32_t i = 0; i < sizeof(page_needed); i++) {
+		page_needed[i] = 0;
+	}
+	page_needed[0] = 1;
+	for(uint32_t i = committed; i < page_count; i++) {
+		page_needed[i / 8] |= (1 << (i % 8));
+	}
+	StartPageMode();
+	resume_offset = (committed * PAGE_SIZE < firmware_size) ? committed * PAGE_SIZE : firmware_size;
+}
+
+/* A page is programmed and verified, move the resume point past it. In page mode
+that is the end of the run of committed pages from the start */
+void Pages_CommittedCallback(uint32_t end)
+{
+	uint32_t pages = (end - APP_CURRENT) / PAGE_SIZE;
+
+	if(page_mode) {
+		uint32_t page_count = (firmware_size + PAGE_SIZE - 1) / PAGE_SIZE;
+		page_committed[(pages - 1) / 8] |= (1 << ((pages - 1) % 8));
+		for(pages = 0; pages < page_count && (page_committed[pages / 8] & (1 << (pages % 8))); pages++);
+	}
+	Journal_Commit(pages);
+}
+
+void CountTransferCycles(void)
+{
+	uint32_t now = DWT_GetCycles();
+	transfer_cycles += now - cycle_mark;
+	cycle_mark = now;
+}
+
+uint32_t ReadBE32(const uint8_t *pData)
+{
+	return ((uint32_t)pData[0] << 24) | ((uint32_t)pData[1] << 16) |
+	       ((uint32_t)pData[2] << 8) | pData[3];
+}
+
+void WriteBE32(uint8_t *pData, uint32_t value)
+{
+	pData[0] = value >> 24;
+	pData[1] = value >> 16;
+	pData[2] = value >> 8;
+	pData[3] = value;
+}
+
+/* USART interrupt callback: line idle or DMA ring half/full. Both interrupts
+have the same priority, so only one of them runs ReadRxRing at a time */
 void USART_ReceptionEventsCallback(USART_Handle_t *pUSARTHandle)
 {
-	data_received = 1;
+	ReadRxRing();
+}
+
+/* Main freed a frame slot after reception stopped, continue in interrupt context */
+void Frame_RxResumeCallback(void)
+{
+	NVIC_SetPending(IRQ_NO_DMA1_CH5);
 }
@@ -0,0 +1,153 @@
+/*
+ * ota_delta.c
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: nphuc
+ */
+
+#include "ota_delta.h"
+#include <string.h>
+
+#define DELTA_NO_PAGE							0xFFFFFFFF
+
+static uint8_t history[DELTA_HISTORY_PAGES][PAGE_SIZE] __attribute__((aligned(4)));
+static uint32_t history_page[DELTA_HISTORY_PAGES];
+
+static uint32_t source_base;
+static uint32_t source_size;
+static uint32_t target_size;
+static uint32_t output_count;
+static Delta_Output_t output;
+
+static uint8_t header[7];
+static uint8_t header_length;
+static uint32_t literal_left;
+static uint8_t status;
+
+static uint32_t Delta_Min(uint32_t a, uint32_t b)
+{
+	return (a < b) ? a : b;
+}
+
+/* keep the old content of the page the output is about to overwrite */
+static void Delta_EnterPage(void)
+{
+	uint32_t page = output_count / PAGE_SIZE;
+	uint32_t offset = page * PAGE_SIZE;
+	uint8_t slot = page % DELTA_HISTORY_PAGES;
+
+	if(offset < source_size) {
+		memcpy(history[slot], (const void *)(source_base + offset), Delta_Min(PAGE_SIZE, source_size - offset));
+		history_page[slot] = page;
+	} else {
+		history_page[slot] = DELTA_NO_PAGE;
+	}
+}
+
+/* length never crosses an output page boundary */
+static uint8_t Delta_Output(const uint8_t *pData, uint32_t length)
+{
+	if(output_count % PAGE_SIZE == 0) {
+		Delta_EnterPage();
+	}
+	if(output(pData, length) != PAGES_OK) {
+		return DELTA_ERROR;
+	}
+	output_count += length;
+	return DELTA_OK;
+}
+
+static const uint8_t *Delta_Source(uint32_t offset)
+{
+	uint32_t page = offset / PAGE_SIZE;
+	uint32_t output_page = output_count / PAGE_SIZE;
+
+	if(page >= output_page) {
+		return (const uint8_t *)(source_base + offset);
+	}
+	if(page + DELTA_HISTORY_PAGES > output_page && history_page[page % DELTA_HISTORY_PAGES] == page) {
+		return &history[page % DELTA_HISTORY_PAGES][offset % PAGE_SIZE];
+	}
+	return NULL;
+}
+
+static uint8_t Delta_Copy(uint32_t offset, uint32_t length)
+{
+	if(offset >= source_size || length > source_size - offset) {
+		return DELTA_ERROR;
+	}
+
+	while(length > 0) {
+		/* stay inside one source page and one output page */
+		uint32_t chunk = Delta_Min(PAGE_SIZE - offset % PAGE_SIZE, PAGE_SIZE - output_count % PAGE_SIZE);
+		chunk = Delta_Min(chunk, length);
+
+		const uint8_t *pSource = Delta_Source(offset);
+		if(pSource == NULL || Delta_Output(pSource, chunk) != DELTA_OK) {
+			return DELTA_ERROR;
+		}
+		offset += chunk;
+		length -= chunk;
+	}
+	return DELTA_OK;
+}
+
+void Delta_Init(uint32_t source, uint32_t size, uint32_t target, Delta_Output_t pOutput)
+{
+	for(uint8_t i = 0; i < DELTA_HISTORY_PAGES; i++) {
+		history_page[i] = DELTA_NO_PAGE;
+	}
+	source_base = source;
+	source_size = size;
+	target_size = target;
+	output_count = 0;
+	output = pOutput;
+	header_length = 0;
+	literal_left = 0;
+	status = DELTA_OK;
+}
+
+uint8_t Delta_Feed(const uint8_t *pData, uint32_t length)
+{
+	while(length > 0 && status == DELTA_OK) {
+		if(literal_left > 0) {
+			uint32_t chunk = Delta_Min(Delta_Min(literal_left, length), PAGE_SIZE - output_count % PAGE_SIZE);
+			status = Delta_Output(pData, chunk);
+			literal_left -= chunk;
+			pData += chunk;
+			length -= chunk;
+			continue;
+		}
+
+		header[header_length++] = *pData++;
+		length--;
+		if(header[0] > DELTA_OP_COPY) {
+			status = DELTA_ERROR;
+			break;
+		}
+		if(header_length < ((header[0] == DELTA_OP_COPY) ? 7 : 3)) {
+			continue;
+		}
+
+		uint32_t op_length = ((uint32_t)header[1] << 8) | header[2];
+		header_length = 0;
+		if(op_length == 0 || op_length > target_size - output_count) {
+			status = DELTA_ERROR;
+		} else if(header[0] == DELTA_OP_COPY) {
+			uint32_t offset = ((uint32_t)header[3] << 24) | ((uint32_t)header[4] << 16) |
+			                  ((uint32_t)header[5] << 8) | header[6];
+			status = Delta_Copy(offset, op_length);
+		} else {
+			literal_left = op_length;
+		}
+	}
+	return status;
+}
+
+uint8_t Delta_Done(void)
+{
+	if(status == DELTA_OK && header_length == 0 && literal_left == 0 && output_count == target_size) {
+		return DELTA_OK;
+	}
+	return DELTA_ERROR;
+}
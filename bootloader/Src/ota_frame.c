@@ -0,0 +1,197 @@
+/*
+ * ota_frame.c
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: nphuc
+ */
+
+#include "ota_frame.h"
+
+/* Encoded frames are stored from RX_SLOT_OFFSET and decoded in place one byte
+lower, which puts the payload (after the 5 byte header) on a word boundary */
+#define RX_SLOT_OFFSET							4
+#define RX_SLOT_SIZE							((RX_SLOT_OFFSET + FRAME_MAX_ENCODED + 3) & ~3)
+
+static uint8_t rx_slots[FRAME_RX_SLOTS][RX_SLOT_SIZE] __attribute__((aligned(4)));
+static __vo uint16_t rx_slot_length[FRAME_RX_SLOTS];
+static __vo uint8_t rx_slot_full[FRAME_RX_SLOTS];
+static __vo uint8_t rx_write_slot = 0;
+static __vo uint16_t rx_write_index = 0;
+static __vo uint8_t rx_dropping = 0;
+static __vo uint8_t rx_stalled = 0;
+static uint8_t rx_read_slot = 0;
+
+/* slot contents must be in memory before the flag handing the slot over */
+#define RX_BARRIER()							__asm volatile ("" ::: "memory")
+
+/* CRC-16/CCITT-FALSE, nibble table keeps flash usage small */
+static const uint16_t crc16_table[16] = {
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+	0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+uint16_t Frame_CRC16(const uint8_t *pData, uint32_t length, uint16_t crc)
+{
+	while(length--) {
+		crc = (crc << 4) ^ crc16_table[(crc >> 12) ^ (*pData >> 4)];
+		crc = (crc << 4) ^ crc16_table[(crc >> 12) ^ (*pData & 0x0F)];
+		pData++;
+	}
+	return crc;
+}
+
+/*
+ * COBS encoder working on one byte at a time
+ */
+typedef struct
+{
+	uint8_t *pOut;
+	uint32_t code_index;
+	uint32_t index;
+	uint8_t code;
+} Cobs_Encoder_t;
+
+static void Cobs_Put(Cobs_Encoder_t *pEnc, uint8_t byte)
+{
+	if(byte == FRAME_DELIMITER) {
+		pEnc->pOut[pEnc->code_index] = pEnc->code;
+		pEnc->code_index = pEnc->index++;
+		pEnc->code = 1;
+		return;
+	}
+	pEnc->pOut[pEnc->index++] = byte;
+	if(++pEnc->code == 0xFF) {
+		pEnc->pOut[pEnc->code_index] = pEnc->code;
+		pEnc->code_index = pEnc->index++;
+		pEnc->code = 1;
+	}
+}
+
+uint32_t Frame_Encode(uint8_t type, uint16_t seq, const uint8_t *pPayload, uint16_t length, uint8_t *pOut)
+{
+	uint8_t header[FRAME_HEADER_SIZE];
+	header[0] = type;
+	header[1] = seq >> 8;
+	header[2] = seq & 0xFF;
+	header[3] = length >> 8;
+	header[4] = length & 0xFF;
+
+	uint16_t crc = Frame_CRC16(header, FRAME_HEADER_SIZE, 0xFFFF);
+	crc = Frame_CRC16(pPayload, length, crc);
+
+	Cobs_Encoder_t enc = { pOut, 0, 1, 1 };
+	for(uint8_t i = 0; i < FRAME_HEADER_SIZE; i++) {
+		Cobs_Put(&enc, header[i]);
+	}
+	for(uint16_t i = 0; i < length; i++) {
+		Cobs_Put(&enc, pPayload[i]);
+	}
+	Cobs_Put(&enc, crc >> 8);
+	Cobs_Put(&enc, crc & 0xFF);
+
+	pOut[enc.code_index] = enc.code;
+	pOut[enc.index++] = FRAME_DELIMITER;
+	return enc.index;
+}
+
+/* pIn holds the encoded frame without delimiter, pOut may overlap it if pOut <= pIn */
+uint8_t Frame_Decode(const uint8_t *pIn, uint32_t length, uint8_t *pOut, Frame_t *pFrame)
+{
+	uint32_t read = 0;
+	uint32_t write = 0;
+
+	while(read < length) {
+		uint8_t code = pIn[read++];
+		if(code == FRAME_DELIMITER) return FRAME_ERROR;
+		for(uint8_t i = 1; i < code; i++) {
+			if(read >= length) return FRAME_ERROR;
+			pOut[write++] = pIn[read++];
+		}
+		if(code != 0xFF && read < length) {
+			pOut[write++] = 0;
+		}
+	}
+
+	if(write < FRAME_HEADER_SIZE + FRAME_CRC_SIZE) return FRAME_ERROR;
+
+	uint16_t payload_length = (pOut[3] << 8) | pOut[4];
+	if(payload_length > FRAME_MAX_PAYLOAD ||
+	   write != (uint32_t)(FRAME_HEADER_SIZE + payload_length + FRAME_CRC_SIZE)) return FRAME_ERROR;
+
+	uint16_t crc = (pOut[write - 2] << 8) | pOut[write - 1];
+	if(Frame_CRC16(pOut, write - FRAME_CRC_SIZE, 0xFFFF) != crc) return FRAME_ERROR;
+
+	pFrame->type = pOut[0];
+	pFrame->seq = (pOut[1] << 8) | pOut[2];
+	pFrame->length = payload_length;
+	pFrame->payload = &pOut[FRAME_HEADER_SIZE];
+	return FRAME_OK;
+}
+
+void Frame_RxReset(void)
+{
+	for(uint8_t i = 0; i < FRAME_RX_SLOTS; i++) {
+		rx_slot_full[i] = 0;
+	}
+	rx_write_slot = 0;
+	rx_write_index = 0;
+	rx_dropping = 0;
+	rx_stalled = 0;
+	rx_read_slot = 0;
+}
+
+void Frame_RxByte(uint8_t byte)
+{
+	uint8_t slot = rx_write_slot;
+
+	if(byte == FRAME_DELIMITER) {
+		if(!rx_dropping && rx_write_index > 0) {
+			rx_slot_length[slot] = rx_write_index;
+			RX_BARRIER();
+			rx_slot_full[slot] = 1;
+			rx_write_slot = (slot + 1) % FRAME_RX_SLOTS;
+		}
+		rx_write_index = 0;
+		rx_dropping = 0;
+		return;
+	}
+
+	if(rx_dropping) return;
+
+	/* no free slot or frame too long: drop it, main sees the gap in sequence.
+	A producer that waits on Frame_RxReady only gets here for a frame too long */
+	if(rx_slot_full[slot] || rx_write_index >= FRAME_MAX_ENCODED) {
+		rx_dropping = 1;
+		return;
+	}
+	rx_slots[slot][RX_SLOT_OFFSET + rx_write_index++] = byte;
+}
+
+uint8_t Frame_RxReady(void)
+{
+	if(!rx_slot_full[rx_write_slot]) return 1;
+	rx_stalled = 1;
+	return 0;
+}
+
+uint8_t Frame_RxGet(Frame_t *pFrame)
+{
+	if(!rx_slot_full[rx_read_slot]) return FRAME_NONE;
+	RX_BARRIER();
+	uint8_t *slot = rx_slots[rx_read_slot];
+	return Frame_Decode(&slot[RX_SLOT_OFFSET], rx_slot_length[rx_read_slot], &slot[RX_SLOT_OFFSET - 1], pFrame);
+}
+
+void Frame_RxRelease(void)
+{
+	RX_BARRIER();
+	rx_slot_full[rx_read_slot] = 0;
+	rx_read_slot = (rx_read_slot + 1) % FRAME_RX_SLOTS;
+
+	if(rx_stalled) {
+		rx_stalled = 0;
+		Frame_RxResumeCallback();
+	}
+}
+
+__weak void Frame_RxResumeCallback(void) {}
@@ -0,0 +1,106 @@
+/*
+ * ota_journal.c
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: nphuc
+ */
+
+#include "ota_journal.h"
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t size;
+	uint32_t crc;
+} JournalHeader_t;
+
+#define JOURNAL_EMPTY							0xFFFF
+#define JOURNAL_NO_CRC							0xFFFFFFFFU		/* image not named, never resumed */
+#define JOURNAL_HEADER							((const JournalHeader_t *)JOURNAL_ADDRESS)
+
+static uint8_t valid;
+static uint8_t active;			/* Journal_Resume named the image being received */
+static uint16_t committed;
+static uint32_t next_entry;
+
+void Journal_Open(void)
+{
+	valid = (JOURNAL_HEADER->magic == JOURNAL_MAGIC);
+	active = 0;
+	committed = 0;
+	next_entry = JOURNAL_ADDRESS + JOURNAL_HEADER_SIZE;
+	if(!valid) return;
+
+	/* entries only grow, one cut off while being written is ignored */
+	uint32_t image_pages = (JOURNAL_HEADER->size + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE;
+	while(next_entry < JOURNAL_ADDRESS + FLASH_PAGE_SIZE && *(const __vo uint16_t *)next_entry != JOURNAL_EMPTY) {
+		uint16_t entry = *(const __vo uint16_t *)next_entry;
+		if(entry > committed && entry <= image_pages) {
+			committed = entry;
+		}
+		next_entry += 2;
+	}
+}
+
+uint8_t Journal_Pending(void)
+{
+	return valid;
+}
+
+static void Journal_Start(uint32_t size, uint32_t crc)
+{
+	JournalHeader_t header = { JOURNAL_MAGIC, size, crc };
+	valid = (FLASH_ProgramPage(JOURNAL_ADDRESS, (const uint8_t *)&header, sizeof(header)) == FLASH_OK);
+	active = valid;
+	committed = 0;
+	next_entry = JOURNAL_ADDRESS + JOURNAL_HEADER_SIZE;
+}
+
+uint32_t Journal_Resume(uint32_t size, uint32_t crc)
+{
+	if(valid && crc != JOURNAL_NO_CRC && JOURNAL_HEADER->size == size && JOURNAL_HEADER->crc == crc) {
+		active = 1;
+		return committed;
+	}
+
+	Journal_Start(size, crc);
+	return 0;
+}
+
+void Journal_Begin(uint32_t size)
+{
+	if(!active) {
+		Journal_Start(size, JOURNAL_NO_CRC);
+	}
+}
+
+void Journal_Abandon(void)
+{
+	if(active && JOURNAL_HEADER->crc != JOURNAL_NO_CRC) {
+		Journal_Start(JOURNAL_HEADER->size, JOURNAL_NO_CRC);
+	}
+	active = 0;
+}
+
+void Journal_Commit(uint32_t pages)
+{
+	if(!active || pages <= committed || next_entry >= JOURNAL_ADDRESS + FLASH_PAGE_SIZE) return;
+
+	uint16_t entry = pages;
+	if(FLASH_ProgramRange(next_entry, (const uint8_t *)&entry, sizeof(entry)) == FLASH_OK) {
+		committed = entry;
+	}
+	/* a failed entry is skipped, the one before it still holds */
+	next_entry += 2;
+}
+
+void Journal_Clear(void)
+{
+	if(valid) {
+		FLASH_RemovePartition(JOURNAL_ADDRESS, 1);
+	}
+	valid = 0;
+	active = 0;
+	committed = 0;
+	next_entry = JOURNAL_ADDRESS + JOURNAL_HEADER_SIZE;
+}
@@ -0,0 +1,107 @@
+/*
+ * ota_lz.c
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: nphuc
+ */
+
+#include "ota_lz.h"
+
+/* output is handed over in pieces of this size, well below the window */
+#define LZ_FLUSH_SIZE							512
+
+static uint8_t window[LZ_WINDOW_SIZE] __attribute__((aligned(4)));
+static uint32_t head;			/* bytes produced */
+static uint32_t flushed;		/* bytes handed to the output */
+static uint32_t target_size;
+static Lz_Output_t output;
+
+static uint8_t flags;
+static uint8_t flag_count;		/* items left under the current flag byte */
+static uint8_t match_high;
+static uint8_t match_pending;	/* first byte of a match seen */
+static uint8_t status;
+
+static uint8_t Lz_Flush(void)
+{
+	while(flushed < head) {
+		uint32_t start = flushed % LZ_WINDOW_SIZE;
+		uint32_t length = head - flushed;
+		if(length > LZ_WINDOW_SIZE - start) length = LZ_WINDOW_SIZE - start;
+
+		if(output(&window[start], length) != PAGES_OK) return LZ_ERROR;
+		flushed += length;
+	}
+	return LZ_OK;
+}
+
+static inline void Lz_Put(uint8_t byte)
+{
+	window[head % LZ_WINDOW_SIZE] = byte;
+	head++;
+}
+
+static uint8_t Lz_Match(uint32_t offset, uint32_t length)
+{
+	if(offset > head || length > target_size - head) return LZ_ERROR;
+
+	/* byte by byte, a match may overlap the bytes it produces */
+	while(length--) {
+		Lz_Put(window[(head - offset) % LZ_WINDOW_SIZE]);
+	}
+	return LZ_OK;
+}
+
+void Lz_Init(uint32_t size, Lz_Output_t pOutput)
+{
+	head = 0;
+	flushed = 0;
+	target_size = size;
+	output = pOutput;
+	flag_count = 0;
+	match_pending = 0;
+	status = LZ_OK;
+}
+
+uint8_t Lz_Feed(const uint8_t *pData, uint32_t length)
+{
+	while(length > 0 && status == LZ_OK && head < target_size) {
+		uint8_t byte = *pData++;
+		length--;
+
+		if(flag_count == 0) {
+			flags = byte;
+			flag_count = 8;
+		} else if(match_pending) {
+			uint32_t code = ((uint32_t)match_high << 8) | byte;
+			match_pending = 0;
+			flags >>= 1;
+			flag_count--;
+			status = Lz_Match((code >> 5) + 1, (code & 0x1F) + LZ_MIN_MATCH);
+		} else if(flags & 1) {
+			Lz_Put(byte);
+			flags >>= 1;
+			flag_count--;
+		} else {
+			match_high = byte;
+			match_pending = 1;
+		}
+
+		if(status == LZ_OK && head - flushed >= LZ_FLUSH_SIZE) {
+			status = Lz_Flush();
+		}
+	}
+
+	/* bytes after the end of the image are an error */
+	if(length > 0) status = LZ_ERROR;
+	if(status == LZ_OK) status = Lz_Flush();
+	return status;
+}
+
+uint8_t Lz_Done(void)
+{
+	if(status == LZ_OK && head == target_size && flushed == head && !match_pending) {
+		return LZ_OK;
+	}
+	return LZ_ERROR;
+}
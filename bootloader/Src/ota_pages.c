@@ -0,0 +1,269 @@
+/*
+ * ota_pages.c
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: nphuc
+ */
+
+#include "ota_pages.h"
+#include <string.h>
+
+typedef struct
+{
+	uint8_t data[PAGE_SIZE] __attribute__((aligned(4)));
+	uint32_t address;
+	uint16_t length;
+	uint8_t full;			/* handed over for programming */
+} PageBuffer_t;
+
+static PageBuffer_t pages[PAGE_BUFFERS];
+static uint8_t fill_index;
+static uint8_t program_index;
+static uint16_t program_offset;
+static uint8_t pending;			/* erase or half-word write in progress */
+static uint8_t erased;
+static uint8_t status;
+static uint32_t next_address;
+
+/* held back page: erased before any other page is touched, programmed by Pages_Release */
+#define HOLD_NONE								0
+#define HOLD_WAITING							1	/* nothing touched yet */
+#define HOLD_ERASING							2
+#define HOLD_ERASED								3
+
+static uint8_t held_data[PAGE_SIZE] __attribute__((aligned(4)));
+static uint32_t held_address;
+static uint8_t hold_state;
+
+static void Pages_Reset(PageBuffer_t *pPage)
+{
+	/* unused tail of the last page stays erased */
+	memset(pPage->data, 0xFF, PAGE_SIZE);
+	pPage->length = 0;
+	pPage->full = 0;
+}
+
+static void Pages_Submit(void)
+{
+	PageBuffer_t *pPage = &pages[fill_index];
+	pPage->address = next_address;
+	pPage->full = 1;
+	next_address += PAGE_SIZE;
+	fill_index = (fill_index + 1) % PAGE_BUFFERS;
+}
+
+static uint32_t Pages_Free(void)
+{
+	PageBuffer_t *pFill = &pages[fill_index];
+	if(pFill->full) return 0;
+
+	uint32_t space = PAGE_SIZE - pFill->length;
+	if(!pages[(fill_index + 1) % PAGE_BUFFERS].full) {
+		space += PAGE_SIZE;
+	}
+	return space;
+}
+
+void Pages_Init(uint32_t address)
+{
+	for(uint8_t i = 0; i < PAGE_BUFFERS; i++) {
+		Pages_Reset(&pages[i]);
+	}
+	fill_index = 0;
+	program_index = 0;
+	program_offset = 0;
+	pending = 0;
+	erased = 0;
+	status = PAGES_OK;
+	next_address = address;
+	hold_state = HOLD_NONE;
+}
+
+void Pages_Hold(uint32_t address)
+{
+	held_address = address;
+	hold_state = HOLD_WAITING;
+}
+
+uint8_t Pages_Write(const uint8_t *pData, uint32_t length)
+{
+	if(status == PAGES_ERROR) return PAGES_ERROR;
+	if(length > Pages_Free()) return PAGES_BUSY;
+
+	while(length > 0) {
+		PageBuffer_t *pPage = &pages[fill_index];
+		uint32_t chunk = PAGE_SIZE - pPage->length;
+		if(chunk > length) chunk = length;
+
+		memcpy(&pPage->data[pPage->length], pData, chunk);
+		pPage->length += chunk;
+		pData += chunk;
+		length -= chunk;
+
+		if(pPage->length == PAGE_SIZE) {
+			Pages_Submit();
+		}
+	}
+	return PAGES_OK;
+}
+
+void Pages_Flush(void)
+{
+	PageBuffer_t *pPage = &pages[fill_index];
+	if(!pPage->full && pPage->length > 0) {
+		Pages_Submit();
+	}
+}
+
+/* the page is committed, go on with the other buffer */
+static uint8_t Pages_Next(PageBuffer_t *pPage)
+{
+	uint32_t end = pPage->address + PAGE_SIZE;
+	Pages_Reset(pPage);
+	program_offset = 0;
+	erased = 0;
+	program_index = (program_index + 1) % PAGE_BUFFERS;
+	Pages_CommittedCallback(end);
+	return pages[program_index].full ? PAGES_BUSY : PAGES_OK;
+}
+
+uint8_t Pages_Poll(void)
+{
+	if(status == PAGES_ERROR) return PAGES_ERROR;
+
+	PageBuffer_t *pPage = &pages[program_index];
+	if(!pPage->full) return PAGES_OK;
+
+	if(pending) {
+		uint8_t result = FLASH_PollOperation();
+		if(result == FLASH_BUSY) return PAGES_BUSY;
+		pending = 0;
+		if(result == FLASH_ERROR) {
+			FLASH_Lock();
+			status = PAGES_ERROR;
+			return PAGES_ERROR;
+		}
+		if(hold_state == HOLD_ERASING) {
+			hold_state = HOLD_ERASED;
+		} else if(erased) {
+			program_offset += 2;
+		} else {
+			erased = 1;
+		}
+	}
+
+	/* before the first page is touched the held page goes, its current content is kept
+	for a page map that leaves it out */
+	if(hold_state == HOLD_WAITING) {
+		memcpy(held_data, (const void *)held_address, PAGE_SIZE);
+		FLASH_Unlock();
+		FLASH_StartErase(held_address);
+		hold_state = HOLD_ERASING;
+		pending = 1;
+		return PAGES_BUSY;
+	}
+
+	/* the held page only goes to RAM for now */
+	if(hold_state == HOLD_ERASED && pPage->address == held_address) {
+		memcpy(held_data, pPage->data, PAGE_SIZE);
+		FLASH_Lock();
+		return Pages_Next(pPage);
+	}
+
+	/* a page that already holds this content is left alone */
+	if(!erased && memcmp((const void *)pPage->address, pPage->data, pPage->length) == 0) {
+		program_offset = pPage->length;
+		erased = 1;
+	}
+
+	/* erase on first use of the page */
+	if(!erased) {
+		FLASH_Unlock();
+		FLASH_StartErase(pPage->address);
+		pending = 1;
+		return PAGES_BUSY;
+	}
+
+	if(program_offset < pPage->length) {
+		uint16_t halfword = pPage->data[program_offset] | (pPage->data[program_offset + 1] << 8);
+		FLASH_StartProgram(pPage->address + program_offset, halfword);
+		pending = 1;
+		return PAGES_BUSY;
+	}
+
+	/* page done, read it back before the buffer is reused */
+	FLASH_Lock();
+	if(memcmp((const void *)pPage->address, pPage->data, pPage->length) != 0) {
+		status = PAGES_ERROR;
+		return PAGES_ERROR;
+	}
+	return Pages_Next(pPage);
+}
+
+void Pages_Seek(uint32_t address)
+{
+	/* a buffer still waiting to be programmed has its address already */
+	PageBuffer_t *pFill = &pages[fill_index];
+	if(pFill->full || pFill->length == 0) {
+		next_address = address;
+	}
+}
+
+uint32_t Pages_Programmed(void)
+{
+	PageBuffer_t *pPage = &pages[program_index];
+	return pPage->full ? pPage->address : next_address;
+}
+
+const uint8_t *Pages_Source(uint32_t address)
+{
+	if(hold_state >= HOLD_ERASING && address - held_address < PAGE_SIZE) {
+		return &held_data[address - held_address];
+	}
+	return (const uint8_t *)address;
+}
+
+uint32_t Pages_AccumulateCRC(uint32_t address, uint32_t length)
+{
+	uint32_t crc = CRC_GetValue();
+
+	/* a page boundary is a word boundary, so no word straddles flash and RAM */
+	while(length >= 4) {
+		uint32_t chunk = PAGE_SIZE - address % PAGE_SIZE;
+		if(chunk > length) chunk = length;
+		chunk &= ~3;
+
+		crc = CRC_AccumulateBytes(Pages_Source(address), chunk);
+		address += chunk;
+		length -= chunk;
+	}
+	return crc;
+}
+
+uint32_t Pages_CRC32(uint32_t address, uint32_t length)
+{
+	uint32_t words = length & ~3;
+
+	CRC_Reset();
+	uint32_t crc = Pages_AccumulateCRC(address, words);
+	return CRC_UpdateBytes(crc, Pages_Source(address + words), length - words);
+}
+
+uint8_t Pages_Release(void)
+{
+	if(hold_state < HOLD_ERASING) {
+		hold_state = HOLD_NONE;
+		return PAGES_OK;
+	}
+	if(hold_state != HOLD_ERASED) return PAGES_ERROR;
+
+	/* the page is erased, only programmed here */
+	hold_state = HOLD_NONE;
+	if(FLASH_ProgramRange(held_address, held_data, PAGE_SIZE) != FLASH_OK ||
+	   memcmp((const void *)held_address, held_data, PAGE_SIZE) != 0) {
+		return PAGES_ERROR;
+	}
+	return PAGES_OK;
+}
+
+__weak void Pages_CommittedCallback(uint32_t end) {}
@@ -19,6 +19,9 @@
 
 #define FLASH_BASEADDR		0x08000000U
 #define SCB_BASEADDR		0xE000ED00U
+#define DWT_BASEADDR		0xE0001000U
+#define SYSTICK_BASEADDR	0xE000E010U
+#define DEMCR_ADDR			0xE000EDFCU
 
 /*
  * AHBx and APBx Bus Peripheral base addresses
@@ -33,7 +36,9 @@
  * Base addresses of peripherals which are hanging on AHB bus
  */
 
+#define DMA1_BASEADDR		(AHBPERIPH_BASE + 0x8000)
 #define RCC_BASEADDR		(AHBPERIPH_BASE + 0x9000)
+#define CRC_BASEADDR		(AHBPERIPH_BASE + 0xB000)
 
 /* Base Address of peripheral which are hanging on APB2 */
 #define GPIOA_BASEADDR					(APB2PERIPH_BASE + 0x0800)
@@ -52,8 +57,10 @@
 #include "stm32f103xx_core_driver.h"
 #include "stm32f103xx_rcc_driver.h"
 #include "stm32f103xx_gpio_driver.h"
+#include "stm32f103xx_dma_driver.h"
 #include "stm32f103xx_usart_driver.h"
 #include "stm32f103xx_flash_driver.h"
+#include "stm32f103xx_crc_driver.h"
 #include "stm32f103xx_bootloader.h"
 
 #endif /* INC_STM32F103XX_H_ */
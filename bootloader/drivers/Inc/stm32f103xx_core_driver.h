@@ -10,10 +10,12 @@
 
 #include "stm32f103xx.h"
 
+#define IRQ_NO_DMA1_CH5		15
 #define IRQ_NO_USART1		37
 
 #define AIRCR_VECTKEY     	16
 #define AIRCR_SYSRESETREQ	2
+#define SCB_ICSR_PENDSTCLR	25
 
 /* peripheral register definition structure for NVIC */
 typedef struct{
@@ -51,8 +53,50 @@ typedef struct{
 	__vo uint32_t AFSR;					
 } SCB_TypdeDef_t;
 
+/* data watchpoint and trace unit, only the cycle counter is used */
+typedef struct{
+	__vo uint32_t CTRL;
+	__vo uint32_t CYCCNT;
+} DWT_TypeDef_t;
+
+/* system timer */
+typedef struct{
+	__vo uint32_t CTRL;
+	__vo uint32_t LOAD;
+	__vo uint32_t VAL;
+	__vo uint32_t CALIB;
+} SysTick_TypeDef_t;
+
 #define NVIC				((NVIC_TypeDef_t*)NVIC_BASE_ADDR)
 #define SCB					((SCB_TypdeDef_t*)SCB_BASEADDR)
+#define DWT					((DWT_TypeDef_t*)DWT_BASEADDR)
+#define SYSTICK				((SysTick_TypeDef_t*)SYSTICK_BASEADDR)
+#define DEMCR				(*(__vo uint32_t*)DEMCR_ADDR)
+
+#define DEMCR_TRCENA		24
+#define DWT_CTRL_CYCCNTENA	0
+
+#define SYSTICK_CTRL_ENABLE		0
+#define SYSTICK_CTRL_TICKINT	1
+#define SYSTICK_CTRL_CLKSOURCE	2
+
+/*
+ * Core instructions. The host build (bootloader/host) runs the drivers on a
+ * simulated core and provides these as functions
+ */
+#ifndef HOST_SIM
+#define __disable_irq()		__asm volatile ("cpsid i")
+#define __enable_irq()		__asm volatile ("cpsie i")
+#define __WFI()				__asm volatile ("wfi")
+#define __DSB()				__asm volatile ("dsb sy")
+#define __set_MSP(topOfStack)	__asm volatile ("MSR msp, %0" : : "r" (topOfStack) : )
+#else
+void __disable_irq(void);
+void __enable_irq(void);
+void __WFI(void);
+void __DSB(void);
+void __set_MSP(uint32_t topOfStack);
+#endif
 
 /*
  * IQR configuring and handling
@@ -60,4 +104,35 @@ typedef struct{
 
 void NVIC_InterruptConfig(uint8_t IRQNumber, uint8_t EnorDi);
 
+/* run the handler as if the interrupt had fired */
+void NVIC_SetPending(uint8_t IRQNumber);
+
+/*
+ * Cycle counter, wraps after 2^32 core clocks
+ */
+
+void DWT_CycleCounterInit(void);
+
+uint32_t DWT_GetCycles(void);
+
+/*
+ * Millisecond tick from SysTick, wraps after 2^32 ms. Deadlines are compared
+ * with wrap-around, so they work as long as they are less than 24 days ahead
+ */
+
+void SysTick_Init(uint32_t HCLK);
+
+void SysTick_DeInit(void);
+
+uint32_t SysTick_GetTicks(void);
+
+uint32_t SysTick_Deadline(uint32_t ms);
+
+uint8_t SysTick_Expired(uint32_t deadline);
+
+/* sleep until the next interrupt, at the latest the next tick, unless *pEvent
+is already set. It is checked with interrupts masked, so an interrupt setting
+it just before the WFI still ends the sleep */
+void SysTick_SleepUnless(const __vo uint8_t *pEvent);
+
 #endif /* INC_STM32F103XX_CORE_DRIVER_H_ */
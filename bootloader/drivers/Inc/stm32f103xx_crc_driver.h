@@ -0,0 +1,51 @@
+/*
+ * stm32f103xx_crc_driver.h
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: nphuc
+ */
+
+#ifndef INC_STM32F103XX_CRC_DRIVER_H_
+#define INC_STM32F103XX_CRC_DRIVER_H_
+
+#include "stm32f103xx.h"
+
+#define CRC									((CRC_TypeDef_t*)CRC_BASEADDR)
+
+/*
+ * Clock enable macros for CRC peripheral
+ */
+#define CRC_PCLK_EN()						(RCC->AHBENR |= (1 << 6))
+#define CRC_PCLK_DI()						(RCC->AHBENR &= ~(1 << 6))
+
+#define CRC_CR_RESET						0
+
+#define CRC_INIT_VALUE						0xFFFFFFFF
+
+/* peripheral register definition structure for CRC */
+typedef struct{
+	__vo uint32_t DR;
+	__vo uint32_t IDR;
+	__vo uint32_t CR;
+} CRC_TypeDef_t;
+
+/*
+ * The unit computes CRC-32/MPEG-2 (poly 0x04C11DB7, init 0xFFFFFFFF, no
+ * reflection) over 32-bit words, most significant byte first. It can neither
+ * take single bytes nor start from another value than CRC_INIT_VALUE.
+ */
+void CRC_PeriClockControl(uint8_t EnorDi);
+
+void CRC_Reset(void);
+
+uint32_t CRC_Accumulate(const uint32_t *pData, uint32_t words);
+
+/* bytes in memory order, length / 4 whole words from a word aligned buffer */
+uint32_t CRC_AccumulateBytes(const uint8_t *pData, uint32_t length);
+
+uint32_t CRC_GetValue(void);
+
+/* continue crc in software over the 1 to 3 trailing bytes the unit cannot take */
+uint32_t CRC_UpdateBytes(uint32_t crc, const uint8_t *pData, uint32_t length);
+
+#endif /* INC_STM32F103XX_CRC_DRIVER_H_ */
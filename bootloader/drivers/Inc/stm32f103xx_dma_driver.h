@@ -0,0 +1,121 @@
+/*
+ * stm32f103xx_dma_driver.h
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: nphuc
+ */
+
+#ifndef INC_STM32F103XX_DMA_DRIVER_H_
+#define INC_STM32F103XX_DMA_DRIVER_H_
+
+#include "stm32f103xx.h"
+
+#define DMA1								((DMA_TypeDef_t*)DMA1_BASEADDR)
+
+/*
+ * Clock enable macros for DMAx peripheral
+ */
+#define DMA1_PCLK_EN()						(RCC->AHBENR |= (1 << 0))
+
+/*
+ *@DMA_Direction
+ *Possible options for DMA_Direction
+ */
+#define DMA_DIR_PERIPH_TO_MEM				0
+#define DMA_DIR_MEM_TO_PERIPH				1
+
+/*
+ *@DMA_Mode
+ *Possible options for DMA_Mode
+ */
+#define DMA_MODE_NORMAL						0
+#define DMA_MODE_CIRCULAR					1
+
+/*
+ *@DMA_Priority
+ *Possible options for DMA_Priority
+ */
+#define DMA_PRIORITY_LOW					0
+#define DMA_PRIORITY_MEDIUM					1
+#define DMA_PRIORITY_HIGH					2
+#define DMA_PRIORITY_VERY_HIGH				3
+
+/*
+ *@DMA_Interrupts
+ *Bit mask of interrupts enabled for the channel
+ */
+#define DMA_IT_NONE							0
+#define DMA_IT_TC							(1 << DMA_CCR_TCIE)
+#define DMA_IT_HT							(1 << DMA_CCR_HTIE)
+#define DMA_IT_TE							(1 << DMA_CCR_TEIE)
+
+/* peripheral register definition structure for DMA */
+typedef struct{
+	__vo uint32_t CCR;
+	__vo uint32_t CNDTR;
+	__vo uint32_t CPAR;
+	__vo uint32_t CMAR;
+	__vo uint32_t RESERVED;
+} DMA_Channel_TypeDef_t;
+
+typedef struct{
+	__vo uint32_t ISR;
+	__vo uint32_t IFCR;
+	DMA_Channel_TypeDef_t CH[7];
+} DMA_TypeDef_t;
+
+typedef struct
+{
+	uint8_t DMA_Direction;
+	uint8_t DMA_Mode;
+	uint8_t DMA_Priority;
+	uint8_t DMA_Interrupts;
+} DMA_Config_t;
+
+typedef struct
+{
+	DMA_TypeDef_t *pDMAx;
+	uint8_t Channel;				/* 1..7 as in the reference manual */
+	DMA_Config_t DMA_Config;
+} DMA_Handle_t;
+
+/*
+ * DMA flags
+ */
+#define DMA_CCR_EN							0
+#define DMA_CCR_TCIE						1
+#define DMA_CCR_HTIE						2
+#define DMA_CCR_TEIE						3
+#define DMA_CCR_DIR							4
+#define DMA_CCR_CIRC						5
+#define DMA_CCR_PINC						6
+#define DMA_CCR_MINC						7
+#define DMA_CCR_PSIZE						8
+#define DMA_CCR_MSIZE						10
+#define DMA_CCR_PL							12
+#define DMA_CCR_MEM2MEM						14
+
+/* ISR/IFCR flags of one channel, shifted by 4 * (Channel - 1) */
+#define DMA_FLAG_GIF						0
+#define DMA_FLAG_TCIF						1
+#define DMA_FLAG_HTIF						2
+#define DMA_FLAG_TEIF						3
+
+
+void DMA_PeriClockControl(DMA_TypeDef_t *pDMAx, uint8_t EnorDi);
+
+void DMA_Init(DMA_Handle_t *pDMAHandle);
+
+/* byte wide transfers, memory address incremented, peripheral address fixed */
+void DMA_Start(DMA_Handle_t *pDMAHandle, uint32_t PeriphAddress, uint32_t MemAddress, uint16_t length);
+
+void DMA_Stop(DMA_Handle_t *pDMAHandle);
+
+/* transfers left before the buffer wraps (circular) or completes (normal) */
+uint16_t DMA_GetCounter(DMA_Handle_t *pDMAHandle);
+
+uint8_t DMA_GetFlagStatus(DMA_Handle_t *pDMAHandle, uint8_t flag);
+
+void DMA_ClearFlag(DMA_Handle_t *pDMAHandle, uint8_t flag);
+
+#endif /* INC_STM32F103XX_DMA_DRIVER_H_ */
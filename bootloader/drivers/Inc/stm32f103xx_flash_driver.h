@@ -12,10 +12,15 @@
 
 #define FLASH						((FLASH_TypeDef_t*)(FLASH_BASEADDR + 0x38022000U))
 
+#define FLASH_ACR_LATENCY			0
+#define FLASH_ACR_HLFCYA			3
+#define FLASH_ACR_PRFTBE			4
+#define FLASH_ACR_PRFTBS			5
+
 #define FLASH_SR_BSY				0
-#define FLASH_SR_PGERR				1
-#define FLASH_SR_WRPRTERR			2
-#define FLASH_SR_EOP				3
+#define FLASH_SR_PGERR				2
+#define FLASH_SR_WRPRTERR			4
+#define FLASH_SR_EOP				5
 
 #define FLASH_CR_PG					0
 #define FLASH_CR_PER				1
@@ -28,8 +33,12 @@
 #define FLASH_CR_ERRIE				10
 #define FLASH_CR_EOPIE				12
 
+#define FLASH_PAGE_SIZE				0x400
+#define FLASH_END					(FLASH_BASEADDR + 0x20000U)
+
 #define FLASH_OK					1
 #define FLASH_ERROR					0
+#define FLASH_BUSY					2
 
 /* peripheral register definition structure for FLASH */
 
@@ -45,6 +54,9 @@ typedef struct{
 	__vo uint32_t WRPR;
 } FLASH_TypeDef_t;
 
+/* wait states and prefetch buffer for the given HCLK, set before raising the clock */
+void FLASH_SetLatency(uint32_t HCLK);
+
 void FLASH_Unlock();
 
 void FLASH_Lock();
@@ -57,4 +69,23 @@ void FLASH_Erase(uint32_t PageAdress);
 
 void FLASH_RemovePartition(uint32_t address, uint8_t numOfPage);
 
+/*
+ * Non-blocking programming: start one half-word or a page erase, then poll until
+ * it is no longer FLASH_BUSY. Flash must be unlocked by the caller
+ */
+void FLASH_StartProgram(uint32_t address, uint16_t data);
+
+void FLASH_StartErase(uint32_t PageAddress);
+
+uint8_t FLASH_PollOperation(void);
+
+/*
+ * Blocking bulk programming in half-words, any byte length (an odd last byte is
+ * padded with 0xFF). Unlocks once and always locks again; the target must be erased.
+ * FLASH_ProgramPage erases the page first, length up to FLASH_PAGE_SIZE.
+ */
+uint8_t FLASH_ProgramRange(uint32_t address, const uint8_t *pData, uint32_t length);
+
+uint8_t FLASH_ProgramPage(uint32_t PageAddress, const uint8_t *pData, uint32_t length);
+
 #endif /* INC_STM32F103XX_FLASH_DRIVER_H_ */
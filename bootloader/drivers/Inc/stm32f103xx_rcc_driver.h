@@ -20,6 +20,74 @@ typedef struct{
 	__vo uint32_t CFGR2;
 } RCC_TypeDef_t;
 
+typedef struct
+{
+	uint8_t RCC_ClockSource;
+	uint8_t RCC_PLLMul;
+	uint16_t RCC_AHBPrescaler;
+	uint8_t RCC_APB1Prescaler;
+	uint8_t RCC_APB2Prescaler;
+} RCC_Config_t;
+
 #define RCC			((RCC_TypeDef_t*)(RCC_BASEADDR))
 
+/* ------------------------ CONFIGURATION OPTIONS ------------------------ */
+#define HSI_VALUE					8000000UL
+#define HSE_VALUE					8000000UL	/* crystal on the board */
+
+/*
+ *@RCC_ClockSource
+ *Possible options for RCC_ClockSource, the PLL runs from HSI/2 or HSE
+ */
+#define RCC_CLK_SRC_HSI				0
+#define RCC_CLK_SRC_HSE				1
+#define RCC_CLK_SRC_PLL_HSI			2
+#define RCC_CLK_SRC_PLL_HSE			3
+
+/*
+ *@RCC_PLLMul: 2..16
+ *@RCC_AHBPrescaler: 1, 2, 4 .. 512
+ *@RCC_APBxPrescaler: 1, 2, 4, 8, 16 - APB1 must not exceed 36 MHz
+ */
+
+#define RCC_OK						1
+#define RCC_ERROR					0
+
+/* ------------------------ REGISTER BITS ------------------------ */
+#define RCC_CR_HSION				0
+#define RCC_CR_HSIRDY				1
+#define RCC_CR_HSEON				16
+#define RCC_CR_HSERDY				17
+#define RCC_CR_HSEBYP				18
+#define RCC_CR_CSSON				19
+#define RCC_CR_PLLON				24
+#define RCC_CR_PLLRDY				25
+
+#define RCC_CFGR_SW					0
+#define RCC_CFGR_SWS				2
+#define RCC_CFGR_HPRE				4
+#define RCC_CFGR_PPRE1				8
+#define RCC_CFGR_PPRE2				11
+#define RCC_CFGR_PLLSRC				16
+#define RCC_CFGR_PLLXTPRE			17
+#define RCC_CFGR_PLLMUL				18
+
+#define RCC_SW_HSI					0
+#define RCC_SW_HSE					1
+#define RCC_SW_PLL					2
+
+/* ------------------------ API ------------------------ */
+uint8_t RCC_ClockConfig(RCC_Config_t *pRCCConfig);
+
+/* back to the reset clock tree (HSI, no prescalers) before starting the application */
+void RCC_DeInit(void);
+
+uint32_t RCC_GetSYSCLK(void);
+
+uint32_t RCC_GetHCLK(void);
+
+uint32_t RCC_GetPCLK1(void);
+
+uint32_t RCC_GetPCLK2(void);
+
 #endif
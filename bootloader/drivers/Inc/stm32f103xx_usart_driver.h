@@ -108,6 +108,8 @@ typedef struct
 	uint32_t RxLength;
 	uint8_t TxState;
 	uint8_t RxState;
+	DMA_Handle_t RxDMA;
+	uint32_t RxReadIndex;
 } USART_Handle_t;
 
 extern USART_Handle_t uart1;
@@ -169,6 +171,7 @@ extern USART_Handle_t uart1;
  */
 #define USART_BUSY_RX 						1
 #define USART_BUSY_TX 						2
+#define USART_BUSY_RX_DMA 					3
 #define USART_READY 						0
 
 
@@ -183,14 +186,40 @@ void USART_SendData(USART_Handle_t *pUSARTHandle, uint8_t *pTxBuffer, uint32_t l
 
 void USART_SetBaudRate(USART_TypeDef_t *pUSARTx, uint32_t BaudRate);
 
+/* rate the USART really runs at when asked for BaudRate, 0 if it cannot be reached */
+uint32_t USART_GetActualBaudRate(USART_TypeDef_t *pUSARTx, uint32_t BaudRate);
+
 uint8_t USART_ReceiveDataIT(USART_Handle_t *pUSARTHandle,uint8_t *pRxBuffer, uint32_t length);
 
+/*
+ * Continuous reception (8 bit data only): DMA1 channel 5 fills pRxBuffer as a ring
+ * and never stops. USART_ReceptionEventsCallback runs when the line goes idle and
+ * when the ring is half/completely filled; the bytes are taken out with USART_ReadData.
+ * The application has to read faster than `length` bytes arrive, an overrun of the
+ * ring is not detected.
+ */
+uint8_t USART_ReceiveDataDMA(USART_Handle_t *pUSARTHandle, uint8_t *pRxBuffer, uint32_t length);
+
+void USART_AbortReceiveDMA(USART_Handle_t *pUSARTHandle);
+
+uint32_t USART_RxAvailable(USART_Handle_t *pUSARTHandle);
+
+uint32_t USART_ReadData(USART_Handle_t *pUSARTHandle, uint8_t *pBuffer, uint32_t length);
+
+/* zero-copy reading: the received bytes from the read position up to the end of
+the ring, in place, and how many of them were used */
+uint32_t USART_PeekData(USART_Handle_t *pUSARTHandle, uint8_t **ppData);
+
+void USART_SkipData(USART_Handle_t *pUSARTHandle, uint32_t length);
+
 /*
  * IRQ Configuation and ISR Handling
  */
 
 void USART_IRQHandling(USART_Handle_t *pUSARTHandle);
 
+void USART_DMA_IRQHandling(USART_Handle_t *pUSARTHandle);
+
 __weak void USART_ReceptionEventsCallback(USART_Handle_t *pUSARTHandle);
 
 #endif /* INC_STM32F103XX_USART_DRIVER_H_ */
@@ -12,26 +12,26 @@
 
 void Bootloader_Reset(){
     /* Memory barriers */
-    __asm volatile ("dsb sy");
+    __DSB();
 
     /* Ghi thanh ghi */
     SCB->AIRCR = (0x5FA << AIRCR_VECTKEY) |
                 (1 << AIRCR_SYSRESETREQ);
 
-    __asm volatile ("dsb sy");
+    __DSB();
 }
 
 void Bootloader_JumpApp(uint32_t appAddress){
-	__asm volatile ("cpsid i");
+	__disable_irq();
 
 	uint32_t appStack = *(volatile uint32_t*)appAddress;
 	void (*appFunction)() = (void (*)())*(uint32_t*)(appAddress + 4);
 
-	__asm volatile ("MSR msp, %0" : : "r" (appStack) : );
+	__set_MSP(appStack);
 
 	SCB->VTOR = appAddress;
 
-	__asm volatile ("cpsie i");
+	__enable_irq();
 
 	appFunction();
 }
@@ -20,3 +20,65 @@ void NVIC_InterruptConfig(uint8_t IRQNumber, uint8_t EnorDi){ // config IRQ numb
 		NVIC->ICER[IRQNumber/32] |= (1 << (IRQNumber % 32));
 	}
 }
+
+void NVIC_SetPending(uint8_t IRQNumber){
+	NVIC->ISPR[IRQNumber/32] = (1 << (IRQNumber % 32));
+}
+
+/*
+ * Cycle counter
+ */
+
+void DWT_CycleCounterInit(void){
+	DEMCR |= (1 << DEMCR_TRCENA);
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= (1 << DWT_CTRL_CYCCNTENA);
+}
+
+uint32_t DWT_GetCycles(void){
+	return DWT->CYCCNT;
+}
+
+/*
+ * Millisecond tick
+ */
+
+static __vo uint32_t systick_ticks;
+
+void SysTick_Init(uint32_t HCLK){
+	SYSTICK->CTRL = 0;
+	SYSTICK->LOAD = HCLK / 1000 - 1;
+	SYSTICK->VAL = 0;
+	SYSTICK->CTRL = (1 << SYSTICK_CTRL_CLKSOURCE) | (1 << SYSTICK_CTRL_TICKINT) | (1 << SYSTICK_CTRL_ENABLE);
+}
+
+void SysTick_DeInit(void){
+	SYSTICK->CTRL = 0;
+	SYSTICK->VAL = 0;
+	/* a tick that came in meanwhile must not fire in the application */
+	SCB->ICSR = (1 << SCB_ICSR_PENDSTCLR);
+}
+
+uint32_t SysTick_GetTicks(void){
+	return systick_ticks;
+}
+
+uint32_t SysTick_Deadline(uint32_t ms){
+	return systick_ticks + ms;
+}
+
+uint8_t SysTick_Expired(uint32_t deadline){
+	return (int32_t)(systick_ticks - deadline) >= 0;
+}
+
+void SysTick_SleepUnless(const __vo uint8_t *pEvent){
+	__disable_irq();
+	if(!*pEvent){
+		__WFI();
+	}
+	__enable_irq();
+}
+
+void SysTick_Handler(void){
+	systick_ticks++;
+}
@@ -0,0 +1,65 @@
+/*
+ * stm32f103xx_crc_driver.c
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: nphuc
+ */
+
+#include "stm32f103xx.h"
+
+/* same polynomial as the unit, nibble table */
+static const uint32_t CRC_Table[16] = {
+	0x00000000, 0x04C11DB7, 0x09823B6E, 0x0D4326D9, 0x130476DC, 0x17C56B6B, 0x1A864DB2, 0x1E475005,
+	0x2608EDB8, 0x22C9F00F, 0x2F8AD6D6, 0x2B4BCB61, 0x350C9B64, 0x31CD86D3, 0x3C8EA00A, 0x384FBDBD
+};
+
+/*
+ * Peripheral clock setup
+ */
+void CRC_PeriClockControl(uint8_t EnorDi)
+{
+	if (EnorDi == ENABLE)
+		CRC_PCLK_EN();
+	else
+		CRC_PCLK_DI();
+}
+
+void CRC_Reset(void)
+{
+	CRC_PeriClockControl(ENABLE);
+	CRC->CR = (1 << CRC_CR_RESET);
+}
+
+uint32_t CRC_Accumulate(const uint32_t *pData, uint32_t words)
+{
+	while (words--) {
+		CRC->DR = *pData++;
+	}
+	return CRC->DR;
+}
+
+uint32_t CRC_AccumulateBytes(const uint8_t *pData, uint32_t length)
+{
+	const uint32_t *pWord = (const uint32_t *)pData;
+
+	/* the unit takes the most significant byte first, memory holds it last */
+	for (uint32_t words = length / 4; words > 0; words--) {
+		CRC->DR = __builtin_bswap32(*pWord++);
+	}
+	return CRC->DR;
+}
+
+uint32_t CRC_GetValue(void)
+{
+	return CRC->DR;
+}
+
+uint32_t CRC_UpdateBytes(uint32_t crc, const uint8_t *pData, uint32_t length)
+{
+	while (length--) {
+		crc = (crc << 4) ^ CRC_Table[(crc >> 28) ^ (*pData >> 4)];
+		crc = (crc << 4) ^ CRC_Table[(crc >> 28) ^ (*pData & 0x0F)];
+		pData++;
+	}
+	return crc;
+}
@@ -0,0 +1,85 @@
+/*
+ * stm32f103xx_dma_driver.c
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: nphuc
+ */
+
+#include "stm32f103xx.h"
+
+static DMA_Channel_TypeDef_t *DMA_GetChannel(DMA_Handle_t *pDMAHandle)
+{
+	return &pDMAHandle->pDMAx->CH[pDMAHandle->Channel - 1];
+}
+
+/*
+ * Peripheral clock setup
+ */
+void DMA_PeriClockControl(DMA_TypeDef_t *pDMAx, uint8_t EnorDi)
+{
+	if (!EnorDi) return;
+	if (pDMAx == DMA1)
+		DMA1_PCLK_EN();
+}
+
+/*
+ * Init and De-Init
+ */
+void DMA_Init(DMA_Handle_t *pDMAHandle)
+{
+	DMA_PeriClockControl(pDMAHandle->pDMAx, ENABLE);
+
+	DMA_Channel_TypeDef_t *pChannel = DMA_GetChannel(pDMAHandle);
+	uint32_t reg = 0;
+
+	/* channel must be disabled while it is configured */
+	pChannel->CCR &= ~(1 << DMA_CCR_EN);
+
+	if (pDMAHandle->DMA_Config.DMA_Direction == DMA_DIR_MEM_TO_PERIPH)
+		reg |= (1 << DMA_CCR_DIR);
+	if (pDMAHandle->DMA_Config.DMA_Mode == DMA_MODE_CIRCULAR)
+		reg |= (1 << DMA_CCR_CIRC);
+
+	/* 8 bit peripheral and memory size, walk through the memory buffer */
+	reg |= (1 << DMA_CCR_MINC);
+	reg |= (pDMAHandle->DMA_Config.DMA_Priority << DMA_CCR_PL);
+	reg |= pDMAHandle->DMA_Config.DMA_Interrupts;
+
+	pChannel->CCR = reg;
+}
+
+void DMA_Start(DMA_Handle_t *pDMAHandle, uint32_t PeriphAddress, uint32_t MemAddress, uint16_t length)
+{
+	DMA_Channel_TypeDef_t *pChannel = DMA_GetChannel(pDMAHandle);
+
+	pChannel->CCR &= ~(1 << DMA_CCR_EN);
+	DMA_ClearFlag(pDMAHandle, DMA_FLAG_GIF);
+
+	pChannel->CPAR = PeriphAddress;
+	pChannel->CMAR = MemAddress;
+	pChannel->CNDTR = length;
+
+	pChannel->CCR |= (1 << DMA_CCR_EN);
+}
+
+void DMA_Stop(DMA_Handle_t *pDMAHandle)
+{
+	DMA_GetChannel(pDMAHandle)->CCR &= ~(1 << DMA_CCR_EN);
+	DMA_ClearFlag(pDMAHandle, DMA_FLAG_GIF);
+}
+
+uint16_t DMA_GetCounter(DMA_Handle_t *pDMAHandle)
+{
+	return (uint16_t)DMA_GetChannel(pDMAHandle)->CNDTR;
+}
+
+uint8_t DMA_GetFlagStatus(DMA_Handle_t *pDMAHandle, uint8_t flag)
+{
+	return (pDMAHandle->pDMAx->ISR >> (4 * (pDMAHandle->Channel - 1) + flag)) & 1;
+}
+
+void DMA_ClearFlag(DMA_Handle_t *pDMAHandle, uint8_t flag)
+{
+	/* IFCR is write 1 to clear, clearing GIF clears all flags of the channel */
+	pDMAHandle->pDMAx->IFCR = (1 << (4 * (pDMAHandle->Channel - 1) + flag));
+}
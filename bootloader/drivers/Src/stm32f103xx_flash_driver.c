@@ -7,6 +7,14 @@
 
 #include "stm32f103xx_flash_driver.h"
 
+void FLASH_SetLatency(uint32_t HCLK){
+	uint32_t latency = 2;
+	if(HCLK <= 24000000) latency = 0;
+	else if(HCLK <= 48000000) latency = 1;
+
+	FLASH->ACR = (FLASH->ACR & ~(7 << FLASH_ACR_LATENCY)) | (latency << FLASH_ACR_LATENCY) | (1 << FLASH_ACR_PRFTBE);
+}
+
 void FLASH_Unlock(){
     FLASH->KEYR = 0x45670123;
     FLASH->KEYR = 0xCDEF89AB;
@@ -20,7 +28,10 @@ uint8_t FLASH_WriteData(uint32_t PageAddress, uint32_t *pBuffer, uint16_t length
 	FLASH_Unlock();
     while(length > 0){
     	uint8_t currentPage = (PageAddress / 0x0400) & 0x0FF;
-    	if(currentPage > 127) return FLASH_ERROR;
+    	if(currentPage > 127){
+    		FLASH_Lock();
+    		return FLASH_ERROR;
+    	}
 
     	uint32_t value = (*pBuffer);
         uint16_t lower_half = (uint16_t)(value & 0xFFFF);
@@ -39,8 +50,10 @@ uint8_t FLASH_WriteData(uint32_t PageAddress, uint32_t *pBuffer, uint16_t length
         while (FLASH->SR & FLASH_SR_BSY);
         FLASH->CR &= ~(1 << FLASH_CR_PG);
 
-        if(((FLASH->SR >> FLASH_SR_PGERR) & 1) || (FLASH->SR >> FLASH_SR_WRPRTERR) & 1)
+        if(((FLASH->SR >> FLASH_SR_PGERR) & 1) || (FLASH->SR >> FLASH_SR_WRPRTERR) & 1){
+            FLASH_Lock();
             return FLASH_ERROR;
+        }
 
         /* step to next address */
         pBuffer++;
@@ -91,3 +104,92 @@ void FLASH_RemovePartition(uint32_t address, uint8_t numOfPage){
 	}
 	FLASH_Lock();
 }
+
+void FLASH_StartProgram(uint32_t address, uint16_t data){
+	/* Clear flags */
+	FLASH->SR |= (1 << FLASH_SR_EOP) | (1 << FLASH_SR_PGERR) | (1 << FLASH_SR_WRPRTERR);
+
+	FLASH->CR |= (1 << FLASH_CR_PG);
+	*(__vo uint16_t *)address = data;
+}
+
+void FLASH_StartErase(uint32_t PageAddress){
+	FLASH->SR |= (1 << FLASH_SR_EOP) | (1 << FLASH_SR_PGERR) | (1 << FLASH_SR_WRPRTERR);
+
+	FLASH->CR |= (1 << FLASH_CR_PER);
+	FLASH->AR = PageAddress;
+	FLASH->CR |= (1 << FLASH_CR_STRT);
+}
+
+uint8_t FLASH_PollOperation(void){
+	if((FLASH->SR >> FLASH_SR_BSY) & 1) return FLASH_BUSY;
+
+	FLASH->CR &= ~((1 << FLASH_CR_PG) | (1 << FLASH_CR_PER));
+	if(((FLASH->SR >> FLASH_SR_PGERR) & 1) || ((FLASH->SR >> FLASH_SR_WRPRTERR) & 1))
+		return FLASH_ERROR;
+	return FLASH_OK;
+}
+
+static void FLASH_WaitBusy(void){
+	while((FLASH->SR >> FLASH_SR_BSY) & 1);
+}
+
+static uint8_t FLASH_CheckErrors(void){
+	if(FLASH->SR & ((1 << FLASH_SR_PGERR) | (1 << FLASH_SR_WRPRTERR)))
+		return FLASH_ERROR;
+	return FLASH_OK;
+}
+
+/* PG stays set for the whole run, errors are checked at the end of every page */
+static uint8_t FLASH_ProgramRun(uint32_t address, const uint8_t *pData, uint32_t length){
+	uint8_t status = FLASH_OK;
+
+	FLASH->SR = (1 << FLASH_SR_EOP) | (1 << FLASH_SR_PGERR) | (1 << FLASH_SR_WRPRTERR);
+	FLASH->CR |= (1 << FLASH_CR_PG);
+
+	while(length > 0){
+		uint16_t halfword = pData[0] | ((length > 1 ? pData[1] : 0xFF) << 8);
+		*(__vo uint16_t *)address = halfword;
+		FLASH_WaitBusy();
+
+		address += 2;
+		pData += 2;
+		length = (length > 2) ? length - 2 : 0;
+
+		if((address % FLASH_PAGE_SIZE) == 0 || length == 0){
+			status = FLASH_CheckErrors();
+			if(status != FLASH_OK) break;
+		}
+	}
+
+	FLASH->CR &= ~(1 << FLASH_CR_PG);
+	return status;
+}
+
+uint8_t FLASH_ProgramRange(uint32_t address, const uint8_t *pData, uint32_t length){
+	if((address & 1) || address < FLASH_BASEADDR || address + length > FLASH_END) return FLASH_ERROR;
+
+	FLASH_Unlock();
+	uint8_t status = FLASH_ProgramRun(address, pData, length);
+	FLASH_Lock();
+	return status;
+}
+
+uint8_t FLASH_ProgramPage(uint32_t PageAddress, const uint8_t *pData, uint32_t length){
+	if((PageAddress % FLASH_PAGE_SIZE) || length > FLASH_PAGE_SIZE ||
+	   PageAddress < FLASH_BASEADDR || PageAddress + FLASH_PAGE_SIZE > FLASH_END) return FLASH_ERROR;
+
+	FLASH_Unlock();
+	FLASH->SR = (1 << FLASH_SR_EOP) | (1 << FLASH_SR_PGERR) | (1 << FLASH_SR_WRPRTERR);
+	FLASH->CR |= (1 << FLASH_CR_PER);
+	FLASH->AR = PageAddress;
+	FLASH->CR |= (1 << FLASH_CR_STRT);
+	FLASH_WaitBusy();
+	FLASH->CR &= ~(1 << FLASH_CR_PER);
+
+	uint8_t status = FLASH_CheckErrors();
+	if(status == FLASH_OK && length > 0)
+		status = FLASH_ProgramRun(PageAddress, pData, length);
+	FLASH_Lock();
+	return status;
+}
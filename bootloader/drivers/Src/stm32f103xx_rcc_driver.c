@@ -0,0 +1,166 @@
+/*
+ * stm32f103xx_rcc_driver.c
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: nphuc
+ */
+
+#include "stm32f103xx.h"
+
+#define RCC_STARTUP_TIMEOUT			0x10000
+
+static const uint16_t AHB_Prescaler[8] = {2, 4, 8, 16, 64, 128, 256, 512};
+static const uint8_t APB_Prescaler[4] = {2, 4, 8, 16};
+
+static uint8_t RCC_WaitFlag(__vo uint32_t *pReg, uint8_t bit, uint8_t value)
+{
+	for (uint32_t i = 0; i < RCC_STARTUP_TIMEOUT; i++) {
+		if (((*pReg >> bit) & 1) == value) return RCC_OK;
+	}
+	return RCC_ERROR;
+}
+
+static uint32_t RCC_HPREBits(uint16_t prescaler)
+{
+	for (uint8_t i = 0; i < 8; i++) {
+		if (AHB_Prescaler[i] == prescaler) return 0x8 | i;
+	}
+	return 0;
+}
+
+static uint32_t RCC_PPREBits(uint8_t prescaler)
+{
+	for (uint8_t i = 0; i < 4; i++) {
+		if (APB_Prescaler[i] == prescaler) return 0x4 | i;
+	}
+	return 0;
+}
+
+static void RCC_SwitchSysClock(uint8_t source)
+{
+	RCC->CFGR = (RCC->CFGR & ~(3 << RCC_CFGR_SW)) | (source << RCC_CFGR_SW);
+	while (((RCC->CFGR >> RCC_CFGR_SWS) & 3) != source);
+}
+
+/*
+ * Clock tree configuration
+ */
+uint8_t RCC_ClockConfig(RCC_Config_t *pRCCConfig)
+{
+	uint8_t source = pRCCConfig->RCC_ClockSource;
+	uint8_t use_hse = (source == RCC_CLK_SRC_HSE || source == RCC_CLK_SRC_PLL_HSE);
+	uint8_t use_pll = (source == RCC_CLK_SRC_PLL_HSI || source == RCC_CLK_SRC_PLL_HSE);
+
+	/* HSI stays on, the flash programming interface needs it */
+	RCC->CR |= (1 << RCC_CR_HSION);
+	RCC_WaitFlag(&RCC->CR, RCC_CR_HSIRDY, 1);
+
+	if (use_hse) {
+		RCC->CR |= (1 << RCC_CR_HSEON);
+		if (!RCC_WaitFlag(&RCC->CR, RCC_CR_HSERDY, 1)) {
+			RCC->CR &= ~(1 << RCC_CR_HSEON);
+			return RCC_ERROR;
+		}
+	}
+
+	/* run from HSI while the PLL and prescalers change, with the wait states of the fastest clock */
+	FLASH_SetLatency(72000000);
+	RCC_SwitchSysClock(RCC_SW_HSI);
+
+	uint32_t sysclk = use_hse ? HSE_VALUE : HSI_VALUE;
+	if (use_pll) {
+		RCC->CR &= ~(1 << RCC_CR_PLLON);
+		RCC_WaitFlag(&RCC->CR, RCC_CR_PLLRDY, 0);
+
+		uint32_t reg = RCC->CFGR;
+		reg &= ~((1 << RCC_CFGR_PLLSRC) | (1 << RCC_CFGR_PLLXTPRE) | (0xF << RCC_CFGR_PLLMUL));
+		if (source == RCC_CLK_SRC_PLL_HSE)
+			reg |= (1 << RCC_CFGR_PLLSRC);
+		reg |= ((pRCCConfig->RCC_PLLMul - 2) & 0xF) << RCC_CFGR_PLLMUL;
+		RCC->CFGR = reg;
+
+		RCC->CR |= (1 << RCC_CR_PLLON);
+		if (!RCC_WaitFlag(&RCC->CR, RCC_CR_PLLRDY, 1))
+			return RCC_ERROR;
+		sysclk = (use_hse ? HSE_VALUE : HSI_VALUE / 2) * pRCCConfig->RCC_PLLMul;
+	}
+
+	uint32_t reg = RCC->CFGR;
+	reg &= ~((0xF << RCC_CFGR_HPRE) | (7 << RCC_CFGR_PPRE1) | (7 << RCC_CFGR_PPRE2));
+	reg |= RCC_HPREBits(pRCCConfig->RCC_AHBPrescaler) << RCC_CFGR_HPRE;
+	reg |= RCC_PPREBits(pRCCConfig->RCC_APB1Prescaler) << RCC_CFGR_PPRE1;
+	reg |= RCC_PPREBits(pRCCConfig->RCC_APB2Prescaler) << RCC_CFGR_PPRE2;
+	RCC->CFGR = reg;
+
+	RCC_SwitchSysClock(use_pll ? RCC_SW_PLL : (use_hse ? RCC_SW_HSE : RCC_SW_HSI));
+
+	/* drop wait states that are not needed */
+	FLASH_SetLatency(sysclk / (pRCCConfig->RCC_AHBPrescaler ? pRCCConfig->RCC_AHBPrescaler : 1));
+
+	if (!use_hse)
+		RCC->CR &= ~(1 << RCC_CR_HSEON);
+
+	return RCC_OK;
+}
+
+void RCC_DeInit(void)
+{
+	RCC->CR |= (1 << RCC_CR_HSION);
+	RCC_WaitFlag(&RCC->CR, RCC_CR_HSIRDY, 1);
+	RCC_SwitchSysClock(RCC_SW_HSI);
+
+	/* no prescalers, PLL and HSE off */
+	RCC->CFGR &= ~((0xF << RCC_CFGR_HPRE) | (7 << RCC_CFGR_PPRE1) | (7 << RCC_CFGR_PPRE2));
+	RCC->CR &= ~((1 << RCC_CR_PLLON) | (1 << RCC_CR_HSEON));
+	RCC_WaitFlag(&RCC->CR, RCC_CR_PLLRDY, 0);
+	RCC->CFGR &= ~((1 << RCC_CFGR_PLLSRC) | (1 << RCC_CFGR_PLLXTPRE) | (0xF << RCC_CFGR_PLLMUL));
+
+	FLASH_SetLatency(HSI_VALUE);
+}
+
+/*
+ * Bus clocks, read back from the registers
+ */
+uint32_t RCC_GetSYSCLK(void)
+{
+	uint32_t cfgr = RCC->CFGR;
+
+	switch ((cfgr >> RCC_CFGR_SWS) & 3) {
+	case RCC_SW_HSE:
+		return HSE_VALUE;
+	case RCC_SW_PLL:
+	{
+		uint32_t mul = ((cfgr >> RCC_CFGR_PLLMUL) & 0xF) + 2;
+		if (mul > 16) mul = 16;
+
+		uint32_t input = HSI_VALUE / 2;
+		if ((cfgr >> RCC_CFGR_PLLSRC) & 1)
+			input = ((cfgr >> RCC_CFGR_PLLXTPRE) & 1) ? HSE_VALUE / 2 : HSE_VALUE;
+		return input * mul;
+	}
+	default:
+		return HSI_VALUE;
+	}
+}
+
+uint32_t RCC_GetHCLK(void)
+{
+	uint32_t hpre = (RCC->CFGR >> RCC_CFGR_HPRE) & 0xF;
+	uint32_t sysclk = RCC_GetSYSCLK();
+
+	return (hpre & 0x8) ? sysclk / AHB_Prescaler[hpre & 0x7] : sysclk;
+}
+
+uint32_t RCC_GetPCLK1(void)
+{
+	uint32_t ppre = (RCC->CFGR >> RCC_CFGR_PPRE1) & 0x7;
+
+	return (ppre & 0x4) ? RCC_GetHCLK() / APB_Prescaler[ppre & 0x3] : RCC_GetHCLK();
+}
+
+uint32_t RCC_GetPCLK2(void)
+{
+	uint32_t ppre = (RCC->CFGR >> RCC_CFGR_PPRE2) & 0x7;
+
+	return (ppre & 0x4) ? RCC_GetHCLK() / APB_Prescaler[ppre & 0x3] : RCC_GetHCLK();
+}
@@ -58,6 +58,14 @@ static void USART_RXNE_Interrupt_Handle(USART_Handle_t *pUSARTHandle)
 	}
 }
 
+/* clock feeding the USART: USART1 hangs on APB2, the others on APB1 */
+static uint32_t USART_GetPCLK(USART_TypeDef_t *pUSARTx)
+{
+	if (pUSARTx == USART1)
+		return RCC_GetPCLK2();
+	return RCC_GetPCLK1();
+}
+
 /*
  * Peripheral clock setup
  */
@@ -142,15 +150,13 @@ void USART_Init(USART_Handle_t *pUSARTHandle)
 	}
 	pUSARTHandle->pUSARTx->CR3 = reg;
 
-	/* Implement the code to configure the baud rate
-	We will cover this in the lecture. No action required here */
+	/* baud rate from the current APB clock, configure the clock tree first */
 	USART_SetBaudRate(pUSARTHandle->pUSARTx, pUSARTHandle->USART_Config.USART_Baudrate);
 }
 
 void USART_SetBaudRate(USART_TypeDef_t *pUSARTx, uint32_t BaudRate)
 {
-	/* APB clock */
-	uint32_t PCLKx = 8000000;
+	uint32_t PCLKx = USART_GetPCLK(pUSARTx);
 
 	uint32_t usartdiv;
 
@@ -171,6 +177,19 @@ void USART_SetBaudRate(USART_TypeDef_t *pUSARTx, uint32_t BaudRate)
 	pUSARTx->BRR = reg;
 }
 
+uint32_t USART_GetActualBaudRate(USART_TypeDef_t *pUSARTx, uint32_t BaudRate)
+{
+	uint32_t PCLKx = USART_GetPCLK(pUSARTx);
+
+	if (!BaudRate) return 0;
+
+	/* BRR holds USARTDIV in 1/16 steps, the mantissa must not be 0 */
+	uint32_t brr = (PCLKx + BaudRate / 2) / BaudRate;
+	if (brr < 16 || brr > 0xFFFF) return 0;
+
+	return PCLKx / brr;
+}
+
 void USART_SendData(USART_Handle_t *pUSARTHandle, uint8_t *pTxBuffer, uint32_t length)
 {
 	while (length > 0)
@@ -218,6 +237,92 @@ uint8_t USART_ReceiveDataIT(USART_Handle_t *pUSARTHandle, uint8_t *pRxBuffer, ui
 	return state;
 }
 
+uint8_t USART_ReceiveDataDMA(USART_Handle_t *pUSARTHandle, uint8_t *pRxBuffer, uint32_t length)
+{
+	uint8_t state = pUSARTHandle->RxState;
+	/* only USART1 RX (DMA1 channel 5) is wired up */
+	if (state != USART_READY || pUSARTHandle->pUSARTx != USART1 || !length || length > 0xFFFF)
+		return state;
+
+	pUSARTHandle->pRxBuffer = pRxBuffer;
+	pUSARTHandle->RxLength = length;
+	pUSARTHandle->RxReadIndex = 0;
+	pUSARTHandle->RxState = USART_BUSY_RX_DMA;
+
+	pUSARTHandle->RxDMA.pDMAx = DMA1;
+	pUSARTHandle->RxDMA.Channel = 5;
+	pUSARTHandle->RxDMA.DMA_Config.DMA_Direction = DMA_DIR_PERIPH_TO_MEM;
+	pUSARTHandle->RxDMA.DMA_Config.DMA_Mode = DMA_MODE_CIRCULAR;
+	pUSARTHandle->RxDMA.DMA_Config.DMA_Priority = DMA_PRIORITY_HIGH;
+	pUSARTHandle->RxDMA.DMA_Config.DMA_Interrupts = DMA_IT_HT | DMA_IT_TC;
+	DMA_Init(&pUSARTHandle->RxDMA);
+	DMA_Start(&pUSARTHandle->RxDMA, (uint32_t)&pUSARTHandle->pUSARTx->DR, (uint32_t)pRxBuffer, (uint16_t)length);
+
+	pUSARTHandle->pUSARTx->CR3 |= (1 << USART_CR3_DMAR);
+
+	/* drop a stale IDLE flag (SR then DR read) before enabling its interrupt */
+	(void)pUSARTHandle->pUSARTx->SR;
+	(void)pUSARTHandle->pUSARTx->DR;
+	pUSARTHandle->pUSARTx->CR1 |= (1 << USART_CR1_IDLEIE);
+
+	return state;
+}
+
+void USART_AbortReceiveDMA(USART_Handle_t *pUSARTHandle)
+{
+	if (pUSARTHandle->RxState != USART_BUSY_RX_DMA) return;
+
+	pUSARTHandle->pUSARTx->CR1 &= ~(1 << USART_CR1_IDLEIE);
+	pUSARTHandle->pUSARTx->CR3 &= ~(1 << USART_CR3_DMAR);
+	DMA_Stop(&pUSARTHandle->RxDMA);
+
+	pUSARTHandle->RxState = USART_READY;
+	pUSARTHandle->pRxBuffer = NULL;
+	pUSARTHandle->RxLength = 0;
+}
+
+uint32_t USART_RxAvailable(USART_Handle_t *pUSARTHandle)
+{
+	if (pUSARTHandle->RxState != USART_BUSY_RX_DMA) return 0;
+
+	/* CNDTR counts down from RxLength and reloads when the ring wraps */
+	uint32_t write_index = (pUSARTHandle->RxLength - DMA_GetCounter(&pUSARTHandle->RxDMA)) % pUSARTHandle->RxLength;
+
+	return (write_index + pUSARTHandle->RxLength - pUSARTHandle->RxReadIndex) % pUSARTHandle->RxLength;
+}
+
+uint32_t USART_ReadData(USART_Handle_t *pUSARTHandle, uint8_t *pBuffer, uint32_t length)
+{
+	uint32_t available = USART_RxAvailable(pUSARTHandle);
+	if (length > available)
+		length = available;
+
+	uint32_t index = pUSARTHandle->RxReadIndex;
+	for (uint32_t i = 0; i < length; i++)
+	{
+		pBuffer[i] = pUSARTHandle->pRxBuffer[index];
+		if (++index == pUSARTHandle->RxLength)
+			index = 0;
+	}
+	pUSARTHandle->RxReadIndex = index;
+
+	return length;
+}
+
+uint32_t USART_PeekData(USART_Handle_t *pUSARTHandle, uint8_t **ppData)
+{
+	uint32_t available = USART_RxAvailable(pUSARTHandle);
+	uint32_t to_end = pUSARTHandle->RxLength - pUSARTHandle->RxReadIndex;
+
+	*ppData = &pUSARTHandle->pRxBuffer[pUSARTHandle->RxReadIndex];
+	return (available < to_end) ? available : to_end;
+}
+
+void USART_SkipData(USART_Handle_t *pUSARTHandle, uint32_t length)
+{
+	pUSARTHandle->RxReadIndex = (pUSARTHandle->RxReadIndex + length) % pUSARTHandle->RxLength;
+}
+
 /*
  * IRQ Configuation and ISR Handling
  */
@@ -230,6 +335,26 @@ void USART_IRQHandling(USART_Handle_t *pUSARTHandle){
 
 	if (temp1 && temp2)
 		USART_RXNE_Interrupt_Handle(pUSARTHandle);
+
+	temp1 = (pUSARTHandle->pUSARTx->SR >> USART_SR_IDLE) & 1;
+	temp2 = (pUSARTHandle->pUSARTx->CR1 >> USART_CR1_IDLEIE) & 1;
+
+	if (temp1 && temp2)
+	{
+		/* IDLE is cleared by reading SR then DR, the DMA already took the data */
+		(void)pUSARTHandle->pUSARTx->DR;
+		USART_ReceptionEventsCallback(pUSARTHandle);
+	}
+}
+
+void USART_DMA_IRQHandling(USART_Handle_t *pUSARTHandle)
+{
+	if (DMA_GetFlagStatus(&pUSARTHandle->RxDMA, DMA_FLAG_HTIF) ||
+		DMA_GetFlagStatus(&pUSARTHandle->RxDMA, DMA_FLAG_TCIF))
+		DMA_ClearFlag(&pUSARTHandle->RxDMA, DMA_FLAG_GIF);
+
+	/* without a flag the interrupt was pended by software to read the ring again */
+	USART_ReceptionEventsCallback(pUSARTHandle);
 }
 
 void USART1_IRQHandler()
@@ -237,4 +362,9 @@ void USART1_IRQHandler()
 	USART_IRQHandling(&uart1);
 }
 
+void DMA1_Channel5_IRQHandler()
+{
+	USART_DMA_IRQHandling(&uart1);
+}
+
 __weak void USART_ReceptionEventsCallback(USART_Handle_t *pUSARTHandle) {}
@@ -0,0 +1,432 @@
+/*
+ * sim.c
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: nphuc
+ */
+
+#define _GNU_SOURCE
+#include "sim.h"
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#ifdef FLASH_BENCHMARK
+#include "flash_benchmark.h"
+#endif
+
+#if !defined(__x86_64__) || !defined(__linux__)
+#error "register accesses are trapped and single-stepped the x86-64 Linux way"
+#endif
+
+#define SIM_PERIPH_SIZE							0x24000		/* APB1 up to the CRC unit*/
+#define SIM_CORE_BASE							0xE0000000U
+#define SIM_CORE_SIZE							0x10000		/* DWT, SysTick, NVIC, SCB*/
+#define SIM_MAX_REGIONS							4
+#define SIM_HOST_PAGE							4096UL
+#define SIM_PACE_SLACK_NS						100000		/* ahead of real time before -r sleeps*/
+
+#define EFLAGS_TF								0x100		/* trap after the next instruction*/
+#define PF_WRITE								0x2			/* page fault error code: write access*/
+
+typedef struct
+{
+	uintptr_t base;
+	uint32_t size;
+	int prot;				/* what the firmware may do without a trap */
+	uint8_t *pAlias;
+} SimRegion_t;
+
+SimConfig_t sim_config = {
+	.flash_path = "flash.bin",
+	.peer_baud = SIM_PEER_BAUD_FOLLOW,
+	.seed = 1,
+};
+
+static const SimPeripheral_t *const peripherals[] = {
+	&SimFlash_Memory, &SimFlash_Interface, &SimRcc, &SimCrc, &SimUsart_DMA1, &SimUsart_USART1,
+	&SimCore_NVIC, &SimCore_SCB, &SimCore_SysTick, &SimCore_DWT,
+};
+#define SIM_PERIPHERALS							(sizeof(peripherals) / sizeof(peripherals[0]))
+
+static SimRegion_t regions[SIM_MAX_REGIONS];
+static uint8_t region_count;
+
+/* the access being single-stepped */
+static struct
+{
+	const SimRegion_t *pRegion;
+	const SimPeripheral_t *pPeripheral;
+	uintptr_t address;
+	uint32_t old;
+	uint8_t write;
+	uint8_t pending;
+} stepping;
+static uintptr_t last_read;		/* address of the last access if it was a read */
+
+static uint64_t now;
+static uint64_t sleep_ns;
+static uint32_t hclk = HSI_VALUE;
+static uint64_t cycles_base;
+static uint64_t cycles_mark;
+static struct timespec real_start;
+static uint64_t real_lag;		/* how far the simulation fell behind real time */
+static __vo uint64_t *pClock;	/* -c */
+
+/*
+ * Memory
+ */
+
+void Sim_MapRegion(uintptr_t base, uint32_t size, int prot, int fd, uint8_t *pAlias)
+{
+	void *pView = mmap((void *)base, size, prot, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+	if(pView != (void *)base || region_count == SIM_MAX_REGIONS) {
+		fprintf(stderr, "sim: cannot map %#lx, is the host build linked with -no-pie?\n", (unsigned long)base);
+		exit(1);
+	}
+	regions[region_count++] = (SimRegion_t){ base, size, prot, pAlias };
+}
+
+static void Sim_MapRegisters(uintptr_t base, uint32_t size)
+{
+	int fd = memfd_create("registers", 0);
+	if(fd < 0 || ftruncate(fd, size) != 0) {
+		perror("sim: registers");
+		exit(1);
+	}
+	uint8_t *pAlias = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	Sim_MapRegion(base, size, PROT_NONE, fd, pAlias);
+	close(fd);
+}
+
+static void Sim_MapClock(void)
+{
+	int fd = open(sim_config.clock_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+	if(fd < 0 || ftruncate(fd, sizeof(*pClock)) != 0) {
+		perror(sim_config.clock_path);
+		exit(1);
+	}
+	pClock = mmap(NULL, sizeof(*pClock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(pClock == MAP_FAILED) {
+		perror(sim_config.clock_path);
+		exit(1);
+	}
+}
+
+static const SimRegion_t *Sim_FindRegion(uintptr_t address)
+{
+	for(uint8_t i = 0; i < region_count; i++) {
+		if(address - regions[i].base < regions[i].size) return &regions[i];
+	}
+	return NULL;
+}
+
+void *Sim_Alias(uintptr_t address)
+{
+	const SimRegion_t *pRegion = Sim_FindRegion(address);
+	return pRegion ? pRegion->pAlias + (address - pRegion->base) : NULL;
+}
+
+static const SimPeripheral_t *Sim_FindPeripheral(uintptr_t address)
+{
+	for(uint32_t i = 0; i < SIM_PERIPHERALS; i++) {
+		if(address - peripherals[i]->base < peripherals[i]->size) return peripherals[i];
+	}
+	return NULL;
+}
+
+/*
+ * Register access: the fault hands the access to the model and lets the
+ * instruction through once, the trap after it closes the page again
+ */
+
+static void Sim_AccessFault(int sig, siginfo_t *pInfo, void *pContext)
+{
+	ucontext_t *pUC = pContext;
+	uintptr_t address = (uintptr_t)pInfo->si_addr;
+	const SimRegion_t *pRegion = Sim_FindRegion(address);
+
+	if(!pRegion || stepping.pending) {
+		/* not a simulated register, crash for real */
+		signal(SIGSEGV, SIG_DFL);
+		return;
+	}
+
+	stepping.pRegion = pRegion;
+	stepping.pPeripheral = Sim_FindPeripheral(address);
+	stepping.address = address;
+	stepping.write = (pUC->uc_mcontext.gregs[REG_ERR] & PF_WRITE) != 0;
+	stepping.pending = 1;
+
+	Sim_AdvanceTo(now + Sim_CyclesToNs(SIM_BUS_CYCLES));
+	if(!stepping.write && stepping.pPeripheral && stepping.pPeripheral->Read) {
+		stepping.pPeripheral->Read(address, last_read == address);
+	}
+	last_read = stepping.write ? 0 : address;
+	stepping.old = *(uint32_t *)Sim_Alias(address & ~3UL);
+
+	mprotect((void *)(address & ~(SIM_HOST_PAGE - 1)), SIM_HOST_PAGE, PROT_READ | PROT_WRITE);
+	pUC->uc_mcontext.gregs[REG_EFL] |= EFLAGS_TF;
+}
+
+static void Sim_AccessStep(int sig, siginfo_t *pInfo, void *pContext)
+{
+	ucontext_t *pUC = pContext;
+
+	if(!stepping.pending) {
+		signal(SIGTRAP, SIG_DFL);
+		return;
+	}
+	pUC->uc_mcontext.gregs[REG_EFL] &= ~EFLAGS_TF;
+	mprotect((void *)(stepping.address & ~(SIM_HOST_PAGE - 1)), SIM_HOST_PAGE, stepping.pRegion->prot);
+	stepping.pending = 0;
+
+	if(stepping.write && stepping.pPeripheral && stepping.pPeripheral->Write) {
+		stepping.pPeripheral->Write(stepping.address, stepping.old, *(uint32_t *)Sim_Alias(stepping.address & ~3UL));
+	}
+	SimCore_CheckInterrupts();
+}
+
+/*
+ * Time
+ */
+
+uint64_t Sim_Now(void)
+{
+	return now;
+}
+
+static uint64_t Sim_RealNow(void)
+{
+	struct timespec real;
+
+	clock_gettime(CLOCK_MONOTONIC, &real);
+	return (real.tv_sec - real_start.tv_sec) * SIM_NS_PER_S + real.tv_nsec - real_start.tv_nsec;
+}
+
+/* -r: no faster than real time, so a peer reacting in real time does not fall behind */
+static void Sim_Pace(void)
+{
+	uint64_t real = Sim_RealNow() - real_lag;
+
+	if(now > real + SIM_PACE_SLACK_NS) {
+		struct timespec wait = { (now - real) / SIM_NS_PER_S, (now - real) % SIM_NS_PER_S };
+		nanosleep(&wait, NULL);
+	} else if(real > now) {
+		/* slower than real time, what is lost is not made up */
+		real_lag += real - now;
+	}
+}
+
+static uint64_t Sim_NextEvent(void)
+{
+	uint64_t next = SIM_NEVER;
+
+	for(uint32_t i = 0; i < SIM_PERIPHERALS; i++) {
+		if(peripherals[i]->NextEvent) {
+			uint64_t event = peripherals[i]->NextEvent();
+			if(event < next) next = event;
+		}
+	}
+	return next;
+}
+
+void Sim_AdvanceTo(uint64_t until)
+{
+	uint64_t next;
+
+	while((next = Sim_NextEvent()) <= until) {
+		if(next > now) now = next;
+		for(uint32_t i = 0; i < SIM_PERIPHERALS; i++) {
+			if(peripherals[i]->RunEvents) peripherals[i]->RunEvents();
+		}
+	}
+	if(until > now) now = until;
+	if(sim_config.real_time) Sim_Pace();
+	if(pClock) *pClock = now;
+
+	if(sim_config.time_limit && now >= sim_config.time_limit) {
+		Sim_Finish(1, "time limit");
+	}
+}
+
+void Sim_Stall(void)
+{
+	uint64_t next = Sim_NextEvent();
+	if(next != SIM_NEVER) Sim_AdvanceTo(next);
+}
+
+void Sim_Sleep(void)
+{
+	uint64_t start = now;
+
+	while(!SimCore_Pending()) {
+		uint64_t next = Sim_NextEvent();
+		uint64_t wait = SimUsart_WaitLine((next == SIM_NEVER) ? SIM_NEVER : next - now);
+		uint64_t until = (next == SIM_NEVER || wait < next - now) ? now + wait : next;
+
+		Sim_AdvanceTo(until);
+		if(until != next) {
+			/* woken up by the peer */
+			SimUsart_PollLine();
+		}
+	}
+	sleep_ns += now - start;
+}
+
+void Sim_SetHCLK(uint32_t hz)
+{
+	cycles_base = Sim_Cycles();
+	cycles_mark = now;
+	hclk = hz;
+}
+
+uint32_t Sim_HCLK(void)
+{
+	return hclk;
+}
+
+uint64_t Sim_Cycles(void)
+{
+	uint64_t elapsed = now - cycles_mark;
+	return cycles_base + (elapsed / SIM_NS_PER_S) * hclk + (elapsed % SIM_NS_PER_S) * hclk / SIM_NS_PER_S;
+}
+
+uint64_t Sim_CyclesToNs(uint64_t cycles)
+{
+	return (cycles / hclk) * SIM_NS_PER_S + (cycles % hclk) * SIM_NS_PER_S / hclk;
+}
+
+/*
+ * End of the run
+ */
+
+void Sim_Finish(int status, const char *reason, ...)
+{
+	struct timespec real_end;
+	va_list args;
+
+	clock_gettime(CLOCK_MONOTONIC, &real_end);
+	double real = (real_end.tv_sec - real_start.tv_sec) + (real_end.tv_nsec - real_start.tv_nsec) / 1e9;
+
+	fprintf(stderr, "sim: ");
+	va_start(args, reason);
+	vfprintf(stderr, reason, args);
+	va_end(args);
+	fprintf(stderr, " after %.6f s simulated (%.1f%% asleep, %llu core clocks), %.2f s real\n",
+	        now / 1e9, now ? 100.0 * sleep_ns / now : 0.0, (unsigned long long)Sim_Cycles(), real);
+	if(sim_config.real_time) {
+		fprintf(stderr, "sim: %.3f s behind real time\n", real_lag / 1e9);
+	}
+
+	for(uint32_t i = 0; i < SIM_PERIPHERALS; i++) {
+		if(peripherals[i]->Report) peripherals[i]->Report(stderr);
+	}
+#ifdef FLASH_BENCHMARK
+	fprintf(stderr, "benchmark: %s, FLASH_WriteData %u clocks/KB, FLASH_ProgramRange %u clocks/KB at %u Hz\n",
+	        flash_benchmark.status == FLASH_OK ? "verified" : "failed", flash_benchmark.word_cycles_per_kb,
+	        flash_benchmark.range_cycles_per_kb, flash_benchmark.hclk);
+#endif
+
+	if(sim_config.link_path) unlink(sim_config.link_path);
+	exit(status);
+}
+
+void Sim_Fault(const char *reason, ...)
+{
+	char text[160];
+	va_list args;
+
+	va_start(args, reason);
+	vsnprintf(text, sizeof(text), reason, args);
+	va_end(args);
+	Sim_Finish(1, "fault, %s,", text);
+}
+
+static void Sim_Interrupted(int sig)
+{
+	Sim_Finish(1, "interrupted");
+}
+
+/*
+ * Start-up, before main() of the bootloader. glibc passes the command line to
+ * constructors
+ */
+
+static void Sim_Usage(const char *pName)
+{
+	fprintf(stderr,
+	        "usage: %s [-f flash.bin] [-e] [-u] [-l link] [-b baud|pty] [-n ppm] [-s seed] [-t seconds] [-r] [-c clock]\n"
+	        "  -f  flash image file, created erased, with the erase count of every page behind it\n"
+	        "  -e  erase the whole flash first\n"
+	        "  -u  set the update request flag the application leaves before a reset\n"
+	        "  -l  symlink to the pseudo-terminal that is the other end of USART1\n"
+	        "  -b  line rate of the peer, or pty to take it from the terminal settings;\n"
+	        "      by default the peer always matches the USART\n"
+	        "  -n  received bytes per million that get a bit flipped\n"
+	        "  -s  seed for the line noise\n"
+	        "  -t  stop after this many simulated seconds\n"
+	        "  -r  run no faster than real time, for a peer that reacts in real time\n"
+	        "  -c  file the simulated time is kept in, 64-bit nanoseconds, for the peer to time itself by\n", pName);
+	exit(2);
+}
+
+static void Sim_Signal(int sig, void (*pHandler)(int, siginfo_t *, void *))
+{
+	struct sigaction action;
+
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = pHandler;
+	action.sa_flags = SA_SIGINFO;
+	/* no interrupt and no report in the middle of an access */
+	sigemptyset(&action.sa_mask);
+	sigaddset(&action.sa_mask, SIGUSR1);
+	sigaddset(&action.sa_mask, SIGINT);
+	sigaddset(&action.sa_mask, SIGTERM);
+	sigaction(sig, &action, NULL);
+}
+
+__attribute__((constructor)) static void Sim_Start(int argc, char **argv)
+{
+	int option;
+
+	while((option = getopt(argc, argv, "f:eul:b:n:s:t:rc:h")) != -1) {
+		switch(option) {
+			case 'f': sim_config.flash_path = optarg; break;
+			case 'e': sim_config.erase = 1; break;
+			case 'u': sim_config.update_flag = 1; break;
+			case 'l': sim_config.link_path = optarg; break;
+			case 'b':
+				sim_config.peer_baud = strcmp(optarg, "pty") ? strtoul(optarg, NULL, 0) : SIM_PEER_BAUD_PTY;
+				if(sim_config.peer_baud == SIM_PEER_BAUD_FOLLOW) Sim_Usage(argv[0]);
+				break;
+			case 'n': sim_config.noise_ppm = strtoul(optarg, NULL, 0); break;
+			case 's': sim_config.seed = strtoul(optarg, NULL, 0); break;
+			case 't': sim_config.time_limit = (uint64_t)(strtod(optarg, NULL) * SIM_NS_PER_S); break;
+			case 'r': sim_config.real_time = 1; break;
+			case 'c': sim_config.clock_path = optarg; break;
+			default: Sim_Usage(argv[0]);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &real_start);
+	if(sim_config.clock_path) Sim_MapClock();
+
+	Sim_MapRegisters(PERIPH_BASE, SIM_PERIPH_SIZE);
+	Sim_MapRegisters(SIM_CORE_BASE, SIM_CORE_SIZE);
+	for(uint32_t i = 0; i < SIM_PERIPHERALS; i++) {
+		if(peripherals[i]->Init) peripherals[i]->Init();
+	}
+
+	Sim_Signal(SIGSEGV, Sim_AccessFault);
+	Sim_Signal(SIGTRAP, Sim_AccessStep);
+	signal(SIGINT, Sim_Interrupted);
+	signal(SIGTERM, Sim_Interrupted);
+}
@@ -0,0 +1,145 @@
+/*
+ * sim.h
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: nphuc
+ */
+
+#ifndef HOST_SIM_H_
+#define HOST_SIM_H_
+
+#include "stm32f103xx.h"
+#include <stdio.h>
+
+/*
+ * Host simulation of the STM32F103 the bootloader runs on. Flash, the
+ * peripheral registers and the core registers sit at their real addresses, the
+ * firmware sees them through a view that traps every register access and every
+ * write to flash. The access is single-stepped and handed to the model of the
+ * peripheral, which keeps its registers in a second, untrapped view of the same
+ * memory. Time is simulated in nanoseconds and only moves on register accesses,
+ * flash operations, line traffic and sleeps, CPU work between them is free.
+ */
+#define SIM_NEVER								UINT64_MAX
+#define SIM_NS_PER_S							1000000000ULL
+#define SIM_BUS_CYCLES							2		/* one register access*/
+
+/* A register as the models see it, without a trap */
+#define SIM_REG(reg)							(*(__vo uint32_t *)Sim_Alias((uintptr_t)&(reg)))
+
+typedef struct
+{
+	const char *name;
+	uintptr_t base;
+	uint32_t size;
+	void (*Init)(void);
+	/* before the firmware reads, repeated: the last access was a read of the same address */
+	void (*Read)(uintptr_t address, uint8_t repeated);
+	/* after the firmware wrote, old and value are the aligned word before and after */
+	void (*Write)(uintptr_t address, uint32_t old, uint32_t value);
+	uint64_t (*NextEvent)(void);
+	void (*RunEvents)(void);
+	void (*Report)(FILE *pOut);
+} SimPeripheral_t;
+
+/* Command line of the simulator, see README.md */
+#define SIM_PEER_BAUD_FOLLOW					0	/* the peer always runs at the USART rate*/
+#define SIM_PEER_BAUD_PTY						1	/* the peer sets its rate on the pty*/
+
+typedef struct
+{
+	const char *flash_path;
+	uint8_t erase;
+	uint8_t update_flag;
+	const char *link_path;
+	uint32_t peer_baud;
+	uint32_t noise_ppm;
+	uint32_t seed;
+	uint64_t time_limit;
+	uint8_t real_time;
+	const char *clock_path;
+} SimConfig_t;
+
+extern SimConfig_t sim_config;
+
+extern const SimPeripheral_t SimFlash_Memory;
+extern const SimPeripheral_t SimFlash_Interface;
+extern const SimPeripheral_t SimUsart_USART1;
+extern const SimPeripheral_t SimUsart_DMA1;
+extern const SimPeripheral_t SimRcc;
+extern const SimPeripheral_t SimCrc;
+extern const SimPeripheral_t SimCore_NVIC;
+extern const SimPeripheral_t SimCore_SCB;
+extern const SimPeripheral_t SimCore_SysTick;
+extern const SimPeripheral_t SimCore_DWT;
+
+/*
+ * Memory: the firmware view of a region at its real address and the untrapped
+ * view the models use
+ */
+void Sim_MapRegion(uintptr_t base, uint32_t size, int prot, int fd, uint8_t *pAlias);
+
+void *Sim_Alias(uintptr_t address);
+
+/*
+ * Simulated time
+ */
+uint64_t Sim_Now(void);
+
+/* let time pass up to `until`, running the events due on the way */
+void Sim_AdvanceTo(uint64_t until);
+
+/* a status is polled that only an event changes, skip to the next event */
+void Sim_Stall(void);
+
+/* WFI: let time pass until an interrupt is pending, in real time while the line is silent */
+void Sim_Sleep(void);
+
+/* core clock, the RCC model reports every change */
+void Sim_SetHCLK(uint32_t hz);
+
+uint32_t Sim_HCLK(void);
+
+uint64_t Sim_Cycles(void);
+
+uint64_t Sim_CyclesToNs(uint64_t cycles);
+
+/* stop with a report, status 0 when the application was started */
+void Sim_Finish(int status, const char *reason, ...);
+
+/* the firmware did something the hardware would fault on */
+void Sim_Fault(const char *reason, ...);
+
+/*
+ * Core, sim_core.c
+ */
+
+/* level of an interrupt request line, a high level pends the interrupt */
+void SimCore_IRQLine(uint8_t IRQNumber, uint8_t level);
+
+void SimCore_PendSysTick(void);
+
+/* an enabled interrupt is pending, WFI wakes up */
+uint8_t SimCore_Pending(void);
+
+/* take pending interrupts as soon as the firmware does not mask them */
+void SimCore_CheckInterrupts(void);
+
+/*
+ * Line, sim_usart.c
+ */
+
+/* take what the peer has written so far */
+void SimUsart_PollLine(void);
+
+/* wait in real time for the peer, at most max_ns, returns the time waited */
+uint64_t SimUsart_WaitLine(uint64_t max_ns);
+
+/*
+ * Clock tree, sim_rcc.c
+ */
+uint32_t SimRcc_HCLK(void);
+
+uint32_t SimRcc_PCLK2(void);
+
+#endif /* HOST_SIM_H_ */
@@ -0,0 +1,364 @@
+/*
+ * sim_core.c
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: nphuc
+ */
+
+#define _GNU_SOURCE
+#include "sim.h"
+#include <signal.h>
+
+/*
+ * Cortex-M3 core: NVIC, SCB, SysTick and the DWT cycle counter. Exceptions are
+ * taken as SIGUSR1 and PRIMASK is SIGUSR1 being blocked, so a handler runs on
+ * top of whatever the firmware was doing, the way it does on the chip. All
+ * exceptions have the same priority, they never preempt each other.
+ */
+#define SIM_IRQS								64
+#define SIM_CPUID								0x411FC231U		/* Cortex-M3 r1p1*/
+#define SIM_SYSTICK_CALIB						9000			/* 1 ms at 72 MHz / 8*/
+#define SCB_ICSR_PENDSTSET						26
+#define SYSTICK_CTRL_COUNTFLAG					16
+
+void SysTick_Handler(void);
+void USART1_IRQHandler(void);
+void DMA1_Channel5_IRQHandler(void);
+
+/* the vector table of the bootloader, as far as it has handlers */
+static void (*const vectors[SIM_IRQS])(void) = {
+	[IRQ_NO_DMA1_CH5] = DMA1_Channel5_IRQHandler,
+	[IRQ_NO_USART1] = USART1_IRQHandler,
+};
+
+static uint64_t irq_enabled;
+static uint64_t irq_pending;
+static uint64_t irq_active;
+static uint64_t irq_line;
+static uint8_t systick_pending;
+static uint8_t in_handler;
+static __vo sig_atomic_t raised;
+static uint32_t msp;
+
+static uint64_t next_tick = SIM_NEVER;
+static uint64_t dwt_base;
+static uint64_t dwt_mark;
+
+/*
+ * Exceptions
+ */
+
+static void SimCore_NVICSync(void)
+{
+	for(uint8_t word = 0; word < SIM_IRQS / 32; word++) {
+		SIM_REG(NVIC->ISER[word]) = SIM_REG(NVIC->ICER[word]) = (uint32_t)(irq_enabled >> (32 * word));
+		SIM_REG(NVIC->ISPR[word]) = SIM_REG(NVIC->ICPR[word]) = (uint32_t)(irq_pending >> (32 * word));
+		SIM_REG(NVIC->IABR[word]) = (uint32_t)(irq_active >> (32 * word));
+	}
+}
+
+void SimCore_IRQLine(uint8_t IRQNumber, uint8_t level)
+{
+	uint64_t bit = 1ULL << IRQNumber;
+
+	if(level) {
+		irq_line |= bit;
+		/* an active interrupt pends again on exit if the line is still high */
+		if(!(irq_active & bit)) irq_pending |= bit;
+	} else {
+		irq_line &= ~bit;
+	}
+	SimCore_NVICSync();
+}
+
+void SimCore_PendSysTick(void)
+{
+	systick_pending = 1;
+}
+
+uint8_t SimCore_Pending(void)
+{
+	return systick_pending || (irq_pending & irq_enabled);
+}
+
+void SimCore_CheckInterrupts(void)
+{
+	if(!in_handler && !raised && SimCore_Pending()) {
+		raised = 1;
+		raise(SIGUSR1);
+	}
+}
+
+/* exception entry, one handler after the other until nothing is pending */
+static void SimCore_Exception(int sig)
+{
+	raised = 0;
+	in_handler = 1;
+
+	for(;;) {
+		if(systick_pending) {
+			systick_pending = 0;
+			SysTick_Handler();
+			continue;
+		}
+
+		uint64_t ready = irq_pending & irq_enabled;
+		if(!ready) break;
+
+		uint8_t irq = __builtin_ctzll(ready);
+		uint64_t bit = 1ULL << irq;
+		irq_pending &= ~bit;
+		irq_active |= bit;
+		SimCore_NVICSync();
+
+		if(!vectors[irq]) Sim_Fault("IRQ %u enabled without a handler", irq);
+		vectors[irq]();
+
+		irq_active &= ~bit;
+		if(irq_line & bit) irq_pending |= bit;
+		SimCore_NVICSync();
+	}
+	in_handler = 0;
+}
+
+/*
+ * Core instructions
+ */
+
+void __disable_irq(void)
+{
+	sigset_t set;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	sigprocmask(SIG_BLOCK, &set, NULL);
+}
+
+void __enable_irq(void)
+{
+	sigset_t set;
+
+	SimCore_CheckInterrupts();
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	sigprocmask(SIG_UNBLOCK, &set, NULL);
+}
+
+void __WFI(void)
+{
+	Sim_Sleep();
+	SimCore_CheckInterrupts();
+}
+
+void __DSB(void)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void __set_MSP(uint32_t topOfStack)
+{
+	/* the host stack stays, the application is never run */
+	msp = topOfStack;
+}
+
+/*
+ * NVIC
+ */
+
+static uint8_t SimCore_NVICWord(uintptr_t address, __vo uint32_t *pArray, uint8_t *pWord)
+{
+	uintptr_t offset = address - (uintptr_t)pArray;
+
+	if(offset >= (SIM_IRQS / 32) * 4) return 0;
+	*pWord = offset / 4;
+	return 1;
+}
+
+static void SimCore_NVICInit(void)
+{
+	struct sigaction action = { .sa_handler = SimCore_Exception };
+
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGUSR1, &action, NULL);
+}
+
+static void SimCore_NVICWrite(uintptr_t address, uint32_t old, uint32_t value)
+{
+	uint8_t word;
+
+	address &= ~3UL;
+	if(SimCore_NVICWord(address, NVIC->ISER, &word)) {
+		irq_enabled |= (uint64_t)value << (32 * word);
+	} else if(SimCore_NVICWord(address, NVIC->ICER, &word)) {
+		irq_enabled &= ~((uint64_t)value << (32 * word));
+	} else if(SimCore_NVICWord(address, NVIC->ISPR, &word)) {
+		irq_pending |= (uint64_t)value << (32 * word);
+	} else if(SimCore_NVICWord(address, NVIC->ICPR, &word)) {
+		irq_pending &= ~((uint64_t)value << (32 * word));
+	}
+	SimCore_NVICSync();
+}
+
+const SimPeripheral_t SimCore_NVIC = {
+	.name = "nvic",
+	.base = NVIC_BASE_ADDR,
+	.size = offsetof(NVIC_TypeDef_t, RESERVED5),
+	.Init = SimCore_NVICInit,
+	.Write = SimCore_NVICWrite,
+};
+
+/*
+ * SCB, with DEMCR
+ */
+
+static void SimCore_SCBInit(void)
+{
+	SIM_REG(SCB->CPUID) = SIM_CPUID;
+	SIM_REG(SCB->AIRCR) = 0xFA050000U;
+}
+
+static void SimCore_SCBRead(uintptr_t address, uint8_t repeated)
+{
+	if((address & ~3UL) == (uintptr_t)&SCB->ICSR) {
+		SIM_REG(SCB->ICSR) = (uint32_t)systick_pending << SCB_ICSR_PENDSTSET;
+	}
+}
+
+static void SimCore_SCBWrite(uintptr_t address, uint32_t old, uint32_t value)
+{
+	address &= ~3UL;
+	if(address == (uintptr_t)&SCB->ICSR) {
+		if(value & (1 << SCB_ICSR_PENDSTCLR)) systick_pending = 0;
+		if(value & (1 << SCB_ICSR_PENDSTSET)) systick_pending = 1;
+		SIM_REG(SCB->ICSR) = (uint32_t)systick_pending << SCB_ICSR_PENDSTSET;
+	} else if(address == (uintptr_t)&SCB->VTOR) {
+		/* the last thing Bootloader_JumpApp does before it calls the reset handler */
+		uint32_t *pVectors = Sim_Alias(value);
+		if(!pVectors) Sim_Fault("vector table moved to %#x, outside flash", value);
+		Sim_Finish(0, "application started, vector table %#x, stack %#x, reset handler %#x",
+		           value, msp, pVectors[1]);
+	} else if(address == (uintptr_t)&SCB->AIRCR) {
+		if((value >> AIRCR_VECTKEY) == 0x5FA && (value & (1 << AIRCR_SYSRESETREQ))) {
+			Sim_Finish(1, "system reset requested");
+		}
+		SIM_REG(SCB->AIRCR) = 0xFA050000U | (value & 0x700);
+	} else if(address == (uintptr_t)&SCB->CPUID) {
+		SIM_REG(SCB->CPUID) = SIM_CPUID;
+	}
+}
+
+const SimPeripheral_t SimCore_SCB = {
+	.name = "scb",
+	.base = SCB_BASEADDR,
+	.size = DEMCR_ADDR + 4 - SCB_BASEADDR,
+	.Init = SimCore_SCBInit,
+	.Read = SimCore_SCBRead,
+	.Write = SimCore_SCBWrite,
+};
+
+/*
+ * SysTick
+ */
+
+static uint64_t SimCore_TickPeriod(void)
+{
+	uint64_t cycles = (SIM_REG(SYSTICK->LOAD) & 0xFFFFFF) + 1;
+
+	/* the external reference is HCLK / 8 */
+	if(!(SIM_REG(SYSTICK->CTRL) & (1 << SYSTICK_CTRL_CLKSOURCE))) cycles *= 8;
+	return Sim_CyclesToNs(cycles);
+}
+
+static void SimCore_SysTickInit(void)
+{
+	SIM_REG(SYSTICK->CALIB) = SIM_SYSTICK_CALIB;
+}
+
+static void SimCore_SysTickRead(uintptr_t address, uint8_t repeated)
+{
+	if((address & ~3UL) == (uintptr_t)&SYSTICK->VAL && next_tick != SIM_NEVER) {
+		uint64_t left = next_tick - Sim_Now();
+		SIM_REG(SYSTICK->VAL) = (uint32_t)(left * Sim_HCLK() / SIM_NS_PER_S);
+	}
+}
+
+static void SimCore_SysTickWrite(uintptr_t address, uint32_t old, uint32_t value)
+{
+	address &= ~3UL;
+	if(address == (uintptr_t)&SYSTICK->CTRL) {
+		/* COUNTFLAG is read only */
+		SIM_REG(SYSTICK->CTRL) = (value & ~(1 << SYSTICK_CTRL_COUNTFLAG)) | (old & (1 << SYSTICK_CTRL_COUNTFLAG));
+		if(!(value & (1 << SYSTICK_CTRL_ENABLE))) {
+			next_tick = SIM_NEVER;
+		} else if(!(old & (1 << SYSTICK_CTRL_ENABLE))) {
+			next_tick = Sim_Now() + SimCore_TickPeriod();
+		}
+	} else if(address == (uintptr_t)&SYSTICK->VAL) {
+		/* any write clears the counter, it reloads on the next clock */
+		SIM_REG(SYSTICK->VAL) = 0;
+		SIM_REG(SYSTICK->CTRL) &= ~(1 << SYSTICK_CTRL_COUNTFLAG);
+		if(next_tick != SIM_NEVER) next_tick = Sim_Now() + SimCore_TickPeriod();
+	}
+}
+
+static uint64_t SimCore_SysTickNextEvent(void)
+{
+	return next_tick;
+}
+
+static void SimCore_SysTickRun(void)
+{
+	while(next_tick <= Sim_Now()) {
+		SIM_REG(SYSTICK->CTRL) |= (1 << SYSTICK_CTRL_COUNTFLAG);
+		if(SIM_REG(SYSTICK->CTRL) & (1 << SYSTICK_CTRL_TICKINT)) SimCore_PendSysTick();
+		next_tick += SimCore_TickPeriod();
+	}
+}
+
+const SimPeripheral_t SimCore_SysTick = {
+	.name = "systick",
+	.base = SYSTICK_BASEADDR,
+	.size = sizeof(SysTick_TypeDef_t),
+	.Init = SimCore_SysTickInit,
+	.Read = SimCore_SysTickRead,
+	.Write = SimCore_SysTickWrite,
+	.NextEvent = SimCore_SysTickNextEvent,
+	.RunEvents = SimCore_SysTickRun,
+};
+
+/*
+ * DWT cycle counter
+ */
+
+static uint8_t SimCore_DWTCounting(void)
+{
+	return (SIM_REG(DWT->CTRL) & (1 << DWT_CTRL_CYCCNTENA)) && (SIM_REG(DEMCR) & (1 << DEMCR_TRCENA));
+}
+
+static void SimCore_DWTRead(uintptr_t address, uint8_t repeated)
+{
+	if((address & ~3UL) == (uintptr_t)&DWT->CYCCNT && SimCore_DWTCounting()) {
+		SIM_REG(DWT->CYCCNT) = (uint32_t)(dwt_base + Sim_Cycles() - dwt_mark);
+	}
+}
+
+static void SimCore_DWTWrite(uintptr_t address, uint32_t old, uint32_t value)
+{
+	address &= ~3UL;
+	if(address == (uintptr_t)&DWT->CYCCNT) {
+		dwt_base = value;
+		dwt_mark = Sim_Cycles();
+	} else if(address == (uintptr_t)&DWT->CTRL && (value & ~old & (1 << DWT_CTRL_CYCCNTENA))) {
+		/* counting starts from where it stopped */
+		dwt_base = SIM_REG(DWT->CYCCNT);
+		dwt_mark = Sim_Cycles();
+	}
+}
+
+const SimPeripheral_t SimCore_DWT = {
+	.name = "dwt",
+	.base = DWT_BASEADDR,
+	.size = sizeof(DWT_TypeDef_t),
+	.Read = SimCore_DWTRead,
+	.Write = SimCore_DWTWrite,
+};
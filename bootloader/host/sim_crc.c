@@ -0,0 +1,52 @@
+/*
+ * sim_crc.c
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: nphuc
+ */
+
+#include "sim.h"
+
+/*
+ * CRC unit: CRC-32/MPEG-2 over every word written to DR, most significant bit
+ * first, reset to CRC_INIT_VALUE through CR
+ */
+#define SIM_CRC_POLY							0x04C11DB7U
+
+static uint32_t crc = CRC_INIT_VALUE;
+
+static uint32_t SimCrc_Word(uint32_t value, uint32_t word)
+{
+	value ^= word;
+	for(uint8_t bit = 0; bit < 32; bit++) {
+		value = (value & 0x80000000U) ? (value << 1) ^ SIM_CRC_POLY : value << 1;
+	}
+	return value;
+}
+
+static void SimCrc_Init(void)
+{
+	SIM_REG(CRC->DR) = crc;
+}
+
+static void SimCrc_Write(uintptr_t address, uint32_t old, uint32_t value)
+{
+	address &= ~3UL;
+	if(address == (uintptr_t)&CRC->DR) {
+		crc = SimCrc_Word(crc, value);
+	} else if(address == (uintptr_t)&CRC->CR) {
+		if(value & (1 << CRC_CR_RESET)) crc = CRC_INIT_VALUE;
+		SIM_REG(CRC->CR) = 0;
+	} else if(address == (uintptr_t)&CRC->IDR) {
+		SIM_REG(CRC->IDR) = value & 0xFF;
+	}
+	SIM_REG(CRC->DR) = crc;
+}
+
+const SimPeripheral_t SimCrc = {
+	.name = "crc",
+	.base = CRC_BASEADDR,
+	.size = sizeof(CRC_TypeDef_t),
+	.Init = SimCrc_Init,
+	.Write = SimCrc_Write,
+};
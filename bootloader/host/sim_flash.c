@@ -0,0 +1,260 @@
+/*
+ * sim_flash.c
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: nphuc
+ */
+
+#define _GNU_SOURCE
+#include "sim.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Flash memory and its programming interface. The 128 KB are a file mapped at
+ * FLASH_BASEADDR, followed by the erase count of every page, so wear adds up
+ * over runs. Half-words are programmed and pages erased with the typical times
+ * of the datasheet, a write while the flash is busy stalls the bus until it is
+ * done. Programming a half-word that is not erased fails with PGERR, unless it
+ * is programmed to 0.
+ */
+#define SIM_FLASH_SIZE							(FLASH_END - FLASH_BASEADDR)
+#define SIM_FLASH_PAGES							(SIM_FLASH_SIZE / FLASH_PAGE_SIZE)
+#define SIM_FLASH_FILE_SIZE						(SIM_FLASH_SIZE + 4096)		/* wear table on its own host page*/
+#define SIM_FLASH_PROGRAM_NS					52500		/* tPROG*/
+#define SIM_FLASH_ERASE_NS						20000000	/* tERASE*/
+#define SIM_FLASH_MASS_ERASE_NS					20000000	/* tME*/
+#define SIM_FLASH_ENDURANCE						10000		/* erase cycles*/
+#define SIM_FLASH_KEY1							0x45670123U
+#define SIM_FLASH_KEY2							0xCDEF89ABU
+#define SIM_UPDATE_FLAG_ADDRESS					0x08011C00U	/* APP_CURRENT_FLAG in Src/main.c*/
+
+#define SIM_FLASH_SR_W1C						((1U << FLASH_SR_PGERR) | (1U << FLASH_SR_WRPRTERR) | (1U << FLASH_SR_EOP))
+
+typedef enum
+{
+	SIM_FLASH_IDLE,
+	SIM_FLASH_PROGRAM,
+	SIM_FLASH_ERASE,
+	SIM_FLASH_MASS_ERASE
+} SimFlashOp_t;
+
+static uint8_t *pFlash;				/* untrapped view */
+static uint32_t *pWear;				/* erase count per page */
+static SimFlashOp_t op = SIM_FLASH_IDLE;
+static uint32_t op_page;
+static uint64_t op_end = SIM_NEVER;
+static uint8_t key_state;
+
+static struct
+{
+	uint32_t erases;
+	uint32_t programs;
+	uint32_t refused;
+	uint64_t busy_ns;
+} stats;
+
+/*
+ * Flash memory
+ */
+
+static void SimFlash_MemoryInit(void)
+{
+	struct stat info;
+	int fd = open(sim_config.flash_path, O_RDWR | O_CREAT, 0644);
+
+	if(fd < 0 || fstat(fd, &info) != 0) {
+		perror(sim_config.flash_path);
+		exit(1);
+	}
+	uint8_t fresh = (info.st_size == 0);
+	if(fresh && ftruncate(fd, SIM_FLASH_FILE_SIZE) != 0) {
+		perror(sim_config.flash_path);
+		exit(1);
+	}
+	if(!fresh && info.st_size != SIM_FLASH_FILE_SIZE) {
+		fprintf(stderr, "sim: %s is not a flash image of this simulator\n", sim_config.flash_path);
+		exit(1);
+	}
+
+	pFlash = mmap(NULL, SIM_FLASH_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	pWear = (uint32_t *)(pFlash + SIM_FLASH_SIZE);
+	if(fresh || sim_config.erase) {
+		memset(pFlash, 0xFF, SIM_FLASH_SIZE);
+	}
+	if(sim_config.update_flag) {
+		pFlash[SIM_UPDATE_FLAG_ADDRESS - FLASH_BASEADDR] = 0x01;
+		pFlash[SIM_UPDATE_FLAG_ADDRESS - FLASH_BASEADDR + 1] = 0x00;
+	}
+
+	Sim_MapRegion(FLASH_BASEADDR, SIM_FLASH_SIZE, PROT_READ, fd, pFlash);
+	close(fd);
+}
+
+static void SimFlash_Start(SimFlashOp_t operation, uint32_t page, uint64_t duration)
+{
+	op = operation;
+	op_page = page;
+	op_end = Sim_Now() + duration;
+	stats.busy_ns += duration;
+	SIM_REG(FLASH->SR) |= (1 << FLASH_SR_BSY);
+}
+
+static void SimFlash_MemoryWrite(uintptr_t address, uint32_t old, uint32_t value)
+{
+	uint32_t offset = (address & ~3UL) - FLASH_BASEADDR;
+	uint8_t shift = (address & 2) * 8;
+	uint16_t current = old >> shift;
+	uint16_t data = value >> shift;
+	uint32_t cr = SIM_REG(FLASH->CR);
+
+	/* the write stays only once it is programmed */
+	memcpy(pFlash + offset, &old, sizeof(old));
+
+	if((address & 1) || ((old ^ value) & ~(0xFFFFU << shift))) {
+		Sim_Fault("flash written at %#lx other than by half-word", (unsigned long)address);
+	}
+	if((cr & (1 << FLASH_CR_LOCK)) || !(cr & (1 << FLASH_CR_PG))) {
+		Sim_Fault("flash written at %#lx without PG set", (unsigned long)address);
+	}
+
+	/* the bus waits for the operation in progress */
+	if(op != SIM_FLASH_IDLE) Sim_AdvanceTo(op_end);
+
+	if(current != 0xFFFF && data != 0) {
+		SIM_REG(FLASH->SR) |= (1 << FLASH_SR_PGERR);
+		stats.refused++;
+		return;
+	}
+	memcpy(pFlash + offset + (address & 2), &data, sizeof(data));
+	stats.programs++;
+	SimFlash_Start(SIM_FLASH_PROGRAM, 0, SIM_FLASH_PROGRAM_NS);
+}
+
+static void SimFlash_MemoryReport(FILE *pOut)
+{
+	uint32_t worn = 0;
+
+	for(uint32_t page = 1; page < SIM_FLASH_PAGES; page++) {
+		if(pWear[page] > pWear[worn]) worn = page;
+	}
+	fprintf(pOut, "flash: %u page erases, %u half-words programmed, %u refused, busy %.3f s\n",
+	        stats.erases, stats.programs, stats.refused, stats.busy_ns / 1e9);
+	fprintf(pOut, "flash: most worn page %#x with %u erases, %.2f%% of the %u cycles it is rated for\n",
+	        FLASH_BASEADDR + worn * FLASH_PAGE_SIZE, pWear[worn], 100.0 * pWear[worn] / SIM_FLASH_ENDURANCE,
+	        SIM_FLASH_ENDURANCE);
+}
+
+const SimPeripheral_t SimFlash_Memory = {
+	.name = "flash",
+	.base = FLASH_BASEADDR,
+	.size = SIM_FLASH_SIZE,
+	.Init = SimFlash_MemoryInit,
+	.Write = SimFlash_MemoryWrite,
+	.Report = SimFlash_MemoryReport,
+};
+
+/*
+ * Programming interface
+ */
+
+static void SimFlash_Erase(uint32_t page)
+{
+	memset(pFlash + page * FLASH_PAGE_SIZE, 0xFF, FLASH_PAGE_SIZE);
+	pWear[page]++;
+	stats.erases++;
+}
+
+static void SimFlash_InterfaceInit(void)
+{
+	SIM_REG(FLASH->CR) = (1 << FLASH_CR_LOCK);
+	SIM_REG(FLASH->OBR) = 0x03FFFFFC;
+	SIM_REG(FLASH->WRPR) = 0xFFFFFFFF;
+}
+
+static void SimFlash_InterfaceRead(uintptr_t address, uint8_t repeated)
+{
+	/* polling BSY, nothing changes until the operation is done */
+	if((address & ~3UL) == (uintptr_t)&FLASH->SR && repeated && op != SIM_FLASH_IDLE) {
+		Sim_Stall();
+	}
+}
+
+static void SimFlash_InterfaceWrite(uintptr_t address, uint32_t old, uint32_t value)
+{
+	address &= ~3UL;
+	if(address == (uintptr_t)&FLASH->KEYR) {
+		SIM_REG(FLASH->KEYR) = 0;
+		if(!(SIM_REG(FLASH->CR) & (1 << FLASH_CR_LOCK))) return;
+
+		if(key_state == 0 && value == SIM_FLASH_KEY1) {
+			key_state = 1;
+		} else if(key_state == 1 && value == SIM_FLASH_KEY2) {
+			key_state = 0;
+			SIM_REG(FLASH->CR) &= ~(1 << FLASH_CR_LOCK);
+		} else {
+			/* the chip locks the interface up to the next reset */
+			Sim_Fault("wrong flash key %#x", value);
+		}
+	} else if(address == (uintptr_t)&FLASH->SR) {
+		SIM_REG(FLASH->SR) = old & ~(value & SIM_FLASH_SR_W1C);
+	} else if(address == (uintptr_t)&FLASH->CR) {
+		if(old & (1 << FLASH_CR_LOCK)) {
+			SIM_REG(FLASH->CR) = old;
+			return;
+		}
+		if(value & (1 << FLASH_CR_LOCK)) key_state = 0;
+		if(!(value & ~old & (1 << FLASH_CR_STRT))) return;
+
+		if(op != SIM_FLASH_IDLE) Sim_AdvanceTo(op_end);
+		if(value & (1 << FLASH_CR_PER)) {
+			uint32_t page = (SIM_REG(FLASH->AR) - FLASH_BASEADDR) / FLASH_PAGE_SIZE;
+			if(page >= SIM_FLASH_PAGES) Sim_Fault("page erase at %#x, outside flash", SIM_REG(FLASH->AR));
+			SimFlash_Start(SIM_FLASH_ERASE, page, SIM_FLASH_ERASE_NS);
+		} else if(value & (1 << FLASH_CR_MER)) {
+			SimFlash_Start(SIM_FLASH_MASS_ERASE, 0, SIM_FLASH_MASS_ERASE_NS);
+		} else {
+			SIM_REG(FLASH->CR) &= ~(1 << FLASH_CR_STRT);
+		}
+	} else if(address == (uintptr_t)&FLASH->ACR) {
+		/* PRFTBS shows the prefetch buffer state */
+		SIM_REG(FLASH->ACR) = (value & ~(1 << FLASH_ACR_PRFTBS)) | (((value >> FLASH_ACR_PRFTBE) & 1) << FLASH_ACR_PRFTBS);
+	}
+}
+
+static uint64_t SimFlash_NextEvent(void)
+{
+	return op_end;
+}
+
+static void SimFlash_Run(void)
+{
+	if(op_end > Sim_Now()) return;
+
+	if(op == SIM_FLASH_ERASE) {
+		SimFlash_Erase(op_page);
+	} else if(op == SIM_FLASH_MASS_ERASE) {
+		for(uint32_t page = 0; page < SIM_FLASH_PAGES; page++) {
+			SimFlash_Erase(page);
+		}
+	}
+	op = SIM_FLASH_IDLE;
+	op_end = SIM_NEVER;
+	SIM_REG(FLASH->SR) = (SIM_REG(FLASH->SR) & ~(1 << FLASH_SR_BSY)) | (1 << FLASH_SR_EOP);
+	SIM_REG(FLASH->CR) &= ~(1 << FLASH_CR_STRT);
+}
+
+const SimPeripheral_t SimFlash_Interface = {
+	.name = "flash interface",
+	.base = (uintptr_t)FLASH,
+	.size = sizeof(FLASH_TypeDef_t),
+	.Init = SimFlash_InterfaceInit,
+	.Read = SimFlash_InterfaceRead,
+	.Write = SimFlash_InterfaceWrite,
+	.NextEvent = SimFlash_NextEvent,
+	.RunEvents = SimFlash_Run,
+};
@@ -0,0 +1,109 @@
+/*
+ * sim_rcc.c
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: nphuc
+ */
+
+#include "sim.h"
+
+/*
+ * Clock tree. Oscillators and the PLL are ready as soon as they are switched
+ * on (the board has its 8 MHz crystal), the system clock switches when its
+ * source is ready. Every change of HCLK goes to the simulated clock.
+ */
+#define SIM_RCC_CR_RESET						0x00000083U		/* HSI on and ready, trimmed*/
+#define SIM_RCC_CR_READY						((1U << RCC_CR_HSIRDY) | (1U << RCC_CR_HSERDY) | (1U << RCC_CR_PLLRDY))
+
+static const uint8_t AHB_Shift[8] = {1, 2, 3, 4, 6, 7, 8, 9};
+
+static uint32_t SimRcc_SYSCLK(void)
+{
+	uint32_t cfgr = SIM_REG(RCC->CFGR);
+
+	switch((cfgr >> RCC_CFGR_SWS) & 3) {
+		case RCC_SW_HSE:
+			return HSE_VALUE;
+		case RCC_SW_PLL:
+		{
+			uint32_t mul = ((cfgr >> RCC_CFGR_PLLMUL) & 0xF) + 2;
+			if(mul > 16) mul = 16;
+
+			uint32_t input = HSI_VALUE / 2;
+			if((cfgr >> RCC_CFGR_PLLSRC) & 1) {
+				input = ((cfgr >> RCC_CFGR_PLLXTPRE) & 1) ? HSE_VALUE / 2 : HSE_VALUE;
+			}
+			return input * mul;
+		}
+		default:
+			return HSI_VALUE;
+	}
+}
+
+uint32_t SimRcc_HCLK(void)
+{
+	uint32_t hpre = (SIM_REG(RCC->CFGR) >> RCC_CFGR_HPRE) & 0xF;
+
+	return (hpre & 0x8) ? SimRcc_SYSCLK() >> AHB_Shift[hpre & 0x7] : SimRcc_SYSCLK();
+}
+
+uint32_t SimRcc_PCLK2(void)
+{
+	uint32_t ppre = (SIM_REG(RCC->CFGR) >> RCC_CFGR_PPRE2) & 0x7;
+
+	return (ppre & 0x4) ? SimRcc_HCLK() >> ((ppre & 0x3) + 1) : SimRcc_HCLK();
+}
+
+static uint8_t SimRcc_SourceReady(uint8_t source)
+{
+	uint32_t cr = SIM_REG(RCC->CR);
+
+	switch(source) {
+		case RCC_SW_HSI: return (cr >> RCC_CR_HSIRDY) & 1;
+		case RCC_SW_HSE: return (cr >> RCC_CR_HSERDY) & 1;
+		case RCC_SW_PLL: return (cr >> RCC_CR_PLLRDY) & 1;
+		default: return 0;
+	}
+}
+
+static void SimRcc_Init(void)
+{
+	SIM_REG(RCC->CR) = SIM_RCC_CR_RESET;
+	SIM_REG(RCC->AHBENR) = 0x14;		/* SRAM and FLITF clocks */
+	Sim_SetHCLK(SimRcc_HCLK());
+}
+
+static void SimRcc_Write(uintptr_t address, uint32_t old, uint32_t value)
+{
+	address &= ~3UL;
+	if(address == (uintptr_t)&RCC->CR) {
+		uint32_t cr = value & ~SIM_RCC_CR_READY;
+		uint8_t pll_input = ((SIM_REG(RCC->CFGR) >> RCC_CFGR_PLLSRC) & 1) ? (cr >> RCC_CR_HSEON) & 1 : (cr >> RCC_CR_HSION) & 1;
+
+		cr |= ((cr >> RCC_CR_HSION) & 1) << RCC_CR_HSIRDY;
+		cr |= ((cr >> RCC_CR_HSEON) & 1) << RCC_CR_HSERDY;
+		cr |= (((cr >> RCC_CR_PLLON) & 1) & pll_input) << RCC_CR_PLLRDY;
+		SIM_REG(RCC->CR) = cr;
+	} else if(address == (uintptr_t)&RCC->CFGR) {
+		/* SWS follows SW once the source is ready */
+		uint8_t sw = (value >> RCC_CFGR_SW) & 3;
+		uint32_t sws = SimRcc_SourceReady(sw) ? sw : (old >> RCC_CFGR_SWS) & 3;
+		SIM_REG(RCC->CFGR) = (value & ~(3U << RCC_CFGR_SWS)) | (sws << RCC_CFGR_SWS);
+	}
+
+	if(SimRcc_HCLK() != Sim_HCLK()) Sim_SetHCLK(SimRcc_HCLK());
+}
+
+static void SimRcc_Report(FILE *pOut)
+{
+	fprintf(pOut, "rcc: HCLK %u Hz, PCLK2 %u Hz\n", SimRcc_HCLK(), SimRcc_PCLK2());
+}
+
+const SimPeripheral_t SimRcc = {
+	.name = "rcc",
+	.base = RCC_BASEADDR,
+	.size = sizeof(RCC_TypeDef_t),
+	.Init = SimRcc_Init,
+	.Write = SimRcc_Write,
+	.Report = SimRcc_Report,
+};
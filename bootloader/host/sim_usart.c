@@ -0,0 +1,484 @@
+/*
+ * sim_usart.c
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: nphuc
+ */
+
+#define _GNU_SOURCE
+#include "sim.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+/* termios output delays, they would shadow the USART control registers */
+#undef CR1
+#undef CR2
+#undef CR3
+
+/*
+ * USART1 and DMA1, the other end of the line is a pseudo-terminal. What the
+ * peer writes is queued and shifted in one frame time after the other at the
+ * rate the peer runs at, transmitted bytes go out when their stop bit is done.
+ * The line is polled every SIM_LINE_POLL_NS of simulated time and waited on in
+ * real time while the core sleeps. A peer more than SIM_BAUD_TOLERANCE off the
+ * USART rate gets garbage and framing errors, like on the wire.
+ */
+#define SIM_RX_QUEUE							65536
+#define SIM_LINE_POLL_NS						100000		/* 100 us*/
+#define SIM_BAUD_TOLERANCE						3			/* % between the two rates*/
+#define SIM_DMA_USART1_RX						5			/* channel USART1_RX is wired to*/
+
+#define SIM_USART_SR_RESET						((1U << USART_SR_TXE) | (1U << USART_SR_TC))
+#define SIM_USART_SR_RC_W0						((1U << USART_SR_RXNE) | (1U << USART_SR_TC) | (1U << USART_SR_LBD) | (1U << USART_SR_CTS))
+#define SIM_USART_SR_RX_ERRORS					((1U << USART_SR_PE) | (1U << USART_SR_FE) | (1U << USART_SR_NE) | (1U << USART_SR_ORE))
+
+static int master = -1;
+static int slave = -1;
+
+static uint8_t rx_queue[SIM_RX_QUEUE];
+static uint32_t rx_head;
+static uint32_t rx_count;
+static uint64_t rx_next = SIM_NEVER;		/* end of the frame being received */
+static uint64_t line_free;					/* end of the last received frame */
+static uint64_t idle_at = SIM_NEVER;
+static uint64_t poll_at;
+static uint16_t rx_data;					/* what DR reads */
+
+static uint8_t shifting;
+static uint8_t tx_shift;
+static uint8_t tdr_full;
+static uint8_t tdr;
+static uint64_t tx_end = SIM_NEVER;
+
+static uint32_t noise_state;
+static uint16_t dma_reload[7];
+
+static struct
+{
+	uint64_t in;
+	uint64_t out;
+	uint64_t dma;
+	uint32_t corrupted;
+	uint32_t lost;
+	uint32_t overruns;
+	uint32_t dropped;
+	uint64_t first_in;
+	uint64_t last_in;
+} stats = { .first_in = SIM_NEVER };
+
+/*
+ * Line timing
+ */
+
+static uint32_t SimUsart_Baud(void)
+{
+	uint32_t brr = SIM_REG(USART1->BRR) & 0xFFFF;
+
+	return (brr < 16) ? 0 : SimRcc_PCLK2() / brr;
+}
+
+static uint32_t SimUsart_PeerBaud(void)
+{
+	struct termios settings;
+
+	if(sim_config.peer_baud == SIM_PEER_BAUD_FOLLOW) return SimUsart_Baud();
+	if(sim_config.peer_baud != SIM_PEER_BAUD_PTY) return sim_config.peer_baud;
+
+	/* the settings of the slave, the peer made them */
+	if(tcgetattr(master, &settings) != 0) return SimUsart_Baud();
+	switch(cfgetispeed(&settings)) {
+		case B1200: return 1200;
+		case B2400: return 2400;
+		case B4800: return 4800;
+		case B9600: return 9600;
+		case B19200: return 19200;
+		case B38400: return 38400;
+		case B57600: return 57600;
+		case B115200: return 115200;
+		case B230400: return 230400;
+		case B460800: return 460800;
+		case B921600: return 921600;
+		case B1000000: return 1000000;
+		case B2000000: return 2000000;
+		case B3000000: return 3000000;
+		case B4000000: return 4000000;
+		default: return 0;
+	}
+}
+
+static uint64_t SimUsart_FrameNs(uint32_t baud)
+{
+	static const uint8_t stop_halves[4] = {2, 1, 4, 3};
+	uint32_t cr1 = SIM_REG(USART1->CR1);
+	uint32_t halves = 2 * (1 + 8 + ((cr1 >> USART_CR1_M) & 1)) + stop_halves[(SIM_REG(USART1->CR2) >> USART_CR2_STOP) & 3];
+
+	return baud ? halves * SIM_NS_PER_S / (2ULL * baud) : SIM_NEVER;
+}
+
+static uint8_t SimUsart_RatesMatch(void)
+{
+	uint32_t usart = SimUsart_Baud();
+	uint32_t peer = SimUsart_PeerBaud();
+
+	if(!usart || !peer) return 0;
+	return (uint64_t)(usart > peer ? usart - peer : peer - usart) * 100 <= (uint64_t)peer * SIM_BAUD_TOLERANCE;
+}
+
+static uint8_t SimUsart_Receiving(void)
+{
+	uint32_t cr1 = SIM_REG(USART1->CR1);
+
+	return (cr1 & (1 << USART_CR1_UE)) && (cr1 & (1 << USART_CR1_RE)) && SimUsart_Baud();
+}
+
+static uint32_t SimUsart_Random(void)
+{
+	/* xorshift32 */
+	noise_state ^= noise_state << 13;
+	noise_state ^= noise_state >> 17;
+	noise_state ^= noise_state << 5;
+	return noise_state;
+}
+
+/*
+ * Interrupt lines
+ */
+
+static void SimUsart_UpdateIRQ(void)
+{
+	uint32_t sr = SIM_REG(USART1->SR);
+	uint32_t cr1 = SIM_REG(USART1->CR1);
+	uint8_t level = 0;
+
+	if((sr & ((1 << USART_SR_RXNE) | (1 << USART_SR_ORE))) && (cr1 & (1 << USART_CR1_RXNEIE))) level = 1;
+	if((sr & (1 << USART_SR_IDLE)) && (cr1 & (1 << USART_CR1_IDLEIE))) level = 1;
+	if((sr & (1 << USART_SR_TXE)) && (cr1 & (1 << USART_CR1_TXEIE))) level = 1;
+	if((sr & (1 << USART_SR_TC)) && (cr1 & (1 << USART_CR1_TCIE))) level = 1;
+	SimCore_IRQLine(IRQ_NO_USART1, level);
+
+	/* TCIE, HTIE and TEIE sit right above EN like TCIF, HTIF and TEIF above GIF */
+	uint32_t flags = SIM_REG(DMA1->ISR) >> (4 * (SIM_DMA_USART1_RX - 1));
+	uint32_t ccr = SIM_REG(DMA1->CH[SIM_DMA_USART1_RX - 1].CCR);
+	SimCore_IRQLine(IRQ_NO_DMA1_CH5, (flags & ccr & 0xE) != 0);
+}
+
+/*
+ * Reception
+ */
+
+static void SimUsart_SetDMAFlag(uint8_t channel, uint8_t flag)
+{
+	SIM_REG(DMA1->ISR) |= (1U << (4 * (channel - 1) + flag)) | (1U << (4 * (channel - 1) + DMA_FLAG_GIF));
+}
+
+/* the DMA takes the byte out of DR as soon as it is there, 0 if it does not */
+static uint8_t SimUsart_DMATransfer(uint8_t byte)
+{
+	DMA_Channel_TypeDef_t *pChannel = &DMA1->CH[SIM_DMA_USART1_RX - 1];
+	uint32_t ccr = SIM_REG(pChannel->CCR);
+	uint32_t count = SIM_REG(pChannel->CNDTR) & 0xFFFF;
+	uint16_t reload = dma_reload[SIM_DMA_USART1_RX - 1];
+
+	if(!(SIM_REG(USART1->CR3) & (1 << USART_CR3_DMAR)) || !(ccr & (1 << DMA_CCR_EN)) || !count) return 0;
+	if(SIM_REG(pChannel->CPAR) != (uint32_t)(uintptr_t)&USART1->DR || (ccr & (1 << DMA_CCR_DIR))) return 0;
+
+	uint32_t offset = (ccr & (1 << DMA_CCR_MINC)) ? reload - count : 0;
+	*(uint8_t *)(uintptr_t)(SIM_REG(pChannel->CMAR) + offset) = byte;
+	stats.dma++;
+
+	count--;
+	if(count == reload / 2) SimUsart_SetDMAFlag(SIM_DMA_USART1_RX, DMA_FLAG_HTIF);
+	if(count == 0) {
+		SimUsart_SetDMAFlag(SIM_DMA_USART1_RX, DMA_FLAG_TCIF);
+		if(ccr & (1 << DMA_CCR_CIRC)) count = reload;
+	}
+	SIM_REG(pChannel->CNDTR) = count;
+	return 1;
+}
+
+static void SimUsart_Receive(uint8_t byte)
+{
+	uint32_t errors = 0;
+
+	if(!SimUsart_RatesMatch()) {
+		byte = SimUsart_Random();
+		errors = (1 << USART_SR_FE);
+		stats.corrupted++;
+	} else if(sim_config.noise_ppm && SimUsart_Random() % 1000000 < sim_config.noise_ppm) {
+		byte ^= 1 << (SimUsart_Random() % 8);
+		stats.corrupted++;
+	}
+
+	if(SimUsart_DMATransfer(byte)) {
+		SIM_REG(USART1->SR) |= errors;
+	} else if(SIM_REG(USART1->SR) & (1 << USART_SR_RXNE)) {
+		/* the byte before was not read, this one is lost */
+		SIM_REG(USART1->SR) |= (1 << USART_SR_ORE);
+		stats.overruns++;
+	} else {
+		rx_data = byte;
+		SIM_REG(USART1->DR) = rx_data;
+		SIM_REG(USART1->SR) |= (1 << USART_SR_RXNE) | errors;
+	}
+}
+
+void SimUsart_PollLine(void)
+{
+	uint8_t buffer[4096];
+	ssize_t length;
+
+	while(rx_count < SIM_RX_QUEUE) {
+		uint32_t space = SIM_RX_QUEUE - rx_count;
+		length = read(master, buffer, space < sizeof(buffer) ? space : sizeof(buffer));
+		if(length <= 0) break;
+
+		if(!SimUsart_Receiving()) {
+			/* nobody listens on the wire */
+			stats.lost += length;
+			continue;
+		}
+		if(stats.first_in == SIM_NEVER) stats.first_in = Sim_Now();
+		if(!rx_count) {
+			uint64_t start = line_free > Sim_Now() ? line_free : Sim_Now();
+			rx_next = start + SimUsart_FrameNs(SimUsart_PeerBaud());
+		}
+		for(ssize_t i = 0; i < length; i++) {
+			rx_queue[(rx_head + rx_count++) % SIM_RX_QUEUE] = buffer[i];
+		}
+	}
+}
+
+uint64_t SimUsart_WaitLine(uint64_t max_ns)
+{
+	struct pollfd line = { .fd = master, .events = POLLIN };
+	struct timespec start, end, timeout;
+
+	/* bytes already queued arrive in simulated time */
+	if(rx_count || max_ns == 0) return max_ns;
+
+	timeout.tv_sec = max_ns / SIM_NS_PER_S;
+	timeout.tv_nsec = max_ns % SIM_NS_PER_S;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if(ppoll(&line, 1, (max_ns == SIM_NEVER) ? NULL : &timeout, NULL) <= 0) return max_ns;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	uint64_t waited = (end.tv_sec - start.tv_sec) * SIM_NS_PER_S + end.tv_nsec - start.tv_nsec;
+	return waited < max_ns ? waited : max_ns;
+}
+
+/*
+ * Transmission
+ */
+
+static void SimUsart_Shift(uint8_t byte)
+{
+	shifting = 1;
+	tx_shift = byte;
+	tx_end = Sim_Now() + SimUsart_FrameNs(SimUsart_Baud());
+	SIM_REG(USART1->SR) &= ~(1 << USART_SR_TC);
+}
+
+static void SimUsart_Transmitted(void)
+{
+	uint8_t byte = SimUsart_RatesMatch() ? tx_shift : SimUsart_Random();
+
+	if(write(master, &byte, 1) == 1) {
+		stats.out++;
+	} else {
+		/* the peer does not read, the pty is full */
+		stats.dropped++;
+	}
+	if(tdr_full) {
+		tdr_full = 0;
+		SimUsart_Shift(tdr);
+		SIM_REG(USART1->SR) |= (1 << USART_SR_TXE);
+	} else {
+		shifting = 0;
+		tx_end = SIM_NEVER;
+		SIM_REG(USART1->SR) |= (1 << USART_SR_TC);
+	}
+}
+
+/*
+ * USART1
+ */
+
+static void SimUsart_Init(void)
+{
+	struct termios settings;
+
+	master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if(master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+		perror("sim: pty");
+		exit(1);
+	}
+	/* held open so the line does not hang up between two peers */
+	slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+	if(slave < 0 || tcgetattr(slave, &settings) != 0) {
+		perror("sim: pty");
+		exit(1);
+	}
+	cfmakeraw(&settings);
+	cfsetspeed(&settings, B115200);
+	tcsetattr(slave, TCSANOW, &settings);
+
+	if(sim_config.link_path) {
+		unlink(sim_config.link_path);
+		if(symlink(ptsname(master), sim_config.link_path) != 0) {
+			perror(sim_config.link_path);
+			exit(1);
+		}
+	}
+	fprintf(stderr, "sim: USART1 is %s\n", sim_config.link_path ? sim_config.link_path : ptsname(master));
+
+	noise_state = sim_config.seed ? sim_config.seed : 1;
+	SIM_REG(USART1->SR) = SIM_USART_SR_RESET;
+}
+
+static void SimUsart_Read(uintptr_t address, uint8_t repeated)
+{
+	address &= ~3UL;
+	if(address == (uintptr_t)&USART1->SR && repeated) {
+		/* polling a flag, only an event sets it */
+		Sim_Stall();
+	} else if(address == (uintptr_t)&USART1->DR) {
+		/* SR then DR clears the receive flags */
+		SIM_REG(USART1->SR) &= ~((1 << USART_SR_RXNE) | (1 << USART_SR_IDLE) | SIM_USART_SR_RX_ERRORS);
+		SIM_REG(USART1->DR) = rx_data;
+		SimUsart_UpdateIRQ();
+	}
+}
+
+static void SimUsart_Write(uintptr_t address, uint32_t old, uint32_t value)
+{
+	address &= ~3UL;
+	if(address == (uintptr_t)&USART1->DR) {
+		uint32_t cr1 = SIM_REG(USART1->CR1);
+		SIM_REG(USART1->DR) = rx_data;
+
+		if(!(cr1 & (1 << USART_CR1_UE)) || !(cr1 & (1 << USART_CR1_TE))) return;
+		if(!shifting) {
+			SimUsart_Shift(value);
+		} else if(!tdr_full) {
+			tdr = value;
+			tdr_full = 1;
+			SIM_REG(USART1->SR) &= ~(1 << USART_SR_TXE);
+		} else {
+			/* written while TXE was 0, the byte in TDR is overwritten */
+			tdr = value;
+		}
+	} else if(address == (uintptr_t)&USART1->SR) {
+		SIM_REG(USART1->SR) = old & (value | ~SIM_USART_SR_RC_W0);
+	}
+	SimUsart_UpdateIRQ();
+}
+
+static uint64_t SimUsart_NextEvent(void)
+{
+	uint64_t next = poll_at;
+
+	if(rx_next < next) next = rx_next;
+	if(idle_at < next) next = idle_at;
+	if(tx_end < next) next = tx_end;
+	return next;
+}
+
+static void SimUsart_Run(void)
+{
+	uint64_t now = Sim_Now();
+
+	while(rx_next <= now) {
+		uint8_t byte = rx_queue[rx_head];
+		uint64_t frame = SimUsart_FrameNs(SimUsart_PeerBaud());
+
+		rx_head = (rx_head + 1) % SIM_RX_QUEUE;
+		rx_count--;
+		stats.in++;
+		stats.last_in = rx_next;
+		SimUsart_Receive(byte);
+
+		line_free = rx_next;
+		idle_at = line_free + frame;
+		rx_next = rx_count ? rx_next + frame : SIM_NEVER;
+	}
+	if(idle_at <= now) {
+		idle_at = SIM_NEVER;
+		SIM_REG(USART1->SR) |= (1 << USART_SR_IDLE);
+	}
+	if(tx_end <= now) {
+		SimUsart_Transmitted();
+	}
+	if(poll_at <= now) {
+		SimUsart_PollLine();
+		poll_at = now + SIM_LINE_POLL_NS;
+	}
+	SimUsart_UpdateIRQ();
+}
+
+static void SimUsart_Report(FILE *pOut)
+{
+	fprintf(pOut, "usart1: %llu bytes in (%llu by DMA), %llu out, %u corrupted, %u overruns, %u lost, %u dropped\n",
+	        (unsigned long long)stats.in, (unsigned long long)stats.dma, (unsigned long long)stats.out,
+	        stats.corrupted, stats.overruns, stats.lost, stats.dropped);
+	if(stats.in && stats.last_in > stats.first_in) {
+		double span = (stats.last_in - stats.first_in) / 1e9;
+		fprintf(pOut, "usart1: first byte in at %.6f s, last at %.6f s, %.0f bytes/s while receiving\n",
+		        stats.first_in / 1e9, stats.last_in / 1e9, stats.in / span);
+	}
+}
+
+const SimPeripheral_t SimUsart_USART1 = {
+	.name = "usart1",
+	.base = USART1_BASEADDR,
+	.size = sizeof(USART_TypeDef_t),
+	.Init = SimUsart_Init,
+	.Read = SimUsart_Read,
+	.Write = SimUsart_Write,
+	.NextEvent = SimUsart_NextEvent,
+	.RunEvents = SimUsart_Run,
+	.Report = SimUsart_Report,
+};
+
+/*
+ * DMA1
+ */
+
+static void SimUsart_DMAWrite(uintptr_t address, uint32_t old, uint32_t value)
+{
+	address &= ~3UL;
+	if(address == (uintptr_t)&DMA1->IFCR) {
+		uint32_t clear = value;
+		for(uint8_t channel = 0; channel < 7; channel++) {
+			/* GIF clears all flags of the channel */
+			if(value & (1U << (4 * channel + DMA_FLAG_GIF))) clear |= 0xFU << (4 * channel);
+		}
+		SIM_REG(DMA1->ISR) &= ~clear;
+		SIM_REG(DMA1->IFCR) = 0;
+	} else if(address == (uintptr_t)&DMA1->ISR) {
+		SIM_REG(DMA1->ISR) = old;
+	} else {
+		uint8_t channel = (address - (uintptr_t)&DMA1->CH[0]) / sizeof(DMA_Channel_TypeDef_t);
+		DMA_Channel_TypeDef_t *pChannel = &DMA1->CH[channel];
+		uint32_t ccr = SIM_REG(pChannel->CCR);
+
+		if(address == (uintptr_t)&pChannel->CCR && (value & ~old & (1 << DMA_CCR_EN))) {
+			dma_reload[channel] = SIM_REG(pChannel->CNDTR);
+		} else if(address == (uintptr_t)&pChannel->CNDTR) {
+			/* read only while the channel runs */
+			SIM_REG(pChannel->CNDTR) = (ccr & (1 << DMA_CCR_EN)) ? old : value & 0xFFFF;
+		}
+	}
+	SimUsart_UpdateIRQ();
+}
+
+const SimPeripheral_t SimUsart_DMA1 = {
+	.name = "dma1",
+	.base = DMA1_BASEADDR,
+	.size = sizeof(DMA_TypeDef_t),
+	.Write = SimUsart_DMAWrite,
+};